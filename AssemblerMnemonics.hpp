@@ -11,7 +11,7 @@
 
 const std::map<UInt8, std::string> disassembler_03 = {
 	{0, "LB"}, {1, "LH"}, {2, "LW"}, {3, "LD"},
-	{4, "LBU"}, {5, "LHU"}, {6, "LWU"}
+	{4, "LBU"}, {5, "LHU"}, {6, "LWU"}, {7, "LDU"}
 };
 
 const std::map<UInt8, std::string> disassembler_07 = {
@@ -23,7 +23,8 @@ const std::map<UInt8, std::string> disassembler_0F = {
 };
 
 const std::map<UInt8, std::string> disassembler_23 = {
-	{0, "SB"}, {1, "SH"}, {2, "SW"}, {3, "SD"}
+	{0, "SB"}, {1, "SH"}, {2, "SW"}, {3, "SD"},
+	{4, "SQ"}
 };
 
 const std::map<UInt8, std::string> disassembler_27 = {
@@ -31,7 +32,7 @@ const std::map<UInt8, std::string> disassembler_27 = {
 };
 
 const std::map<UInt8, std::string> disassembler_2F = {
-	{2, "W"}, {3, "D"}
+	{2, "W"}, {3, "D"}, {4, "Q"}
 };
 
 const std::map<UInt8, std::string> disassembler_2F_2 = {
@@ -105,6 +106,13 @@ const std::map<UInt8, std::string> disassembler_73_2 = {
 	{1, "FSFLAGS"}, {2, "FSRM"}, {3, "FSCSR"}
 };
 
+const std::map<UInt8, std::string> disassembler_77 = {
+	{0x00, "RADD"}, {0x01, "RSUB"}, {0x08, "KADD"}, {0x09, "KSUB"},
+	{0x10, "URADD"}, {0x11, "URSUB"}, {0x18, "UKADD"}, {0x19, "UKSUB"},
+	{0x20, "ADD"}, {0x21, "SUB"}, {0x40, "SMIN"}, {0x41, "SMAX"},
+	{0x43, "KHM"}, {0x48, "UMIN"}, {0x49, "UMAX"}
+};
+
 const std::map<UInt8, std::string> disassembler_IntRegABINames = {
 	{0, "zero"}, {1, "ra"}, {2, "fp"}, {3, "s1"}, {4, "s2"}, {5, "s3"}, {6, "s4"}, {7, "s5"},
 	{8, "s6"}, {9, "s7"}, {10, "s8"}, {11, "s9"}, {12, "s10"}, {13, "s11"}, {14, "sp"}, {15, "tp"},
@@ -149,11 +157,13 @@ const std::map<std::string, UInt8> assembler_instructions = {
 	{"LBU", 0x03},
 	{"LHU", 0x03},
 	{"LWU", 0x03},
+	{"LDU", 0x03},
 
 	{"FLW", 0x07},
 	{"FLD", 0x07},
 
 	{"FENCE", 0x0F},
+	{"LQ", 0x0F},
 
 	{"ADDI", 0x13},
 	{"SLTI", 0x13},
@@ -181,6 +191,7 @@ const std::map<std::string, UInt8> assembler_instructions = {
 	{"SH", 0x23},
 	{"SW", 0x23},
 	{"SD", 0x23},
+	{"SQ", 0x23},
 
 	{"FSW", 0x27},
 	{"FSD", 0x27},
@@ -230,6 +241,22 @@ const std::map<std::string, UInt8> assembler_instructions = {
 	{"REMW", 0x3B},
 	{"REMUW", 0x3B},
 
+	{"ADDID", 0x5B},
+	{"SLLID", 0x5B},
+	{"SRLID", 0x5B},
+	{"SRAID", 0x5B},
+
+	{"ADDD", 0x7B},
+	{"SUBD", 0x7B},
+	{"SLLD", 0x7B},
+	{"SRLD", 0x7B},
+	{"SRAD", 0x7B},
+	{"MULD", 0x7B},
+	{"DIVD", 0x7B},
+	{"DIVUD", 0x7B},
+	{"REMD", 0x7B},
+	{"REMUD", 0x7B},
+
 	{"FMADD", 0x43},
 	{"FMSUB", 0x47},
 	{"FNMSUB", 0x4B},
@@ -254,6 +281,10 @@ const std::map<std::string, UInt8> assembler_instructions = {
 	{"FNEG", 0x53},
 	{"FABS", 0x53},
 
+	{"VSETVLI", 0x57},
+	{"VSETIVLI", 0x57},
+	{"VSETVL", 0x57},
+
 	{"BEQ", 0x63},
 	{"BNE", 0x63},
 	{"BLT", 0x63},
@@ -295,5 +326,46 @@ const std::map<std::string, UInt8> assembler_instructions = {
 	{"MRTS", 0x73},
 	{"MRTH", 0x73},
 	{"HRTS", 0x73},
-	{"WFI", 0x73}
+	{"WFI", 0x73},
+
+	{"RADD8", 0x77},
+	{"RADD16", 0x77},
+	{"RADD32", 0x77},
+	{"RSUB8", 0x77},
+	{"RSUB16", 0x77},
+	{"RSUB32", 0x77},
+	{"KADD8", 0x77},
+	{"KADD16", 0x77},
+	{"KADD32", 0x77},
+	{"KSUB8", 0x77},
+	{"KSUB16", 0x77},
+	{"KSUB32", 0x77},
+	{"URADD8", 0x77},
+	{"URADD16", 0x77},
+	{"URADD32", 0x77},
+	{"URSUB8", 0x77},
+	{"URSUB16", 0x77},
+	{"URSUB32", 0x77},
+	{"UKADD8", 0x77},
+	{"UKADD16", 0x77},
+	{"UKADD32", 0x77},
+	{"UKSUB8", 0x77},
+	{"UKSUB16", 0x77},
+	{"UKSUB32", 0x77},
+	{"ADD8", 0x77},
+	{"ADD16", 0x77},
+	{"ADD32", 0x77},
+	{"SUB8", 0x77},
+	{"SUB16", 0x77},
+	{"SUB32", 0x77},
+	{"SMIN8", 0x77},
+	{"SMIN16", 0x77},
+	{"SMAX8", 0x77},
+	{"SMAX16", 0x77},
+	{"KHM8", 0x77},
+	{"KHM16", 0x77},
+	{"UMIN8", 0x77},
+	{"UMIN16", 0x77},
+	{"UMAX8", 0x77},
+	{"UMAX16", 0x77}
 };
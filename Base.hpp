@@ -14,6 +14,7 @@
 #include <map>
 #include <thread>
 #include <mutex>
+#include <cstring>
 #include <inttypes.h>
 
 typedef __uint8_t UInt8;
@@ -92,11 +93,28 @@ UInt8 ctz(unsigned_type value) {
 	else if(sizeof(unsigned_type) <= 8)
 		return __builtin_ctzll(value);
 	else if(sizeof(unsigned_type) <= 16) {
-		auto upper = static_cast<UInt128>(value)>>64;
-		return (upper) ? __builtin_ctzll(upper) : 64+__builtin_ctzll(value&TrailingBitMask<unsigned_type>(64));
+		UInt64 lower = value;
+		return (lower) ? __builtin_ctzll(lower) : 64+__builtin_ctzll(static_cast<UInt128>(value)>>64);
 	}
 }
 
+template<typename unsigned_type>
+unsigned_type multiplyHigh(unsigned_type a, unsigned_type b) {
+	typedef typename Integer<sizeof(unsigned_type)*16>::unsigned_type wide_type;
+	return (static_cast<wide_type>(a)*static_cast<wide_type>(b))>>(sizeof(unsigned_type)*8);
+}
+
+inline UInt128 multiplyHigh(UInt128 a, UInt128 b) {
+	// Schoolbook multiplication of two 64 bit limbs each
+	UInt128 aLow = static_cast<UInt64>(a), aHigh = a>>64,
+	        bLow = static_cast<UInt64>(b), bHigh = b>>64;
+	if(aHigh == 0 && bHigh == 0)
+		return 0;
+	UInt128 low = aLow*bLow, middleA = aHigh*bLow, middleB = aLow*bHigh,
+	        carry = ((low>>64)+static_cast<UInt64>(middleA)+static_cast<UInt64>(middleB))>>64;
+	return aHigh*bHigh+(middleA>>64)+(middleB>>64)+carry;
+}
+
 namespace std {
 	template<bool condition, typename TrueType, TrueType trueValue, typename FalseType, FalseType falseValue>
 	struct conditional_value : std::conditional<condition,
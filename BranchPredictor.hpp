@@ -0,0 +1,294 @@
+#ifndef BRANCH_PREDICTOR
+#define BRANCH_PREDICTOR
+
+#include "Cache.hpp"
+
+// Predicts the direction of conditional branches from their address and
+// the global history of the previous outcomes (most recent in bit 0).
+
+class DirectionPredictor {
+    public:
+    virtual ~DirectionPredictor() { }
+    virtual bool predict(AddressType pc, UInt64 history) = 0;
+    virtual void update(AddressType pc, UInt64 history, bool taken) = 0;
+
+    // Saturating counters: predict taken in the upper half of the range
+    template<typename type>
+    static void train(type& counter, bool taken, type min, type max) {
+        if(taken && counter < max)
+            ++counter;
+        else if(!taken && counter > min)
+            --counter;
+    }
+};
+
+// Two bit counters indexed by the branch address
+class BimodalPredictor : public DirectionPredictor {
+    public:
+    std::vector<UInt8> counters;
+
+    BimodalPredictor(UInt8 bits = 14) :counters(static_cast<size_t>(1)<<bits, 1) { }
+
+    UInt8& getCounter(AddressType pc) {
+        return counters[(pc>>1)&(counters.size()-1)];
+    }
+
+    bool predict(AddressType pc, UInt64) {
+        return getCounter(pc) >= 2;
+    }
+
+    void update(AddressType pc, UInt64, bool taken) {
+        train<UInt8>(getCounter(pc), taken, 0, 3);
+    }
+};
+
+// Two bit counters indexed by the branch address xor the global history
+class GsharePredictor : public DirectionPredictor {
+    public:
+    std::vector<UInt8> counters;
+
+    GsharePredictor(UInt8 bits = 14) :counters(static_cast<size_t>(1)<<bits, 1) { }
+
+    UInt8& getCounter(AddressType pc, UInt64 history) {
+        return counters[((pc>>1)^history)&(counters.size()-1)];
+    }
+
+    bool predict(AddressType pc, UInt64 history) {
+        return getCounter(pc, history) >= 2;
+    }
+
+    void update(AddressType pc, UInt64 history, bool taken) {
+        train<UInt8>(getCounter(pc, history), taken, 0, 3);
+    }
+};
+
+// A small TAGE: A bimodal base predictor and tagged tables which use
+// geometrically increasing lengths of the global history. The table with
+// the longest matching history provides the prediction. After a
+// misprediction an entry is allocated in a table with a longer history.
+class TagePredictor : public DirectionPredictor {
+    public:
+    const static UInt8 Tables = 4, IndexBits = 10, TagBits = 9;
+    struct Entry {
+        UInt16 tag;
+        Int8 counter;
+        UInt8 useful;
+    };
+    BimodalPredictor base;
+    std::vector<Entry> tables[Tables];
+    UInt8 historyLengths[Tables] = { 5, 12, 27, 64 };
+
+    TagePredictor() :base(13) {
+        for(UInt8 table = 0; table < Tables; ++table)
+            tables[table].assign(static_cast<size_t>(1)<<IndexBits, { 0, 0, 0 });
+    }
+
+    static UInt64 fold(UInt64 history, UInt8 length, UInt8 bits) {
+        if(length < 64)
+            history &= (static_cast<UInt64>(1)<<length)-1;
+        UInt64 folded = 0;
+        for(; history; history >>= bits)
+            folded ^= history&((static_cast<UInt64>(1)<<bits)-1);
+        return folded;
+    }
+
+    Entry& getEntry(UInt8 table, AddressType pc, UInt64 history) {
+        UInt64 index = ((pc>>1)^(pc>>(IndexBits+1))^fold(history, historyLengths[table], IndexBits))&((1<<IndexBits)-1);
+        return tables[table][index];
+    }
+
+    UInt16 getTag(UInt8 table, AddressType pc, UInt64 history) {
+        return ((pc>>1)^(fold(history, historyLengths[table], TagBits)<<1)^table)&((1<<TagBits)-1);
+    }
+
+    // Returns the index of the providing table or Tables for the base
+    UInt8 findProvider(AddressType pc, UInt64 history) {
+        for(UInt8 table = Tables; table > 0; --table)
+            if(getEntry(table-1, pc, history).tag == getTag(table-1, pc, history))
+                return table-1;
+        return Tables;
+    }
+
+    bool predict(AddressType pc, UInt64 history) {
+        UInt8 provider = findProvider(pc, history);
+        return (provider == Tables) ? base.predict(pc, history) : getEntry(provider, pc, history).counter >= 0;
+    }
+
+    void update(AddressType pc, UInt64 history, bool taken) {
+        UInt8 provider = findProvider(pc, history);
+        bool prediction;
+        if(provider == Tables) {
+            prediction = base.predict(pc, history);
+            base.update(pc, history, taken);
+        }else{
+            Entry& entry = getEntry(provider, pc, history);
+            prediction = entry.counter >= 0;
+            train<Int8>(entry.counter, taken, -4, 3);
+            if(prediction == taken && entry.useful < 3)
+                ++entry.useful;
+            else if(prediction != taken && entry.useful > 0)
+                --entry.useful;
+        }
+        if(prediction == taken)
+            return;
+        bool allocated = false;
+        for(UInt8 table = (provider == Tables) ? 0 : provider+1; table < Tables; ++table) {
+            Entry& entry = getEntry(table, pc, history);
+            if(entry.useful == 0 && !allocated) {
+                entry = { getTag(table, pc, history), static_cast<Int8>((taken) ? 0 : -1), 0 };
+                allocated = true;
+            }else if(entry.useful > 0 && !allocated)
+                --entry.useful;
+        }
+    }
+};
+
+// Front end model: The direction predictor for conditional branches, a
+// return address stack for returns and a branch target buffer for the
+// targets of indirect jumps. Direct jumps are resolved when decoding, so
+// they are never mispredicted. Outcomes are recorded per branch address.
+
+class BranchPredictor {
+    public:
+    enum Kind {
+        Conditional,
+        Call,
+        Return,
+        Indirect,
+        Direct,
+        Kinds
+    };
+
+    struct Counters {
+        UInt64 executed, mispredicted;
+    };
+
+    struct TargetEntry {
+        AddressType pc, target;
+    };
+
+    const static UInt8 ReturnStackSize = 16;
+    std::unique_ptr<DirectionPredictor> direction;
+    std::vector<TargetEntry> targets;
+    AddressType returnStack[ReturnStackSize];
+    UInt8 returnStackTop;
+    UInt64 history;
+    bool chargeCycles;
+    UInt32 penalty;
+    UInt64 penaltyCycles;
+    Counters kinds[Kinds];
+    std::unordered_map<AddressType, Counters> sites;
+
+    BranchPredictor(DirectionPredictor* _direction = new GsharePredictor())
+        :direction(_direction), targets(4096, { 0, 0 }), returnStackTop(0), history(0),
+         chargeCycles(true), penalty(15), penaltyCycles(0) {
+        memset(returnStack, 0, sizeof(returnStack));
+        memset(kinds, 0, sizeof(kinds));
+    }
+
+    static DirectionPredictor* createDirectionPredictor(const std::string& name) {
+        if(name == "bimodal")
+            return new BimodalPredictor();
+        if(name == "gshare")
+            return new GsharePredictor();
+        if(name == "tage")
+            return new TagePredictor();
+        return NULL;
+    }
+
+    static bool isLinkRegister(UInt8 index) {
+        return index == 1 || index == 5;
+    }
+
+    TargetEntry& getTargetEntry(AddressType pc) {
+        return targets[(pc>>1)&(targets.size()-1)];
+    }
+
+    // Returns the penalty in cycles, target is the address executed next.
+    // Jumps without a base register (rs1 = 0) have a target known at decode.
+    UInt32 observe(AddressType pc, bool conditional, UInt8 rd, UInt8 rs1, AddressType target, AddressType fallThrough) {
+        Kind kind;
+        bool correct;
+        if(conditional) {
+            kind = Conditional;
+            bool taken = target != fallThrough;
+            correct = direction->predict(pc, history) == taken;
+            direction->update(pc, history, taken);
+            history = (history<<1)|taken;
+        }else if(isLinkRegister(rs1) && !isLinkRegister(rd)) {
+            kind = Return;
+            returnStackTop = (returnStackTop+ReturnStackSize-1)%ReturnStackSize;
+            correct = returnStack[returnStackTop] == target;
+        }else{
+            if(isLinkRegister(rd)) {
+                returnStack[returnStackTop] = fallThrough;
+                returnStackTop = (returnStackTop+1)%ReturnStackSize;
+            }
+            if(rs1 == 0) {
+                kind = (isLinkRegister(rd)) ? Call : Direct;
+                correct = true;
+            }else{
+                kind = (isLinkRegister(rd)) ? Call : Indirect;
+                TargetEntry& entry = getTargetEntry(pc);
+                correct = entry.pc == pc && entry.target == target;
+                entry = { pc, target };
+            }
+        }
+        Counters& site = sites[pc];
+        ++site.executed;
+        ++kinds[kind].executed;
+        if(correct)
+            return 0;
+        ++site.mispredicted;
+        ++kinds[kind].mispredicted;
+        penaltyCycles += penalty;
+        return penalty;
+    }
+
+    void writeReport(std::ostream& out, const std::map<AddressType, std::string>& symbols, size_t siteCount = 20) {
+        static const char* names[Kinds] = { "conditional", "call", "return", "indirect", "direct" };
+        char line[256];
+        auto writeRow = [&](const Counters& counters, const std::string& name) {
+            snprintf(line, sizeof(line), "%16llu %16llu %6.2f%%  %s", static_cast<unsigned long long>(counters.executed),
+                     static_cast<unsigned long long>(counters.mispredicted),
+                     (counters.executed) ? counters.mispredicted*100.0/counters.executed : 0.0, name.c_str());
+            out << line << std::endl;
+        };
+        out << "Branches (" << penaltyCycles << " penalty cycles)" << std::endl;
+        out << "        executed     mispredicted" << std::endl;
+        for(UInt8 kind = 0; kind < Kinds; ++kind)
+            writeRow(kinds[kind], names[kind]);
+
+        std::map<std::string, Counters> functions;
+        std::vector<std::pair<std::string, Counters>> rows;
+        for(auto& site : sites) {
+            auto symbol = symbols.upper_bound(site.first);
+            std::string name = "[unknown]";
+            AddressType address = 0;
+            if(symbol != symbols.begin()) {
+                --symbol;
+                name = symbol->second;
+                address = symbol->first;
+            }
+            Counters& counters = functions[name];
+            counters.executed += site.second.executed;
+            counters.mispredicted += site.second.mispredicted;
+            snprintf(line, sizeof(line), "+0x%llx", static_cast<unsigned long long>(site.first-address));
+            rows.push_back(std::make_pair(name+line, site.second));
+        }
+        auto byMispredictions = [](const std::pair<std::string, Counters>& a, const std::pair<std::string, Counters>& b) {
+            return a.second.mispredicted > b.second.mispredicted;
+        };
+        out << std::endl << "Mispredictions per function" << std::endl;
+        std::vector<std::pair<std::string, Counters>> functionRows(functions.begin(), functions.end());
+        std::sort(functionRows.begin(), functionRows.end(), byMispredictions);
+        for(auto& row : functionRows)
+            writeRow(row.second, row.first);
+        out << std::endl << "Mispredictions per branch" << std::endl;
+        std::sort(rows.begin(), rows.end(), byMispredictions);
+        for(size_t i = 0; i < std::min(siteCount, rows.size()); ++i)
+            writeRow(rows[i].second, rows[i].first);
+    }
+};
+
+#endif
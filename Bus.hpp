@@ -0,0 +1,152 @@
+#ifndef BUS
+#define BUS
+
+#include "RAM.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+// A Device is attached to a region of the physical address space and
+// receives all accesses to it, with the address relative to the region.
+// Returning false turns the access into an access fault.
+
+class Device {
+    public:
+    virtual ~Device() { }
+    virtual bool read(AddressType offset, UInt8* data, AddressType length) = 0;
+    virtual bool write(AddressType offset, const UInt8* data, AddressType length) = 0;
+};
+
+// Level sensitive interrupt lines of a hart, in the bit layout of mip.
+// Devices and other harts change them atomically from any thread, the hart
+// only loads them when it checks for interrupts. The timer deadline is in
+// host nanoseconds and is compared by the hart itself at its clock syncs.
+// A hart executing WFI sleeps in wait(), the mutex is only taken when a
+// line is raised while the hart is sleeping.
+
+class InterruptLines {
+    public:
+    std::atomic<UInt64> pending, timerDeadline;
+    std::atomic<bool> sleeping;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+
+    InterruptLines() :pending(0), timerDeadline(std::numeric_limits<UInt64>::max()), sleeping(false) { }
+
+    static UInt64 getHostTime() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void set(UInt8 bit, bool level) {
+        if(level) {
+            pending.fetch_or(static_cast<UInt64>(1)<<bit);
+            notify();
+        }else
+            pending.fetch_and(~(static_cast<UInt64>(1)<<bit), std::memory_order_release);
+    }
+
+    void setTimerDeadline(UInt64 deadline) {
+        timerDeadline.store(deadline);
+        notify();
+    }
+
+    void notify() {
+        if(!sleeping.load())
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeup.notify_all();
+    }
+
+    // Blocks until one of the lines in mask is raised or the deadline passed
+    void wait(UInt64 mask, UInt64 deadline) {
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.store(true);
+        while(!(pending.load()&mask)) {
+            UInt64 now = getHostTime(), timer = timerDeadline.load();
+            if(getBitsFrom(mask, 7, 1) && now >= timer) {
+                pending.fetch_or(static_cast<UInt64>(1)<<7);
+                break;
+            }
+            if(getBitsFrom(mask, 7, 1))
+                deadline = std::min(deadline, timer);
+            if(now >= deadline)
+                break;
+            wakeup.wait_for(lock, std::chrono::nanoseconds(deadline-now));
+        }
+        sleeping.store(false);
+    }
+};
+
+// The physical address map: The Ram occupies the addresses from zero up to
+// its size and is accessed directly by the Cpu. Everything above is looked
+// up in a table of device regions, sorted by address.
+
+class Bus {
+    public:
+    struct Region {
+        AddressType begin, end;
+        Device* device;
+    };
+    std::vector<Region> regions;
+    // Shared by all harts, so it is only a hint
+    std::atomic<size_t> lastRegion;
+
+    Bus() :lastRegion(0) { }
+
+    bool attach(Device* device, AddressType begin, AddressType length) {
+        AddressType end = begin+length;
+        if(length == 0 || end < begin || begin < (static_cast<AddressType>(1)<<ram.size))
+            return false;
+        auto iter = regions.begin();
+        while(iter != regions.end() && iter->end <= begin)
+            ++iter;
+        if(iter != regions.end() && iter->begin < end)
+            return false;
+        regions.insert(iter, { begin, end, device });
+        lastRegion = 0;
+        return true;
+    }
+
+    void detach(Device* device) {
+        for(auto iter = regions.begin(); iter != regions.end(); )
+            if(iter->device == device)
+                iter = regions.erase(iter);
+            else
+                ++iter;
+        lastRegion = 0;
+    }
+
+    Region* find(AddressType address) {
+        // Devices are usually accessed in bursts, so try the last hit first
+        size_t last = lastRegion.load(std::memory_order_relaxed);
+        if(last < regions.size() && address >= regions[last].begin && address < regions[last].end)
+            return &regions[last];
+        size_t low = 0, high = regions.size();
+        while(low < high) {
+            size_t middle = (low+high)/2;
+            if(regions[middle].end <= address)
+                low = middle+1;
+            else
+                high = middle;
+        }
+        if(low == regions.size() || address < regions[low].begin)
+            return NULL;
+        lastRegion.store(low, std::memory_order_relaxed);
+        return &regions[low];
+    }
+
+    template<bool store>
+    bool access(AddressType address, UInt8* data, AddressType length) {
+        Region* region = find(address);
+        if(!region || address+length > region->end || address+length < address)
+            return false;
+        if(store)
+            return region->device->write(address-region->begin, data, length);
+        else
+            return region->device->read(address-region->begin, data, length);
+    }
+};
+
+extern Bus bus;
+#endif
@@ -0,0 +1,97 @@
+#ifndef CLINT
+#define CLINT
+
+#include "PLIC.hpp"
+
+// Core local interruptor: Software interrupts (msip) and timer interrupts
+// (mtimecmp) of every hart plus the shared machine time (mtime), in the
+// register layout of the SiFive CLINT.
+
+class Clint : public Device {
+    public:
+    const static AddressType Size = 0x10000;
+    std::vector<InterruptLines*> harts;
+    std::vector<UInt64> mtimecmp;
+    Int64 epoch;
+    UInt64 period;
+    // Harts access the registers from their own threads
+    std::recursive_mutex mutex;
+
+    Clint(UInt64 frequency = 10000000) :period(1000000000/frequency) {
+        epoch = InterruptLines::getHostTime();
+    }
+
+    void attachHart(UInt32 hartid, InterruptLines* lines) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        if(hartid >= harts.size()) {
+            harts.resize(hartid+1, NULL);
+            mtimecmp.resize(hartid+1, std::numeric_limits<UInt64>::max());
+        }
+        harts[hartid] = lines;
+        updateTimer(hartid);
+    }
+
+    UInt64 getTime() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        return (static_cast<Int64>(InterruptLines::getHostTime())-epoch)/static_cast<Int64>(period);
+    }
+
+    void setTime(UInt64 value) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        epoch = static_cast<Int64>(InterruptLines::getHostTime())-static_cast<Int64>(value*period);
+        for(UInt32 hartid = 0; hartid < harts.size(); ++hartid)
+            updateTimer(hartid);
+    }
+
+    // The hart raises its timer interrupt by itself once the deadline passed
+    void updateTimer(UInt32 hartid) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        if(!harts[hartid])
+            return;
+        UInt64 deadline = std::numeric_limits<UInt64>::max();
+        if(mtimecmp[hartid] < static_cast<UInt64>(std::numeric_limits<Int64>::max()-epoch)/period)
+            deadline = epoch+mtimecmp[hartid]*period;
+        harts[hartid]->setTimerDeadline(deadline);
+        harts[hartid]->set(7, InterruptLines::getHostTime() >= deadline);
+    }
+
+    bool read(AddressType offset, UInt8* data, AddressType length) {
+        if((length != 4 && length != 8) || offset%length != 0)
+            return false;
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        UInt64 value;
+        if(offset < 0x4000 && length == 4 && offset/4 < harts.size() && harts[offset/4])
+            value = getBitsFrom(harts[offset/4]->pending.load(std::memory_order_acquire), 3, 1);
+        else if(offset >= 0x4000 && (offset-0x4000)/8 < harts.size())
+            value = mtimecmp[(offset-0x4000)/8]>>(offset%8*8);
+        else if(offset >= 0xBFF8 && offset < 0xC000)
+            value = getTime()>>(offset%8*8);
+        else
+            return false;
+        memcpy(data, &value, length);
+        return true;
+    }
+
+    bool write(AddressType offset, const UInt8* data, AddressType length) {
+        if((length != 4 && length != 8) || offset%length != 0)
+            return false;
+        UInt64 value = 0;
+        memcpy(&value, data, length);
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        if(offset < 0x4000 && length == 4 && offset/4 < harts.size() && harts[offset/4])
+            harts[offset/4]->set(3, value&1);
+        else if(offset >= 0x4000 && (offset-0x4000)/8 < harts.size()) {
+            UInt32 hartid = (offset-0x4000)/8;
+            setBitsIn(mtimecmp[hartid], value, offset%8*8, length*8);
+            updateTimer(hartid);
+        }else if(offset >= 0xBFF8 && offset < 0xC000) {
+            UInt64 time = getTime();
+            setBitsIn(time, value, offset%8*8, length*8);
+            setTime(time);
+        }else
+            return false;
+        return true;
+    }
+};
+
+#endif
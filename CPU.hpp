@@ -1,7 +1,7 @@
 #ifndef CPU
 #define CPU
 
-#include "CSR.hpp"
+#include "Timeline.hpp"
 
 enum ISAExtensions {
     A_AtomicOperations = 1U<<0,
@@ -19,20 +19,20 @@ enum ISAExtensions {
     M_MultiplyAndDivide = 1U<<12,
     N_UNUSED = 1U<<13,
     O_UNUSED = 1U<<14,
-    P_PackedSIMD = 1U<<15, // Maybe some day
+    P_PackedSIMD = 1U<<15,
     Q_QuadFloat = 1U<<16, // Maybe some day
     R_UNUSED = 1U<<17,
     S_SupervisorMode = 1U<<18,
     T_TransactionalMemory = 1U<<19, // Maybe some day
     U_UserMode = 1U<<20,
-    V_UNUSED = 1U<<21,
+    V_VectorOperations = 1U<<21,
     W_UNUSED = 1U<<22,
     X_NonStandardExtensions = 1U<<23,
     Y_UNUSED = 1U<<24,
     Z_UNUSED = 1U<<25
 };
 
-template<UInt8 XLEN = 64, ISAExtensions EXT = I_BaseISA>
+template<UInt8 XLEN = 64, ISAExtensions EXT = I_BaseISA, UInt16 VLEN = 256>
 class Cpu {
     public:
     typedef typename std::conditional<XLEN == 32, Int32, typename std::conditional<XLEN == 64, Int64, Int128>::type>::type IntType;
@@ -45,6 +45,18 @@ class Cpu {
         StoreData = 6
     };
 
+    enum HighLevelRoutine {
+        HighLevelMemcpy,
+        HighLevelMemset,
+        HighLevelStrlen,
+        HighLevelMemcmp
+    };
+
+    struct HighLevelEntry {
+        HighLevelRoutine routine;
+        UInt8 fingerprint[16];
+    };
+
     enum PrivilegeMode {
         User = 0,
         Supervisor = 1,
@@ -52,9 +64,16 @@ class Cpu {
         Machine = 3
     };
 
-    std::chrono::time_point<std::chrono::system_clock> clockSync;
+    std::chrono::time_point<std::chrono::steady_clock> clockSync;
     UIntType cyclesToClockSync, cyclesToClockSyncMax;
     UInt64 averageElapsedTime;
+    bool macroOpFusion;
+    const static UInt8 NoFastmem = 0xFF;
+    UInt8 fastmemVM;
+    AddressType fastmemDataBase, fastmemDataBound, fastmemDataLength;
+    MemoryAccessType accessType;
+    UIntType accessAddress;
+    FastmemView fastmemDataView;
 
     UIntType pc;
     union {
@@ -66,10 +85,16 @@ class Cpu {
         Float64 F64;
         FloatType F;
     } regF[32];
+    VectorRegisterFile<VLEN> regV;
     struct {
         UInt8 fflags;
         UIntType frm;
         UIntType fcsr;
+        UIntType vstart;
+        UIntType vxsat;
+        UIntType vxrm;
+        UIntType vl;
+        UIntType vtype;
         UIntType stvec;
         UIntType stimecmp;
         UIntType sscratch;
@@ -88,6 +113,8 @@ class Cpu {
         UIntType hepc;
         UIntType hcause;
         UIntType hbadaddr;
+        UIntType hptbr;
+        UIntType hvmid;
         UInt64 stime;
         UIntType mcpuid;
         UIntType mimpid;
@@ -114,6 +141,20 @@ class Cpu {
         UIntType mfromhost;
     } csr;
     std::set<std::pair<AddressType, UInt8>> seals;
+    TranslationCache<256> translationCache;
+    InterruptLines interruptLines;
+    Htif* htif;
+    LinuxUser* linuxUser;
+    Profiler* profiler;
+    CallStackProfiler* callStackProfiler;
+    InstructionMix* instructionMix;
+    CacheModel* cacheModel;
+    BranchPredictor* branchPredictor;
+    Pipeline* pipeline;
+    Sampler* sampler;
+    TraceRecorder* traceRecorder;
+    Timeline* timeline;
+    std::map<UIntType, HighLevelEntry> highLevelRoutines;
 
     constexpr UIntType getStatusCSRMask(PrivilegeMode mode) {
         UIntType mask;
@@ -127,7 +168,7 @@ class Cpu {
             default:
                 return 0;
         }
-        setBitsIn(mask, 1ULL, XLEN-1, 1);
+        setBitsIn(mask, static_cast<UIntType>(1), XLEN-1, 1);
         return mask;
     }
 
@@ -138,9 +179,15 @@ class Cpu {
         return 1;
     }
 
+    constexpr UInt8 getShiftBits() {
+        return (XLEN == 32) ? 5 : (XLEN == 64) ? 6 : 7;
+    }
+
     void reset() {
         memset(regX, 0, sizeof(regX));
         memset(regF, 0, sizeof(regF));
+        memset(regV.data, 0, sizeof(regV.data));
+        translationCache.flush();
 
         // TODO : multi core clock
         // TODO : timer interrupts
@@ -148,21 +195,32 @@ class Cpu {
         csr.fflags = 0;
         csr.frm = 0;
         csr.fcsr = 0;
+        csr.vstart = 0;
+        csr.vxsat = 0;
+        csr.vxrm = 0;
+        csr.vl = 0;
+        csr.vtype = static_cast<UIntType>(1)<<(XLEN-1);
         csr.stvec = 0;
-        csr.stimecmp = 0;
+        csr.stimecmp = ~static_cast<UIntType>(0);
         csr.sscratch = 0;
         csr.sepc = 0;
         csr.scause = 0;
         csr.sbadaddr = 0;
         csr.sptbr = 0;
         csr.sasid = 0;
+        csr.cycle = 0;
+        csr.time = 0;
+        csr.instret = 0;
         csr.htvec = 0;
         csr.htdeleg = 0;
-        csr.htimecmp = 0;
+        csr.htimecmp = ~static_cast<UIntType>(0);
         csr.hscratch = 0;
         csr.hepc = 0;
         csr.hcause = 0;
         csr.hbadaddr = 0;
+        csr.hptbr = 0;
+        csr.hvmid = 0;
+        csr.stime = 0;
 
         {
             csr.status = 6;
@@ -175,7 +233,7 @@ class Cpu {
 
         csr.mtdeleg = 0;
         csr.interruptEnabled = 0;
-        csr.mtimecmp = 0;
+        csr.mtimecmp = ~static_cast<UIntType>(0);
         csr.mtime = 0;
         csr.mscratch = 0;
         csr.mepc = 0;
@@ -188,16 +246,120 @@ class Cpu {
         csr.mibound = 0;
         csr.mdbase = 0;
         csr.mdbound = 0;
+        csr.htime = 0;
         csr.mtohost = 0;
         csr.mfromhost = 0;
 
         cyclesToClockSync = 0;
         averageElapsedTime = 5000;
-        clockSync = std::chrono::system_clock::now();
+        clockSync = std::chrono::steady_clock::now();
+    }
+
+    // The architectural state of the hart, the Ram, LinuxUser and Htif are
+    // snapshotted separately
+    struct Snapshot {
+        UIntType pc;
+        decltype(Cpu::regX) regX;
+        decltype(Cpu::regF) regF;
+        decltype(Cpu::regV.data) regV;
+        decltype(Cpu::csr) csr;
+    };
+
+    void takeSnapshot(Snapshot& snapshot) {
+        snapshot.pc = pc;
+        memcpy(snapshot.regX, regX, sizeof(regX));
+        memcpy(snapshot.regF, regF, sizeof(regF));
+        memcpy(snapshot.regV, regV.data, sizeof(regV.data));
+        snapshot.csr = csr;
+    }
+
+    void restoreSnapshot(const Snapshot& snapshot) {
+        pc = snapshot.pc;
+        memcpy(regX, snapshot.regX, sizeof(regX));
+        memcpy(regF, snapshot.regF, sizeof(regF));
+        memcpy(regV.data, snapshot.regV, sizeof(regV.data));
+        csr = snapshot.csr;
+        ram.seal(seals, {});
+        translationCache.flush();
+        fastmemVM = NoFastmem;
+        updateFastmem();
+        cyclesToClockSync = 0;
+        clockSync = std::chrono::steady_clock::now();
+    }
+
+    // Checkpoint file: This header, the Snapshot of the hart and then the
+    // image of the Ram, starting at the next page boundary
+    struct CheckpointHeader {
+        char magic[8];
+        UInt32 extensions;
+        UInt16 vlen;
+        UInt8 xlen, ramSize;
+        UInt64 snapshotSize, ramOffset;
+    };
+
+    CheckpointHeader getCheckpointHeader() {
+        CheckpointHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "RVCHKPT", 8);
+        header.extensions = EXT;
+        header.vlen = VLEN;
+        header.xlen = XLEN;
+        header.ramSize = ram.size;
+        header.snapshotSize = sizeof(Snapshot);
+        header.ramOffset = (sizeof(CheckpointHeader)+sizeof(Snapshot)+Ram::PageSize-1)/Ram::PageSize*Ram::PageSize;
+        return header;
+    }
+
+    bool saveCheckpoint(const char* path) {
+        int file = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if(file < 0)
+            return false;
+        CheckpointHeader header = getCheckpointHeader();
+        Snapshot snapshot;
+        takeSnapshot(snapshot);
+        bool success = pwrite(file, &header, sizeof(header), 0) == sizeof(header) &&
+                       pwrite(file, &snapshot, sizeof(snapshot), sizeof(header)) == sizeof(snapshot) &&
+                       ram.saveImage(file, header.ramOffset);
+        close(file);
+        return success;
+    }
+
+    // Only works for checkpoints of a Cpu with the same template arguments
+    bool loadCheckpoint(const char* path) {
+        int file = open(path, O_RDONLY);
+        if(file < 0)
+            return false;
+        CheckpointHeader header, expected = getCheckpointHeader();
+        Snapshot snapshot;
+        bool success = pread(file, &header, sizeof(header), 0) == sizeof(header) &&
+                       memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+                       header.extensions == expected.extensions && header.vlen == expected.vlen &&
+                       header.xlen == expected.xlen && header.snapshotSize == expected.snapshotSize &&
+                       header.ramOffset%Ram::PageSize == 0 &&
+                       header.ramSize >= Ram::MinSize && header.ramSize <= Ram::MaxSize &&
+                       pread(file, &snapshot, sizeof(snapshot), sizeof(header)) == sizeof(snapshot) &&
+                       ram.mapImage(file, header.ramOffset, header.ramSize);
+        close(file);
+        if(success)
+            restoreSnapshot(snapshot);
+        return success;
     }
 
     Cpu(UIntType index = 0) {
         cyclesToClockSyncMax = 10;
+        macroOpFusion = true;
+        fastmemVM = NoFastmem;
+        htif = NULL;
+        linuxUser = NULL;
+        profiler = NULL;
+        callStackProfiler = NULL;
+        instructionMix = NULL;
+        cacheModel = NULL;
+        branchPredictor = NULL;
+        pipeline = NULL;
+        sampler = NULL;
+        traceRecorder = NULL;
+        timeline = NULL;
         reset();
 
         UIntType mcpuid;
@@ -213,7 +375,6 @@ class Cpu {
             break;
         }
         mcpuid <<= (XLEN-2);
-        setBitsIn(mcpuid, static_cast<UIntType>(XLEN), 26, XLEN-28);
         setBitsIn(mcpuid, static_cast<UIntType>(EXT), 0, 26);
         csr.mcpuid = mcpuid;
         csr.mimpid = 0; // TODO
@@ -238,6 +399,29 @@ class Cpu {
         return (index) ? regX[index].I : 0;
     }
 
+    UIntType readVectorCSR(UInt16 index) {
+        if(!(EXT&V_VectorOperations) && !(EXT&P_PackedSIMD && index == csr_vxsat))
+            throw Exception(Exception::Code::IllegalInstruction);
+        switch(index) {
+            case csr_vstart:
+                return csr.vstart;
+            case csr_vxsat:
+                return csr.vxsat;
+            case csr_vxrm:
+                return csr.vxrm;
+            case csr_vcsr:
+                return (csr.vxrm<<1)|csr.vxsat;
+            case csr_vl:
+                return csr.vl;
+            case csr_vtype:
+                return csr.vtype;
+            case csr_vlenb:
+                return VLEN/8;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+    }
+
     UIntType readCSR(UInt16 index) {
         PrivilegeMode cpm = (PrivilegeMode)getBitsFrom(csr.status, 1, 2);
 
@@ -248,25 +432,33 @@ class Cpu {
                 return csr.frm;
             case csr_fcsr:
                 return csr.fcsr;
+            case csr_vstart:
+            case csr_vxsat:
+            case csr_vxrm:
+            case csr_vcsr:
+            case csr_vl:
+            case csr_vtype:
+            case csr_vlenb:
+                return readVectorCSR(index);
             case csr_cycle:
             case csr_cyclew:
-                return getBitsFrom(csr.cycle, 0, XLEN);
+                return getBitsFrom(csr.cycle, 0, (XLEN < 64) ? XLEN : 64);
             case csr_time:
-                return getBitsFrom(csr.time, 0, XLEN);
+                return getBitsFrom(csr.time, 0, (XLEN < 64) ? XLEN : 64);
             case csr_instret:
-                return getBitsFrom(csr.instret, 0, XLEN);
+                return getBitsFrom(csr.instret, 0, (XLEN < 64) ? XLEN : 64);
             case csr_cycleh:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.cycle, 32, XLEN);
+                return getBitsFrom(csr.cycle, 32, 32);
             case csr_timeh:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.time, 32, XLEN);
+                return getBitsFrom(csr.time, 32, 32);
             case csr_instreth:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.instret, 32, XLEN);
+                return getBitsFrom(csr.instret, 32, 32);
             default:
                 if(cpm == User)
                     throw Exception(Exception::Code::IllegalInstruction);
@@ -278,15 +470,15 @@ class Cpu {
             case csr_stvec:
                 return csr.stvec;
             case csr_sie:
-                return csr.interruptEnabled&0x22;
+                return csr.interruptEnabled&0x222;
             case csr_stimecmp:
                 return csr.stimecmp;
             case csr_stime:
-                return getBitsFrom(csr.stime, 0, XLEN);
+                return getBitsFrom(csr.stime, 0, (XLEN < 64) ? XLEN : 64);
             case csr_stimeh:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.stime, 32, XLEN);
+                return getBitsFrom(csr.stime, 32, 32);
             case csr_sscratch:
                 return csr.sscratch;
             case csr_sepc:
@@ -296,27 +488,27 @@ class Cpu {
             case csr_sbadaddr:
                 return csr.sbadaddr;
             case csr_sip:
-                return csr.interruptPending&0x2;
+                return getInterruptPending()&0x202;
             case csr_sptbr:
                 return csr.sptbr;
             case csr_sasid:
                 return csr.sasid;
             case csr_timew:
-                return getBitsFrom(csr.time, 0, XLEN);
+                return getBitsFrom(csr.time, 0, (XLEN < 64) ? XLEN : 64);
             case csr_instretw:
-                return getBitsFrom(csr.instret, 0, XLEN);
+                return getBitsFrom(csr.instret, 0, (XLEN < 64) ? XLEN : 64);
             case csr_cyclehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.cycle, 32, XLEN);
+                return getBitsFrom(csr.cycle, 32, 32);
             case csr_timehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.time, 32, XLEN);
+                return getBitsFrom(csr.time, 32, 32);
             case csr_instrethw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.instret, 32, XLEN);
+                return getBitsFrom(csr.instret, 32, 32);
             default:
                 if(cpm == Supervisor)
                     throw Exception(Exception::Code::IllegalInstruction);
@@ -334,11 +526,11 @@ class Cpu {
             case csr_htimecmp:
                 return csr.htimecmp;
             case csr_htime:
-                return getBitsFrom(csr.htime, 0, XLEN);
+                return getBitsFrom(csr.htime, 0, (XLEN < 64) ? XLEN : 64);
             case csr_htimeh:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.htime, 32, XLEN);
+                return getBitsFrom(csr.htime, 32, 32);
             case csr_hscratch:
                 return csr.hscratch;
             case csr_hepc:
@@ -347,14 +539,18 @@ class Cpu {
                 return csr.hcause;
             case csr_hbadaddr:
                 return csr.hbadaddr;
+            case csr_hptbr:
+                return csr.hptbr;
+            case csr_hvmid:
+                return csr.hvmid;
             /*case csr_hip: TODO wait for next riscv-privilege-spec
                 return csr.interruptPending&0x6;*/
             case csr_stimew:
-                return getBitsFrom(csr.stime, 0, XLEN);
+                return getBitsFrom(csr.stime, 0, (XLEN < 64) ? XLEN : 64);
             case csr_stimehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.stime, 32, XLEN);
+                return getBitsFrom(csr.stime, 32, 32);
             default:
                 if(cpm == Hypervisor)
                     throw Exception(Exception::Code::IllegalInstruction);
@@ -378,11 +574,11 @@ class Cpu {
             case csr_mtimecmp:
                 return csr.mtimecmp;
             case csr_mtime:
-                return getBitsFrom(csr.mtime, 0, XLEN);
+                return getBitsFrom(csr.mtime, 0, (XLEN < 64) ? XLEN : 64);
             case csr_mtimeh:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.mtime, 32, XLEN);
+                return getBitsFrom(csr.mtime, 32, 32);
             case csr_mscratch:
                 return csr.mscratch;
             case csr_mepc:
@@ -392,7 +588,7 @@ class Cpu {
             case csr_mbadaddr:
                 return csr.mbadaddr;
             case csr_mip:
-                return csr.interruptPending;
+                return getInterruptPending();
             case csr_mbase:
                 return csr.mbase;
             case csr_mbound:
@@ -406,11 +602,11 @@ class Cpu {
             case csr_mdbound:
                 return csr.mdbound;
             case csr_htimew:
-                return getBitsFrom(csr.htime, 0, XLEN);
+                return getBitsFrom(csr.htime, 0, (XLEN < 64) ? XLEN : 64);
             case csr_htimehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                return getBitsFrom(csr.htime, 32, XLEN);
+                return getBitsFrom(csr.htime, 32, 32);
             case csr_mtohost:
                 return csr.mtohost;
             case csr_mfromhost:
@@ -428,6 +624,28 @@ class Cpu {
         regX[index].I = value;
     }
 
+    void writeVectorCSR(UInt16 index, UIntType value) {
+        if(!(EXT&V_VectorOperations) && !(EXT&P_PackedSIMD && index == csr_vxsat))
+            throw Exception(Exception::Code::IllegalInstruction);
+        switch(index) {
+            case csr_vstart:
+                csr.vstart = value&TrailingBitMask<UIntType>(16);
+            break;
+            case csr_vxsat:
+                csr.vxsat = value&1;
+            break;
+            case csr_vxrm:
+                csr.vxrm = value&TrailingBitMask<UIntType>(2);
+            break;
+            case csr_vcsr:
+                csr.vxsat = value&1;
+                csr.vxrm = getBitsFrom(value, 1, 2);
+            break;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+    }
+
     void writeCSR(UInt16 index, UIntType value) {
         PrivilegeMode cpm = (PrivilegeMode)getBitsFrom(csr.status, 1, 2);
 
@@ -441,6 +659,15 @@ class Cpu {
             case csr_fcsr:
                 csr.fcsr = value;
             break;
+            case csr_vstart:
+            case csr_vxsat:
+            case csr_vxrm:
+            case csr_vcsr:
+            case csr_vl:
+            case csr_vtype:
+            case csr_vlenb:
+                writeVectorCSR(index, value);
+            return;
             case csr_cycle:
             case csr_time:
             case csr_instret:
@@ -461,10 +688,10 @@ class Cpu {
                 csr.stvec = value;
             break;
             case csr_sie:
-                setMaskedIn(csr.interruptEnabled, value, 0x22ULL);
+                setMaskedIn(csr.interruptEnabled, value, static_cast<UIntType>(0x222));
             break;
             case csr_stimecmp:
-                setBitsIn(csr.interruptPending, 0ULL, 5, 1);
+                setBitsIn(csr.interruptPending, static_cast<UIntType>(0), 5, 1);
                 csr.stimecmp = value;
             break;
             case csr_stime:
@@ -483,37 +710,40 @@ class Cpu {
                 csr.sbadaddr = value;
             break;
             case csr_sip:
-                setMaskedIn(csr.interruptPending, value, 0x2ULL);
+                setMaskedIn(csr.interruptPending, value, static_cast<UIntType>(0x2));
             break;
             case csr_sptbr:
                 csr.sptbr = value;
+                translationCache.flush();
+                if(timeline)
+                    recordEvent(Timeline::AddressSpace, getBitsFrom(csr.status, 1, 2), value);
             break;
             case csr_sasid:
                 csr.sasid = value;
             break;
             case csr_cyclew:
-                setBitsIn(csr.cycle, value, 0, XLEN);
+                setBitsIn(csr.cycle, static_cast<UInt64>(value), 0, (XLEN < 64) ? XLEN : 64);
             break;
             case csr_timew:
-                setBitsIn(csr.time, value, 0, XLEN);
+                setBitsIn(csr.time, static_cast<UInt64>(value), 0, (XLEN < 64) ? XLEN : 64);
             break;
             case csr_instretw:
-                setBitsIn(csr.instret, value, 0, XLEN);
+                setBitsIn(csr.instret, static_cast<UInt64>(value), 0, (XLEN < 64) ? XLEN : 64);
             break;
             case csr_cyclehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                setBitsIn(csr.cycle, value, 32, 32);
+                setBitsIn(csr.cycle, static_cast<UInt64>(value), 32, 32);
             break;
             case csr_timehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                setBitsIn(csr.time, value, 32, 32);
+                setBitsIn(csr.time, static_cast<UInt64>(value), 32, 32);
             break;
             case csr_instrethw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                setBitsIn(csr.instret, value, 32, 32);
+                setBitsIn(csr.instret, static_cast<UInt64>(value), 32, 32);
             break;
             default:
                 if(cpm == Supervisor)
@@ -523,6 +753,7 @@ class Cpu {
         switch(index) {
             case csr_hstatus:
                 csr.status = value; // TODO wait for next riscv-privilege-spec
+                updateFastmem();
             break;
             case csr_htvec:
                 csr.htvec = value;
@@ -531,10 +762,10 @@ class Cpu {
                 csr.htdeleg = value;
             break;
             /*case csr_hie: TODO wait for next riscv-privilege-spec
-                setMaskedIn(csr.interruptEnabled, value, 0x66ULL);
+                setMaskedIn(csr.interruptEnabled, value, static_cast<UIntType>(0x66));
             break;*/
             case csr_htimecmp:
-                setBitsIn(csr.interruptPending, 0ULL, 6, 1);
+                setBitsIn(csr.interruptPending, static_cast<UIntType>(0), 6, 1);
                 csr.htimecmp = value;
             break;
             case csr_htime:
@@ -552,16 +783,24 @@ class Cpu {
             case csr_hbadaddr:
                 csr.hbadaddr = value;
             break;
+            case csr_hptbr:
+                csr.hptbr = value;
+                translationCache.flush();
+                updateFastmem();
+            break;
+            case csr_hvmid:
+                csr.hvmid = value;
+            break;
             /*case csr_hip: TODO wait for next riscv-privilege-spec
-                setMaskedIn(csr.interruptPending, value, 0x6ULL);
+                setMaskedIn(csr.interruptPending, value, static_cast<UIntType>(0x6));
             break;*/
             case csr_stimew:
-                setBitsIn(csr.stime, value, 0, XLEN);
+                setBitsIn(csr.stime, static_cast<UInt64>(value), 0, (XLEN < 64) ? XLEN : 64);
             break;
             case csr_stimehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                setBitsIn(csr.stime, value, 32, 32);
+                setBitsIn(csr.stime, static_cast<UInt64>(value), 32, 32);
             break;
             default:
                 if(cpm == Hypervisor)
@@ -571,6 +810,7 @@ class Cpu {
         switch(index) {
             case csr_mstatus:
                 csr.status = value;
+                updateFastmem();
             break;
             case csr_mtvec:
                 csr.mtvec = value;
@@ -582,16 +822,16 @@ class Cpu {
                 csr.interruptEnabled = value;
             break;
             case csr_mtimecmp:
-                setBitsIn(csr.interruptPending, 0ULL, 7, 1);
+                setBitsIn(csr.interruptPending, static_cast<UIntType>(0), 7, 1);
                 csr.mtimecmp = value;
             break;
             case csr_mtime:
-                setBitsIn(csr.mtime, value, 0, XLEN);
+                setBitsIn(csr.mtime, static_cast<UInt64>(value), 0, (XLEN < 64) ? XLEN : 64);
             break;
             case csr_mtimeh:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                setBitsIn(csr.mtime, value, 32, 32);
+                setBitsIn(csr.mtime, static_cast<UInt64>(value), 32, 32);
             break;
             case csr_mscratch:
                 csr.mscratch = value;
@@ -606,13 +846,15 @@ class Cpu {
                 csr.mbadaddr = value;
             break;
             case csr_mip:
-                setMaskedIn(csr.interruptPending, value, 0xEULL);
+                setMaskedIn(csr.interruptPending, value, static_cast<UIntType>(0xE));
             break;
             case csr_mbase:
                 csr.mbase = value;
+                updateFastmem();
             break;
             case csr_mbound:
                 csr.mbound = value;
+                updateFastmem();
             break;
             case csr_mibase:
                 csr.mibase = value;
@@ -622,20 +864,26 @@ class Cpu {
             break;
             case csr_mdbase:
                 csr.mdbase = value;
+                updateFastmem();
             break;
             case csr_mdbound:
                 csr.mdbound = value;
+                updateFastmem();
             break;
             case csr_htimew:
-                setBitsIn(csr.htime, value, 0, XLEN);
+                setBitsIn(csr.htime, static_cast<UInt64>(value), 0, (XLEN < 64) ? XLEN : 64);
             break;
             case csr_htimehw:
                 if(XLEN > 32)
                     throw Exception(Exception::Code::IllegalInstruction);
-                setBitsIn(csr.htime, value, 32, 32);
+                setBitsIn(csr.htime, static_cast<UInt64>(value), 32, 32);
             break;
             case csr_mtohost:
                 csr.mtohost = value;
+                if(value && htif) {
+                    csr.mfromhost = htif->handle(value);
+                    csr.mtohost = 0;
+                }
             break;
             case csr_mfromhost:
                 csr.mfromhost = value;
@@ -657,34 +905,168 @@ class Cpu {
 
     template<typename type, bool store, bool aligned>
     void memoryAccess(MemoryAccessType mat, UIntType address, type* value) {
+        accessType = mat;
+        accessAddress = address;
         if(aligned && address%sizeof(type) != 0)
             throw MemoryAccessException((Exception::Code)mat, address);
 
-        // TODO: Cache
+        AddressType ramSize = static_cast<AddressType>(1)<<ram.size;
+        if(address >= ramSize) {
+            if(address > std::numeric_limits<AddressType>::max() ||
+               !bus.access<store>(address, reinterpret_cast<UInt8*>(value), sizeof(type)))
+                throw MemoryAccessException((Exception::Code)(mat+1), address);
+            return;
+        }
+        // The Ram holds the seals lock while writing, so it must not fault into the guard region
+        if(address+sizeof(type) > ramSize)
+            throw MemoryAccessException((Exception::Code)(mat+1), address);
 
+        if(cacheModel)
+            accessCache(mat, address, sizeof(type));
         if(store)
             ram.set<type, aligned>(address, value);
         else
             ram.get<type, aligned>(address, value);
     }
 
-    template<typename PteType, UInt8 MaxLen, UInt8 MinLen, UInt8 MaxLevel>
-    AddressType translatePaged(PrivilegeMode cpm, MemoryAccessType mat, UIntType src) {
+    void accessCache(MemoryAccessType mat, AddressType address, AddressType length) {
+        UInt32 stall = cacheModel->access(mat == FetchInstruction, mat == StoreData, address, length, pc);
+        if(cacheModel->chargeCycles) {
+            csr.cycle += stall;
+            if(pipeline)
+                pipeline->stall(Pipeline::CacheMiss, stall);
+        }
+    }
+
+    void traceAccess(MemoryAccessType mat, UInt32 length, UIntType address, AddressType mappedAddress) {
+        UInt8 type = (mat == FetchInstruction) ? TraceRecord::Fetch : (mat == StoreData) ? TraceRecord::Store : TraceRecord::Load;
+        traceRecorder->record(type, length, address, mappedAddress, pc);
+    }
+
+    template<bool store>
+    void memoryAccessBlock(MemoryAccessType mat, AddressType address, UInt8* data, AddressType length) {
+        accessType = mat;
+        accessAddress = address;
+        AddressType ramSize = static_cast<AddressType>(1)<<ram.size;
+        if(address >= ramSize) {
+            if(!bus.access<store>(address, data, length))
+                throw MemoryAccessException((Exception::Code)(mat+1), address);
+            return;
+        }
+        if(address+length > ramSize)
+            throw MemoryAccessException((Exception::Code)(mat+1), address);
+
+        if(cacheModel)
+            accessCache(mat, address, length);
+        if(store)
+            ram.setBlock(address, data, length);
+        else
+            ram.getBlock(address, data, length);
+    }
+
+    bool enableFastmem() {
+        if(!ram.enableFastmem() ||
+           !fastmemDataView.reserve(static_cast<AddressType>(1)<<((XLEN == 32) ? 32 : 36)))
+            return false;
+        updateFastmem();
+        return true;
+    }
+
+    void disableFastmem() {
+        fastmemDataView.release();
+        fastmemVM = NoFastmem;
+    }
+
+    // Mirrors the data segment of the current base and bound registers into
+    // the fastmem view. Paged modes and segments which are not page aligned
+    // go through translate() instead.
+    void updateFastmem() {
+        if(!fastmemDataView.base)
+            return;
+        // The second stage of a guest is not mirrored, so while hptbr is
+        // set all accesses go through translate(), whatever the privilege
+        if((EXT&H_HypervisorMode) && csr.hptbr != 0) {
+            fastmemVM = NoFastmem;
+            return;
+        }
+        UInt8 vm = getBitsFrom(csr.status, 17, 5);
+        AddressType ramSize = static_cast<AddressType>(1)<<ram.size, base, bound;
+        switch(vm) {
+            case 0: // Mbare
+                base = 0;
+                bound = ramSize;
+            break;
+            case 1: // Mbb
+                base = csr.mbase;
+                bound = csr.mbound;
+            break;
+            case 2: // Mbbid
+                base = csr.mdbase;
+                bound = std::min(static_cast<UIntType>(csr.mdbound), static_cast<UIntType>(1)<<(XLEN-1));
+            break;
+            default:
+                fastmemVM = NoFastmem;
+                return;
+        }
+        if(fastmemVM == vm && fastmemDataBase == base && fastmemDataBound == bound)
+            return;
+        fastmemVM = NoFastmem;
+        if(getBitsFrom(base|bound, 0, 12) || base > ramSize ||
+           !fastmemDataView.map(ram.fastmemFile, base, std::min(bound, ramSize-base), PROT_READ|PROT_WRITE))
+            return;
+        // Device regions are not mirrored and go through the slow path
+        fastmemDataLength = std::min(bound, ramSize-base);
+        fastmemDataBase = base;
+        fastmemDataBound = bound;
+        fastmemVM = vm;
+    }
+
+    template<typename type, bool store, bool aligned>
+    void virtualMemoryAccess(MemoryAccessType mat, UIntType address, type* value) {
+        if(fastmemVM == getBitsFrom(csr.status, 17, 5) && address < fastmemDataLength) {
+            if(aligned && address%sizeof(type) != 0)
+                throw MemoryAccessException((Exception::Code)mat, address);
+            if(store)
+                ram.prepareWrite(fastmemDataBase+static_cast<AddressType>(address), sizeof(type));
+            // Accesses crossing the end of the mirror fault in the host and are recovered in fetchAndExecute()
+            accessType = mat;
+            accessAddress = address;
+            if(cacheModel)
+                accessCache(mat, fastmemDataBase+static_cast<AddressType>(address), sizeof(type));
+            if(traceRecorder)
+                traceAccess(mat, sizeof(type), address, fastmemDataBase+static_cast<AddressType>(address));
+            UInt8* hostAddress = fastmemDataView.base+static_cast<AddressType>(address);
+            if(store)
+                memcpy(hostAddress, value, sizeof(type));
+            else
+                memcpy(value, hostAddress, sizeof(type));
+            return;
+        }
+        AddressType mappedAddress = translate(mat, address);
+        if(traceRecorder)
+            traceAccess(mat, sizeof(type), address, mappedAddress);
+        memoryAccess<type, store, aligned>(mat, mappedAddress, value);
+    }
+
+    template<typename PteType, UInt8 MaxLen, UInt8 MinLen, UInt8 MaxLevel, UInt8 RootLen>
+    AddressType translatePaged(PrivilegeMode cpm, MemoryAccessType mat, UIntType src, AddressType root, bool guest) {
         UInt8 type, i = MaxLevel, offsetLen = 12;
-        AddressType dst = csr.sptbr;
+        AddressType dst = root, pteAddress;
         PteType pte;
 
         // TODO: csr_sasid
 
         while(true) {
-            dst += getBitsFrom(src, i*MinLen+offsetLen, MinLen)*sizeof(PteType);
+            dst += getBitsFrom(src, i*MinLen+offsetLen, (i == MaxLevel) ? RootLen : MinLen)*sizeof(PteType);
             // TODO: Check dst
 
-            memoryAccess<PteType, false, true>(mat, dst, &pte);
+            // The page tables of a guest lie in its guest physical address space
+            pteAddress = (guest) ? translateGuestPhysical(LoadData, dst) : dst;
+            memoryAccess<PteType, false, true>(mat, pteAddress, &pte);
             if((pte&0x01) == 0) // Invalid
                 throw MemoryAccessException((Exception::Code)(mat+1), src);
 
-            type = getBitsFrom(pte, 1, 5);
+            type = getBitsFrom(pte, 1, 4);
             if(type >= 2) // Leaf
                 break;
 
@@ -692,7 +1074,7 @@ class Cpu {
                 throw MemoryAccessException((Exception::Code)(mat+1), src);
             --i;
 
-            dst = getBitsFrom(dst, 10, MaxLen+MinLen*MaxLevel)<<offsetLen;
+            dst = getBitsFrom(pte, 10, MaxLen+MinLen*MaxLevel)<<offsetLen;
         }
 
         bool storePte = false;
@@ -726,21 +1108,62 @@ class Cpu {
             storePte = true;
         }
         if(storePte)
-            memoryAccess<PteType, true, true>(mat, dst, &pte);
+            memoryAccess<PteType, true, true>(mat, pteAddress, &pte);
 
+        // Superpages take the lower part of the page number from the virtual address
         offsetLen += MinLen*i;
-        dst = getBitsFrom(dst, 10, MaxLen+MinLen*(MaxLevel-i))<<offsetLen;
+        dst = getBitsFrom(pte, 10+MinLen*i, MaxLen+MinLen*(MaxLevel-i))<<offsetLen;
         return dst|getBitsFrom(src, 0, offsetLen);
     }
 
+    template<UInt8 RootExtension>
+    AddressType translatePagedMode(UInt8 vm, PrivilegeMode cpm, MemoryAccessType mat, UIntType src, AddressType root, bool guest) {
+        switch(vm) {
+            case 8: // Sv32
+                return translatePaged<UInt32, 12, 10, 1, 10+RootExtension>(cpm, mat, src, root, guest);
+            case 9: // Sv39
+                return translatePaged<UInt64, 20, 9, 2, 9+RootExtension>(cpm, mat, src, root, guest);
+            case 10: // Sv48
+                return translatePaged<UInt64, 11, 9, 3, 9+RootExtension>(cpm, mat, src, root, guest);
+            case 11: // Sv57
+                return translatePaged<UInt64, 16, 9, 4, 9+RootExtension>(cpm, mat, src, root, guest);
+            case 12: // Sv64
+                return translatePaged<UInt64, 15, 13, 5, 13+RootExtension>(cpm, mat, src, root, guest);
+            default:
+                throw MemoryAccessException((Exception::Code)(mat+1), src);
+        }
+    }
+
+    bool isTwoStageTranslation(PrivilegeMode cpm) {
+        return (EXT&H_HypervisorMode) && cpm < Hypervisor && csr.hptbr != 0;
+    }
+
+    // Second stage from guest physical to machine physical addresses, set up by
+    // the hypervisor in hptbr. It uses the same paging mode as the first stage,
+    // but with a four times larger root table, and checks like a user access.
+    AddressType translateGuestPhysical(MemoryAccessType mat, AddressType src) {
+        UInt8 vm = getBitsFrom(csr.status, 17, 5);
+        if(vm < 8)
+            vm = (XLEN == 32) ? 8 : 9;
+        UInt64 tag = TranslationCache<256>::getTag(vm, User, mat, true, 0, csr.hvmid, true);
+        AddressType frame;
+        if(!translationCache.lookup(src>>12, tag, frame)) {
+            frame = translatePagedMode<2>(vm, User, mat, src, csr.hptbr, false)>>12;
+            translationCache.insert(src>>12, tag, frame);
+        }
+        return (frame<<12)|getBitsFrom(src, 0, 12);
+    }
+
     AddressType translate(MemoryAccessType mat, UIntType src) {
         bool mPrv = getBitsFrom(csr.status, 16, 1);
         PrivilegeMode cpm = (PrivilegeMode)getBitsFrom(csr.status, 1, 2);
         if(cpm != Machine || mat != FetchInstruction || mPrv)
             cpm = (PrivilegeMode)getBitsFrom(csr.status, 4, 2);
 
+        bool guest = isTwoStageTranslation(cpm);
+        UInt8 vm = getBitsFrom(csr.status, 17, 5);
         AddressType dst;
-        switch(getBitsFrom(csr.status, 17, 5)) {
+        switch(vm) {
             case 0: // Mbare
                 dst = src;
             break;
@@ -750,7 +1173,7 @@ class Cpu {
                 dst = src+csr.mbase;
             break;
             case 2: { // Mbbid
-                UIntType halfVAS = 1ULL<<(XLEN-1);
+                UIntType halfVAS = static_cast<UIntType>(1)<<(XLEN-1);
                 if(mat == FetchInstruction) {
                     if(src < halfVAS)
                         throw MemoryAccessException((Exception::Code)(mat+1), src);
@@ -764,66 +1187,69 @@ class Cpu {
                     dst = src+csr.mdbase;
                 }
             } break;
-            case 8: // Sv32
-                dst = translatePaged<UInt32, 12, 10, 1>(cpm, mat, src);
-            break;
-            case 9: // Sv39
-                dst = translatePaged<UInt64, 20, 9, 2>(cpm, mat, src);
-            break;
-            case 10: // Sv48
-                dst = translatePaged<UInt64, 11, 9, 3>(cpm, mat, src);
-            break;
-            case 11: // Sv57
-                dst = translatePaged<UInt64, 16, 9, 4>(cpm, mat, src);
-            break;
-            case 12: // Sv64
-                dst = translatePaged<UInt64, 15, 13, 5>(cpm, mat, src);
-            break;
+            default: {
+                // Paged translations are cached including the second stage,
+                // which saves up to 25 page table reads for a guest
+                UInt64 tag = TranslationCache<256>::getTag(vm, cpm, mat, guest, csr.sasid, (guest) ? csr.hvmid : 0, false);
+                AddressType frame;
+                if(translationCache.lookup(src>>12, tag, frame))
+                    return (frame<<12)|getBitsFrom(src, 0, 12);
+                dst = translatePagedMode<0>(vm, cpm, mat, src, csr.sptbr, guest);
+                if(guest)
+                    dst = translateGuestPhysical(mat, dst);
+                translationCache.insert(src>>12, tag, dst>>12);
+            } return dst;
         }
-        return dst;
+        return (guest) ? translateGuestPhysical(mat, dst) : dst;
     }
 
     void executeOpcode03(const Instruction& instruction) {
         UIntType address = readRegXU(instruction.reg[1])+instruction.imm;
-        address = translate(LoadData, address);
         switch(instruction.funct[0]) {
             case 0: { // LB rd,rs1,imm
                 Int8 data;
-                memoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
                 writeRegXI(instruction.reg[0], data);
             } break;
             case 1: { // LH rd,rs1,imm
                 Int16 data;
-                memoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
                 writeRegXI(instruction.reg[0], data);
             } break;
             case 2: { // LW rd,rs1,imm
                 Int32 data;
-                memoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
                 writeRegXI(instruction.reg[0], data);
             } break;
             case 3: { // LD rd,rs1,imm (64)
                 if(XLEN < 64)
                     throw Exception(Exception::Code::IllegalInstruction);
                 Int64 data;
-                memoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
                 writeRegXI(instruction.reg[0], data);
             } break;
             case 4: { // LBU rd,rs1,imm
                 UInt8 data;
-                memoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
                 writeRegXU(instruction.reg[0], data);
             } break;
             case 5: { // LHU rd,rs1,imm
                 UInt16 data;
-                memoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
                 writeRegXU(instruction.reg[0], data);
             } break;
             case 6: { // LWU rd,rs1,imm (64)
                 if(XLEN < 64)
                     throw Exception(Exception::Code::IllegalInstruction);
                 UInt32 data;
-                memoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
+                writeRegXU(instruction.reg[0], data);
+            } break;
+            case 7: { // LDU rd,rs1,imm (128)
+                if(XLEN < 128)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                UInt64 data;
+                virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
                 writeRegXU(instruction.reg[0], data);
             } break;
             default:
@@ -832,18 +1258,21 @@ class Cpu {
     }
 
     void executeOpcode07(const Instruction& instruction) {
+        if(instruction.funct[0] == 0 || instruction.funct[0] >= 5) {
+            executeVectorMemoryAccess<false>(instruction);
+            return;
+        }
         if(!(EXT&F_Float))
             throw Exception(Exception::Code::IllegalInstruction);
         UIntType address = readRegXU(instruction.reg[1])+instruction.imm;
-        address = translate(LoadData, address);
         switch(instruction.funct[0]) {
             case 2: { // FLW rd,rs1,imm (F)
-                memoryAccess<UInt32, false, false>(LoadData, address, &regF[instruction.reg[0]].F32.raw);
+                virtualMemoryAccess<UInt32, false, false>(LoadData, address, &regF[instruction.reg[0]].F32.raw);
             } break;
             case 3: { // FLD rd,rs1,imm (D)
                 if(!(EXT&D_DoubleFloat))
                     throw Exception(Exception::Code::IllegalInstruction);
-                memoryAccess<UInt64, false, false>(LoadData, address, &regF[instruction.reg[0]].F64.raw);
+                virtualMemoryAccess<UInt64, false, false>(LoadData, address, &regF[instruction.reg[0]].F64.raw);
             } break;
         }
     }
@@ -853,7 +1282,14 @@ class Cpu {
         FENCE
         FENCE.I
         */
-        // TODO : Pipeline, Cache
+        // TODO : Pipeline
+        if(instruction.funct[0] == 2) { // LQ rd,rs1,imm (128)
+            if(XLEN < 128)
+                throw Exception(Exception::Code::IllegalInstruction);
+            UIntType address = readRegXU(instruction.reg[1])+instruction.imm, data;
+            virtualMemoryAccess<decltype(data), false, false>(LoadData, address, &data);
+            writeRegXU(instruction.reg[0], data);
+        }
     }
 
     void executeOpcode13(const Instruction& instruction) {
@@ -862,25 +1298,25 @@ class Cpu {
                 writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])+instruction.imm);
             break;
             case 1: { //SLLI rd,rs1,shamt
-                if(XLEN < 64 && getBitsFrom(instruction.imm, 5, 1))
+                if(getBitsFrom(instruction.imm, getShiftBits(), 12-getShiftBits()))
                     throw Exception(Exception::Code::IllegalInstruction);
-                UIntType shift = instruction.imm&TrailingBitMask<UIntType>((XLEN < 64)?5:6);
+                UIntType shift = instruction.imm&TrailingBitMask<UIntType>(getShiftBits());
                 writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])<<shift);
             } break;
             case 2: //SLTI rd,rs1,imm
                 writeRegXU(instruction.reg[0], (readRegXI(instruction.reg[1]) < instruction.imm) ? 1 : 0);
             break;
             case 3: //SLTIU rd,rs1,imm
-                writeRegXU(instruction.reg[0], (readRegXU(instruction.reg[1]) < static_cast<UInt32>(instruction.imm)) ? 1 : 0);
+                writeRegXU(instruction.reg[0], (readRegXU(instruction.reg[1]) < static_cast<UIntType>(static_cast<IntType>(instruction.imm))) ? 1 : 0);
             break;
             case 4: //XORI rd,rs1,imm
                 writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])^instruction.imm);
             break;
             case 5: {
-                if(XLEN < 64 && getBitsFrom(instruction.imm, 5, 1))
+                if(getBitsFrom(instruction.imm&~0x400, getShiftBits(), 12-getShiftBits()))
                     throw Exception(Exception::Code::IllegalInstruction);
                 bool arithmetic = getBitsFrom(instruction.imm, 10, 1);
-                UIntType shift = instruction.imm&TrailingBitMask<UIntType>((XLEN < 64)?5:6);
+                UIntType shift = instruction.imm&TrailingBitMask<UIntType>(getShiftBits());
                 if(arithmetic) //SRAI rd,rs1,shamt
                     writeRegXI(instruction.reg[0], readRegXI(instruction.reg[1])>>shift);
                 else //SRLI rd,rs1,shamt
@@ -900,53 +1336,74 @@ class Cpu {
         writeRegXU(instruction.reg[0], pc+instruction.imm);
     }
 
-    void executeOpcode1B(const Instruction& instruction) {
-        if(XLEN < 64)
-            throw Exception(Exception::Code::IllegalInstruction);
+    template<typename narrow_type>
+    void executeNarrowImmediate(const Instruction& instruction) {
+        typedef typename Integer<sizeof(narrow_type)*8>::unsigned_type narrow_unsigned_type;
+        const UInt8 shiftBits = (sizeof(narrow_type) == 4) ? 5 : 6;
+        narrow_unsigned_type value = readRegXU(instruction.reg[1]);
         switch(instruction.funct[0]) {
-            case 0: //ADDIW rd,rs1,imm (64)
-                writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1])+instruction.imm));
+            case 0: //ADDIW/ADDID rd,rs1,imm (64/128)
+                writeRegXI(instruction.reg[0], static_cast<narrow_type>(value+instruction.imm));
             break;
-            case 1: { //SLLIW rd,rs1,shamt (64)
-                if(instruction.imm&(1ULL<<5))
+            case 1: { //SLLIW/SLLID rd,rs1,shamt (64/128)
+                if(getBitsFrom(instruction.imm, shiftBits, 12-shiftBits))
                     throw Exception(Exception::Code::IllegalInstruction);
-                UIntType shift = instruction.imm&TrailingBitMask<UIntType>(5);
-                writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1])<<shift));
+                UInt8 shift = instruction.imm&TrailingBitMask<UInt8>(shiftBits);
+                writeRegXI(instruction.reg[0], static_cast<narrow_type>(value<<shift));
             } break;
             case 5: {
-                if(instruction.imm&(1ULL<<5))
-                    throw Exception(Exception::Code::IllegalInstruction);
-                bool arithmetic = instruction.imm&(1ULL<<10);
-                UIntType shift = instruction.imm&TrailingBitMask<UIntType>(5);
-                if(arithmetic) //SRAIW rd,rs1,shamt (64)
-                    writeRegXI(instruction.reg[0], static_cast<Int32>(readRegXI(instruction.reg[1])>>shift));
-                else //SRLIW rd,rs1,shamt (64)
-                    writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1])>>shift));
+                if(getBitsFrom(instruction.imm&~0x400, shiftBits, 12-shiftBits))
+                    throw Exception(Exception::Code::IllegalInstruction);
+                bool arithmetic = getBitsFrom(instruction.imm, 10, 1);
+                UInt8 shift = instruction.imm&TrailingBitMask<UInt8>(shiftBits);
+                if(arithmetic) //SRAIW/SRAID rd,rs1,shamt (64/128)
+                    writeRegXI(instruction.reg[0], static_cast<narrow_type>(value)>>shift);
+                else //SRLIW/SRLID rd,rs1,shamt (64/128)
+                    writeRegXI(instruction.reg[0], static_cast<narrow_type>(value>>shift));
             } break;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
         }
     }
 
+    void executeOpcode1B(const Instruction& instruction) {
+        if(XLEN < 64)
+            throw Exception(Exception::Code::IllegalInstruction);
+        executeNarrowImmediate<Int32>(instruction);
+    }
+
+    void executeOpcode5B(const Instruction& instruction) {
+        if(XLEN < 128)
+            throw Exception(Exception::Code::IllegalInstruction);
+        executeNarrowImmediate<Int64>(instruction);
+    }
+
     void executeOpcode23(const Instruction& instruction) {
         UIntType address = readRegXU(instruction.reg[1])+instruction.imm;
-        address = translate(StoreData, address);
         switch(instruction.funct[0]) {
             case 0: { // SB rs1,rs2,imm
                 UInt8 data = readRegXU(instruction.reg[2]);
-                memoryAccess<decltype(data), true, false>(StoreData, address, &data);
+                virtualMemoryAccess<decltype(data), true, false>(StoreData, address, &data);
             } break;
             case 1: { // SH rs1,rs2,imm
                 UInt16 data = readRegXU(instruction.reg[2]);
-                memoryAccess<decltype(data), true, false>(StoreData, address, &data);
+                virtualMemoryAccess<decltype(data), true, false>(StoreData, address, &data);
             } break;
             case 2: { // SW rs1,rs2,imm
                 UInt32 data = readRegXU(instruction.reg[2]);
-                memoryAccess<decltype(data), true, false>(StoreData, address, &data);
+                virtualMemoryAccess<decltype(data), true, false>(StoreData, address, &data);
             } break;
             case 3: { // SD rs1,rs2,imm (64)
                 if(XLEN < 64)
                     throw Exception(Exception::Code::IllegalInstruction);
                 UInt64 data = readRegXU(instruction.reg[2]);
-                memoryAccess<decltype(data), true, false>(StoreData, address, &data);
+                virtualMemoryAccess<decltype(data), true, false>(StoreData, address, &data);
+            } break;
+            case 4: { // SQ rs1,rs2,imm (128)
+                if(XLEN < 128)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                UIntType data = readRegXU(instruction.reg[2]);
+                virtualMemoryAccess<decltype(data), true, false>(StoreData, address, &data);
             } break;
             default:
                 throw Exception(Exception::Code::IllegalInstruction);
@@ -954,208 +1411,220 @@ class Cpu {
     }
 
     void executeOpcode27(const Instruction& instruction) {
+        if(instruction.funct[0] == 0 || instruction.funct[0] >= 5) {
+            executeVectorMemoryAccess<true>(instruction);
+            return;
+        }
         if(!(EXT&F_Float))
             throw Exception(Exception::Code::IllegalInstruction);
         UIntType address = readRegXU(instruction.reg[1])+instruction.imm;
-        address = translate(StoreData, address);
         switch(instruction.funct[0]) {
             case 2: { // FSW rd,rs1,imm (F)
-                memoryAccess<UInt32, true, false>(StoreData, address, &regF[instruction.reg[0]].F32.raw);
+                virtualMemoryAccess<UInt32, true, false>(StoreData, address, &regF[instruction.reg[0]].F32.raw);
             } break;
             case 3: { // FSD rd,rs1,imm (D)
                 if(!(EXT&D_DoubleFloat))
                     throw Exception(Exception::Code::IllegalInstruction);
-                memoryAccess<UInt64, true, false>(StoreData, address, &regF[instruction.reg[0]].F64.raw);
+                virtualMemoryAccess<UInt64, true, false>(StoreData, address, &regF[instruction.reg[0]].F64.raw);
             } break;
         }
     }
 
-    void executeOpcode2F(const Instruction& instruction) {
-        if(!(EXT&A_AtomicOperations))
-            throw Exception(Exception::Code::IllegalInstruction);
+    template<typename type>
+    void executeAtomicMemoryOperation(const Instruction& instruction, UIntType address) {
+        typedef typename Integer<sizeof(type)*8>::unsigned_type unsigned_type;
         UInt8 funct = instruction.funct[0]&~TrailingBitMask<UInt8>(2);
-        UIntType address = readRegXU(instruction.reg[1]);
-        address = translate(StoreData, address);
+        type data, operand = readRegXI(instruction.reg[2]);
+        if(funct != 12) {
+            seal(address, sizeof(data));
+            memoryAccess<decltype(data), false, true>(LoadData, address, &data);
+            writeRegXI(instruction.reg[0], data);
+        }
 
-        if(instruction.funct[1] == 2) {
-            Int32 data;
-            if(funct != 12) {
-                seal(address, sizeof(data));
-                memoryAccess<decltype(data), false, true>(LoadData, address, &data);
-                writeRegXU(instruction.reg[0], data);
-            }
+        switch(funct) {
+            case 0: // AMOADD.W/D/Q rd,rs1,rs2 (A)
+                data = static_cast<unsigned_type>(data)+static_cast<unsigned_type>(operand);
+            break;
+            case 4: // AMOSWAP.W/D/Q rd,rs1,rs2 (A)
+                data = operand;
+            break;
+            case 8: // LR.W/D/Q rd,rs1 (A)
+            return;
+            case 12: // SC.W/D/Q rd,rs1,rs2 (A)
+                data = operand;
+            break;
+            case 16: // AMOXOR.W/D/Q rd,rs1,rs2 (A)
+                data ^= operand;
+            break;
+            case 32: // AMOOR.W/D/Q rd,rs1,rs2 (A)
+                data |= operand;
+            break;
+            case 48: // AMOAND.W/D/Q rd,rs1,rs2 (A)
+                data &= operand;
+            break;
+            case 64: // AMOMIN.W/D/Q rd,rs1,rs2 (A)
+                data = std::min(data, operand);
+            break;
+            case 80: // AMOMAX.W/D/Q rd,rs1,rs2 (A)
+                data = std::max(data, operand);
+            break;
+            case 96: // AMOMINU.W/D/Q rd,rs1,rs2 (A)
+                data = std::min(static_cast<unsigned_type>(data), static_cast<unsigned_type>(operand));
+            break;
+            case 112: // AMOMAXU.W/D/Q rd,rs1,rs2 (A)
+                data = std::max(static_cast<unsigned_type>(data), static_cast<unsigned_type>(operand));
+            break;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
 
-            switch(funct) {
-                case 0: // AMOADD.W rd,rs1,rs2 (A)
-                    data += readRegXI(instruction.reg[2]);
-                break;
-                case 4: // AMOSWAP.W rd,rs1,rs2 (A)
-                    data = readRegXI(instruction.reg[2]);
-                break;
-                case 8: // LR.W rd,rs1 (A)
-                return;
-                case 12: // SC.W rd,rs1,rs2 (A)
-                    data = readRegXI(instruction.reg[2]);
-                break;
-                case 16: // AMOXOR.W rd,rs1,rs2 (A)
-                    data ^= readRegXI(instruction.reg[2]);
-                break;
-                case 32: // AMOOR.W rd,rs1,rs2 (A)
-                    data |= readRegXI(instruction.reg[2]);
-                break;
-                case 48: // AMOAND.W rd,rs1,rs2 (A)
-                    data &= readRegXI(instruction.reg[2]);
-                break;
-                case 64: // AMOMIN.W rd,rs1,rs2 (A)
-                    data = std::min(data, static_cast<Int32>(readRegXI(instruction.reg[2])));
-                break;
-                case 80: // AMOMAX.W rd,rs1,rs2 (A)
-                    data = std::max(data, static_cast<Int32>(readRegXI(instruction.reg[2])));
-                break;
-                case 96: // AMOMINU.W rd,rs1,rs2 (A)
-                    data = std::min(static_cast<UInt32>(data), static_cast<UInt32>(readRegXI(instruction.reg[2])));
-                break;
-                case 112: // AMOMAXU.W rd,rs1,rs2 (A)
-                    data = std::max(static_cast<UInt32>(data), static_cast<UInt32>(readRegXI(instruction.reg[2])));
-                break;
-            }
+        std::lock_guard<std::recursive_mutex> lock(ram.sealsMutex);
+        if(funct != 12) {
+            unseal(address, sizeof(data));
+            memoryAccess<decltype(data), true, true>(StoreData, address, &data);
+        }else if(unseal(address, sizeof(data))) {
+            memoryAccess<decltype(data), true, true>(StoreData, address, &data);
+            writeRegXU(instruction.reg[0], 0);
+        }else
+            writeRegXU(instruction.reg[0], 1);
+    }
+
+    void executeOpcode2F(const Instruction& instruction) {
+        if(!(EXT&A_AtomicOperations))
+            throw Exception(Exception::Code::IllegalInstruction);
+        UIntType virtualAddress = readRegXU(instruction.reg[1]), address = translate(StoreData, virtualAddress);
+        if(traceRecorder)
+            traceRecorder->record(TraceRecord::Atomic, 1<<instruction.funct[1], virtualAddress, address, pc);
 
-            std::lock_guard<std::recursive_mutex> lock(ram.sealsMutex);
-            if(unseal(address, sizeof(data))) {
-                memoryAccess<decltype(data), true, true>(StoreData, address, &data);
-                writeRegXU(instruction.reg[0], 0);
-            }else
-                writeRegXU(instruction.reg[0], 1);
-        }else if(instruction.funct[1] == 3) {
-            if(XLEN < 64)
+        switch(instruction.funct[1]) {
+            case 2:
+                executeAtomicMemoryOperation<Int32>(instruction, address);
+            break;
+            case 3:
+                if(XLEN < 64)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                executeAtomicMemoryOperation<Int64>(instruction, address);
+            break;
+            case 4:
+                if(XLEN < 128)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                executeAtomicMemoryOperation<IntType>(instruction, address);
+            break;
+            default:
                 throw Exception(Exception::Code::IllegalInstruction);
+        }
+    }
 
-            Int64 data;
-            if(funct != 12) {
-                seal(address, sizeof(data));
-                memoryAccess<decltype(data), false, true>(LoadData, address, &data);
-                writeRegXU(instruction.reg[0], data);
-            }
+    template<typename type>
+    type divideSigned(type a, type b) {
+        typedef typename Integer<sizeof(type)*8>::unsigned_type unsigned_type;
+        if(b == 0)
+            return -1;
+        if(b == -1) // Avoids the host trap on overflow
+            return static_cast<unsigned_type>(0)-static_cast<unsigned_type>(a);
+        if(sizeof(type) == 16 && static_cast<Int64>(a) == a && static_cast<Int64>(b) == b)
+            return static_cast<Int64>(a)/static_cast<Int64>(b);
+        return a/b;
+    }
 
-            switch(funct) {
-                case 0: // AMOADD.D rd,rs1,rs2 (A, 64)
-                    data += readRegXI(instruction.reg[2]);
-                break;
-                case 4: // AMOSWAP.D rd,rs1,rs2 (A, 64)
-                    data = readRegXI(instruction.reg[2]);
-                break;
-                case 8: // LR.D rd,rs1 (A, 64)
-                return;
-                case 12: // SC.D rd,rs1,rs2 (A, 64)
-                    data = readRegXI(instruction.reg[2]);
-                break;
-                case 16: // AMOXOR.D rd,rs1,rs2 (A, 64)
-                    data ^= readRegXI(instruction.reg[2]);
-                break;
-                case 32: // AMOOR.D rd,rs1,rs2 (A, 64)
-                    data |= readRegXI(instruction.reg[2]);
-                break;
-                case 48: // AMOAND.D rd,rs1,rs2 (A, 64)
-                    data &= readRegXI(instruction.reg[2]);
-                break;
-                case 64: // AMOMIN.D rd,rs1,rs2 (A, 64)
-                    data = std::min(data, static_cast<Int64>(readRegXI(instruction.reg[2])));
-                break;
-                case 80: // AMOMAX.D rd,rs1,rs2 (A, 64)
-                    data = std::max(data, static_cast<Int64>(readRegXI(instruction.reg[2])));
-                break;
-                case 96: // AMOMINU.D rd,rs1,rs2 (A, 64)
-                    data = std::min(static_cast<UInt64>(data), static_cast<UInt64>(readRegXI(instruction.reg[2])));
-                break;
-                case 112: // AMOMAXU.D rd,rs1,rs2 (A, 64)
-                    data = std::max(static_cast<UInt64>(data), static_cast<UInt64>(readRegXI(instruction.reg[2])));
-                break;
-            }
+    template<typename type>
+    type divideUnsigned(type a, type b) {
+        if(b == 0)
+            return ~static_cast<type>(0);
+        if(sizeof(type) == 16 && static_cast<UInt64>(a) == a && static_cast<UInt64>(b) == b)
+            return static_cast<UInt64>(a)/static_cast<UInt64>(b);
+        return a/b;
+    }
 
-            std::lock_guard<std::recursive_mutex> lock(ram.sealsMutex);
-            if(unseal(address, sizeof(data))) {
-                memoryAccess<decltype(data), true, true>(StoreData, address, &data);
-                writeRegXU(instruction.reg[0], 0);
-            }else
-                writeRegXU(instruction.reg[0], 1);
-        }else
-            throw Exception(Exception::Code::IllegalInstruction);
+    template<typename type>
+    type remainderSigned(type a, type b) {
+        if(b == 0)
+            return a;
+        if(b == -1)
+            return 0;
+        if(sizeof(type) == 16 && static_cast<Int64>(a) == a && static_cast<Int64>(b) == b)
+            return static_cast<Int64>(a)%static_cast<Int64>(b);
+        return a%b;
+    }
+
+    template<typename type>
+    type remainderUnsigned(type a, type b) {
+        if(b == 0)
+            return a;
+        if(sizeof(type) == 16 && static_cast<UInt64>(a) == a && static_cast<UInt64>(b) == b)
+            return static_cast<UInt64>(a)%static_cast<UInt64>(b);
+        return a%b;
     }
 
     void executeOpcode33(const Instruction& instruction) {
+        UIntType a = readRegXU(instruction.reg[1]), b = readRegXU(instruction.reg[2]);
         if(instruction.funct[0] == 1) {
             if(!(EXT&M_MultiplyAndDivide))
                 throw Exception(Exception::Code::IllegalInstruction);
             switch(instruction.funct[1]) {
                 case 0: // MUL rd,rs1,rs2 (M)
-                    writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])*readRegXU(instruction.reg[2]));
+                    writeRegXU(instruction.reg[0], a*b);
                 break;
                 case 1: // MULH rd,rs1,rs2 (M)
-                    writeRegXI(instruction.reg[0], (
-                         static_cast<Int128>(readRegXU(instruction.reg[1]))
-                        *static_cast<Int128>(readRegXU(instruction.reg[2]))
-                    )>>64);
+                    writeRegXU(instruction.reg[0], multiplyHigh(a, b)
+                        -((static_cast<IntType>(a) < 0) ? b : 0)
+                        -((static_cast<IntType>(b) < 0) ? a : 0));
                 break;
                 case 2: // MULHSU rd,rs1,rs2 (M)
-                    writeRegXI(instruction.reg[0], (
-                          static_cast<Int128>(readRegXU(instruction.reg[1]))
-                        *static_cast<UInt128>(readRegXU(instruction.reg[2]))
-                    )>>64);
+                    writeRegXU(instruction.reg[0], multiplyHigh(a, b)
+                        -((static_cast<IntType>(a) < 0) ? b : 0));
                 break;
                 case 3: // MULHU rd,rs1,rs2 (M)
-                    writeRegXU(instruction.reg[0], (
-                         static_cast<UInt128>(readRegXU(instruction.reg[1]))
-                        *static_cast<UInt128>(readRegXU(instruction.reg[2]))
-                    )>>64);
+                    writeRegXU(instruction.reg[0], multiplyHigh(a, b));
                 break;
                 case 4: // DIV rd,rs1,rs2 (M)
-                    writeRegXI(instruction.reg[0], readRegXI(instruction.reg[1])/readRegXI(instruction.reg[2]));
+                    writeRegXI(instruction.reg[0], divideSigned<IntType>(a, b));
                 break;
                 case 5: // DIVU rd,rs1,rs2 (M)
-                    writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])/readRegXU(instruction.reg[2]));
+                    writeRegXU(instruction.reg[0], divideUnsigned<UIntType>(a, b));
                 break;
                 case 6: // REM rd,rs1,rs2 (M)
-                    writeRegXI(instruction.reg[0], readRegXI(instruction.reg[1])%readRegXI(instruction.reg[2]));
+                    writeRegXI(instruction.reg[0], remainderSigned<IntType>(a, b));
                 break;
                 case 7: // REMU rd,rs1,rs2 (M)
-                    writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])%readRegXU(instruction.reg[2]));
+                    writeRegXU(instruction.reg[0], remainderUnsigned<UIntType>(a, b));
                 break;
             }
         }else{
     		switch(instruction.funct[1]) {
     			case 0:
                     if(instruction.funct[0] == 0) //ADD rd,rs1,rs2
-                        writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])+readRegXU(instruction.reg[2]));
+                        writeRegXU(instruction.reg[0], a+b);
                     else if(instruction.funct[0] == 32) //SUB rd,rs1,rs2
-                        writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])-readRegXU(instruction.reg[2]));
+                        writeRegXU(instruction.reg[0], a-b);
                     else
                         throw Exception(Exception::Code::IllegalInstruction);
     			break;
     			case 1: // SLL rd,rs1,rs2
-                    writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])<<readRegXU(instruction.reg[2]));
+                    writeRegXU(instruction.reg[0], a<<(b&(XLEN-1)));
     			break;
     			case 2: // SLT rd,rs1,rs2
-                    writeRegXU(instruction.reg[0], (readRegXI(instruction.reg[1]) < readRegXI(instruction.reg[2]))?1:0);
+                    writeRegXU(instruction.reg[0], (static_cast<IntType>(a) < static_cast<IntType>(b))?1:0);
     			break;
     			case 3: // SLTU rd,rs1,rs2
-                    writeRegXU(instruction.reg[0], (readRegXU(instruction.reg[1]) < readRegXU(instruction.reg[2]))?1:0);
+                    writeRegXU(instruction.reg[0], (a < b)?1:0);
     			break;
     			case 4: // XOR rd,rs1,rs2
-                    writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])^readRegXU(instruction.reg[2]));
+                    writeRegXU(instruction.reg[0], a^b);
     			break;
     			case 5:
                     if(instruction.funct[0] == 0) //SRL rd,rs1,rs2
-                        writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])>>readRegXU(instruction.reg[2]));
+                        writeRegXU(instruction.reg[0], a>>(b&(XLEN-1)));
                     else if(instruction.funct[0] == 32) //SRA rd,rs1,rs2
-                        writeRegXI(instruction.reg[0], readRegXI(instruction.reg[1])>>readRegXI(instruction.reg[2]));
+                        writeRegXI(instruction.reg[0], static_cast<IntType>(a)>>(b&(XLEN-1)));
                     else
                         throw Exception(Exception::Code::IllegalInstruction);
     			break;
     			case 6: // OR rd,rs1,rs2
-                    writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])|readRegXU(instruction.reg[2]));
+                    writeRegXU(instruction.reg[0], a|b);
     			break;
     			case 7: // AND rd,rs1,rs2
-                    writeRegXU(instruction.reg[0], readRegXU(instruction.reg[1])&readRegXU(instruction.reg[2]));
+                    writeRegXU(instruction.reg[0], a&b);
     			break;
     		}
         }
@@ -1166,52 +1635,72 @@ class Cpu {
         writeRegXU(instruction.reg[0], instruction.imm);
     }
 
-    void executeOpcode3B(const Instruction& instruction) {
-        if(XLEN < 64)
-            throw Exception(Exception::Code::IllegalInstruction);
+    template<typename narrow_type>
+    void executeNarrowRegister(const Instruction& instruction) {
+        typedef typename Integer<sizeof(narrow_type)*8>::unsigned_type narrow_unsigned_type;
+        const UInt8 shiftMask = sizeof(narrow_type)*8-1;
+        narrow_unsigned_type a = readRegXU(instruction.reg[1]), b = readRegXU(instruction.reg[2]);
+        narrow_type result;
         if(instruction.funct[0] == 1) {
             if(!(EXT&M_MultiplyAndDivide))
                 throw Exception(Exception::Code::IllegalInstruction);
             switch(instruction.funct[1]) {
-                case 0: // MULW rd,rs1,rs2 (M, 64)
-                    writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1]))*static_cast<UInt32>(readRegXU(instruction.reg[2])));
+                case 0: // MULW/MULD rd,rs1,rs2 (M, 64/128)
+                    result = a*b;
                 break;
-                case 4: // DIVW rd,rs1,rs2 (M, 64)
-                    writeRegXI(instruction.reg[0], static_cast<Int32>(readRegXU(instruction.reg[1]))/static_cast<Int32>(readRegXU(instruction.reg[2])));
+                case 4: // DIVW/DIVD rd,rs1,rs2 (M, 64/128)
+                    result = divideSigned<narrow_type>(a, b);
                 break;
-                case 5: // DIVUW rd,rs1,rs2 (M, 64)
-                    writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1]))/static_cast<UInt32>(readRegXU(instruction.reg[2])));
+                case 5: // DIVUW/DIVUD rd,rs1,rs2 (M, 64/128)
+                    result = divideUnsigned<narrow_unsigned_type>(a, b);
                 break;
-                case 6: // REMW rd,rs1,rs2 (M, 64)
-                    writeRegXI(instruction.reg[0], static_cast<Int32>(readRegXU(instruction.reg[1]))/static_cast<Int32>(readRegXU(instruction.reg[2])));
+                case 6: // REMW/REMD rd,rs1,rs2 (M, 64/128)
+                    result = remainderSigned<narrow_type>(a, b);
                 break;
-                case 7: // REMUW rd,rs1,rs2 (M, 64)
-                    writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1]))%static_cast<UInt32>(readRegXU(instruction.reg[2])));
+                case 7: // REMUW/REMUD rd,rs1,rs2 (M, 64/128)
+                    result = remainderUnsigned<narrow_unsigned_type>(a, b);
                 break;
+                default:
+                    throw Exception(Exception::Code::IllegalInstruction);
             }
         }else{
     		switch(instruction.funct[1]) {
     			case 0:
-                    if(instruction.funct[0] == 0) //ADDW rd,rs1,rs2 (64)
-                        writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1]))+static_cast<UInt32>(readRegXU(instruction.reg[2])));
-                    else if(instruction.funct[0] == 32) //SUBW rd,rs1,rs2 (64)
-                        writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1]))-static_cast<UInt32>(readRegXU(instruction.reg[2])));
+                    if(instruction.funct[0] == 0) //ADDW/ADDD rd,rs1,rs2 (64/128)
+                        result = a+b;
+                    else if(instruction.funct[0] == 32) //SUBW/SUBD rd,rs1,rs2 (64/128)
+                        result = a-b;
                     else
                         throw Exception(Exception::Code::IllegalInstruction);
     			break;
-    			case 1: // SLLW rd,rs1,rs2 (64)
-                    writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1]))<<static_cast<UInt32>(readRegXU(instruction.reg[2])));
+    			case 1: // SLLW/SLLD rd,rs1,rs2 (64/128)
+                    result = a<<(b&shiftMask);
     			break;
     			case 5:
-                    if(instruction.funct[0] == 0) //SRLW rd,rs1,rs2 (64)
-                        writeRegXU(instruction.reg[0], static_cast<UInt32>(readRegXU(instruction.reg[1]))>>static_cast<UInt32>(readRegXU(instruction.reg[2])));
-                    else if(instruction.funct[0] == 32) //SRAW rd,rs1,rs2 (64)
-                        writeRegXI(instruction.reg[0], static_cast<Int32>(readRegXI(instruction.reg[1]))>>static_cast<Int32>(readRegXI(instruction.reg[2])));
+                    if(instruction.funct[0] == 0) //SRLW/SRLD rd,rs1,rs2 (64/128)
+                        result = a>>(b&shiftMask);
+                    else if(instruction.funct[0] == 32) //SRAW/SRAD rd,rs1,rs2 (64/128)
+                        result = static_cast<narrow_type>(a)>>(b&shiftMask);
                     else
                         throw Exception(Exception::Code::IllegalInstruction);
     			break;
+                default:
+                    throw Exception(Exception::Code::IllegalInstruction);
     		}
         }
+        writeRegXI(instruction.reg[0], result);
+    }
+
+    void executeOpcode3B(const Instruction& instruction) {
+        if(XLEN < 64)
+            throw Exception(Exception::Code::IllegalInstruction);
+        executeNarrowRegister<Int32>(instruction);
+    }
+
+    void executeOpcode7B(const Instruction& instruction) {
+        if(XLEN < 128)
+            throw Exception(Exception::Code::IllegalInstruction);
+        executeNarrowRegister<Int64>(instruction);
     }
 
     #define FloatInstructionAux \
@@ -1546,48 +2035,810 @@ class Cpu {
         }
     }
 
-    void executeOpcode63(const Instruction& instruction, UIntType pcNextValue) {
-        switch(instruction.funct[0]) {
-            case 0: // BEQ rs1,rs2,imm
-                if(readRegXU(instruction.reg[1]) == readRegXU(instruction.reg[2])) break;
-                pc = pcNextValue;
-            return;
-            case 1:// BNE rs1,rs2,imm
-                if(readRegXU(instruction.reg[1]) != readRegXU(instruction.reg[2])) break;
-                pc = pcNextValue;
-            return;
-            case 4:// BLT rs1,rs2,imm
-                if(readRegXI(instruction.reg[1]) < readRegXI(instruction.reg[2])) break;
-                pc = pcNextValue;
-            return;
-            case 5:// BGE rs1,rs2,imm
-                if(readRegXI(instruction.reg[1]) > readRegXI(instruction.reg[2])) break;
-                pc = pcNextValue;
-            return;
-            case 6:// BLTU rs1,rs2,imm
-                if(readRegXU(instruction.reg[1]) < readRegXU(instruction.reg[2])) break;
-                pc = pcNextValue;
-            return;
-            case 7:// BGEU rs1,rs2,imm
-                if(readRegXU(instruction.reg[1]) > readRegXU(instruction.reg[2])) break;
-                pc = pcNextValue;
-            return;
-            default:
-                throw Exception(Exception::Code::IllegalInstruction);
-        }
-        pc += instruction.imm;
+    UInt32 getVectorMaxLength(UIntType vtype) {
+        UInt8 lmul = getBitsFrom(vtype, 0, 3), sew = getBitsFrom(vtype, 3, 3);
+        if(sew > 3 || lmul == 4 || getBitsFrom(vtype, 8, XLEN-8) != 0)
+            return 0;
+        UInt32 elements = VLEN>>(3+sew);
+        return (lmul < 4) ? elements<<lmul : elements>>(8-lmul);
     }
 
-    void executeOpcode67(const Instruction& instruction, UIntType pcNextValue) {
-        // JALR rd,rs1,imm
-        writeRegXU(instruction.reg[0], pcNextValue);
-        pc = (readRegXU(instruction.reg[1])+instruction.imm)&~TrailingBitMask<UIntType>(1);
+    void checkVectorRegisterGroup(UInt8 index) {
+        UInt8 lmul = getBitsFrom(csr.vtype, 0, 3);
+        if(lmul < 4 && (index&TrailingBitMask<UInt8>(lmul)))
+            throw Exception(Exception::Code::IllegalInstruction);
     }
 
-    void executeOpcode6F(const Instruction& instruction, UIntType pcNextValue) {
-        // JAL rd,imm
-        writeRegXU(instruction.reg[0], pcNextValue);
-        pc += instruction.imm;
+    // Checks vd, vs2 and in the vector-vector forms also vs1
+    void checkVectorOperandGroups(const Instruction& instruction, bool destination = true) {
+        if(destination)
+            checkVectorRegisterGroup(instruction.reg[0]);
+        checkVectorRegisterGroup(instruction.reg[2]);
+        if(instruction.funct[1] <= 2) // OPIVV, OPFVV and OPMVV
+            checkVectorRegisterGroup(instruction.reg[1]);
+    }
+
+    const UInt8* getVectorMask(const Instruction& instruction) {
+        return (instruction.funct[0]&1) ? NULL : regV.data;
+    }
+
+    template<typename type>
+    type* broadcastVectorScalar(type value) {
+        type* buffer = reinterpret_cast<type*>(regV.scratch);
+        vectorBroadcast(buffer, value, csr.vl);
+        return buffer;
+    }
+
+    template<bool store>
+    void vectorElementAccess(MemoryAccessType mat, UIntType address, UInt8* element, UInt8 eew) {
+        AddressType mappedAddress = translate(mat, address);
+        if(traceRecorder)
+            traceAccess(mat, eew, address, mappedAddress);
+        switch(eew) {
+            case 1:
+                memoryAccess<UInt8, store, false>(mat, mappedAddress, element);
+            break;
+            case 2:
+                memoryAccess<UInt16, store, false>(mat, mappedAddress, reinterpret_cast<UInt16*>(element));
+            break;
+            case 4:
+                memoryAccess<UInt32, store, false>(mat, mappedAddress, reinterpret_cast<UInt32*>(element));
+            break;
+            case 8:
+                memoryAccess<UInt64, store, false>(mat, mappedAddress, reinterpret_cast<UInt64*>(element));
+            break;
+        }
+    }
+
+    template<bool store>
+    void executeVectorMemoryAccess(const Instruction& instruction) {
+        if(!(EXT&V_VectorOperations))
+            throw Exception(Exception::Code::IllegalInstruction);
+        const MemoryAccessType mat = (store) ? StoreData : LoadData;
+        UInt32 fields = instruction.imm;
+        UInt8 eew = (instruction.funct[0] == 0) ? 1 : 1<<(instruction.funct[0]-4),
+              mop = getBitsFrom(fields, 6, 2),
+              nf = getBitsFrom(fields, 9, 3),
+              vd = (store) ? getBitsFrom(fields, 0, 5) : instruction.reg[0],
+              umop = (store) ? instruction.reg[2] : getBitsFrom(fields, 0, 5);
+        const UInt8* mask = (getBitsFrom(fields, 5, 1)) ? NULL : regV.data;
+        UIntType address = readRegXU(instruction.reg[1]);
+        UInt32 start = csr.vstart, end = csr.vl;
+        bool faultOnlyFirst = false;
+
+        if(getBitsFrom(fields, 8, 1))
+            throw Exception(Exception::Code::IllegalInstruction);
+        if(mop == 0 && umop == 0x08) { // VL<nf>R.V / VS<nf>R.V
+            if(mask || (nf&(nf+1)) != 0 || vd%(nf+1) != 0)
+                throw Exception(Exception::Code::IllegalInstruction);
+            end = (nf+1)*regV.VLENB/eew;
+        }else{
+            if(getBitsFrom(csr.vtype, XLEN-1, 1) || nf != 0)
+                throw Exception(Exception::Code::IllegalInstruction);
+            if(mop == 0)
+                switch(umop) {
+                    case 0x00: // VLE<eew>.V / VSE<eew>.V
+                    break;
+                    case 0x0B: // VLM.V / VSM.V
+                        if(mask || eew != 1)
+                            throw Exception(Exception::Code::IllegalInstruction);
+                        end = (end+7)/8;
+                    break;
+                    case 0x10: // VLE<eew>FF.V
+                        if(store)
+                            throw Exception(Exception::Code::IllegalInstruction);
+                        faultOnlyFirst = true;
+                    break;
+                    default:
+                        throw Exception(Exception::Code::IllegalInstruction);
+                }
+            else if(mop != 2) // TODO : Indexed
+                throw Exception(Exception::Code::IllegalInstruction);
+            if(mop != 0 || umop != 0x0B) // VLM.V / VSM.V access a single register
+                checkVectorRegisterGroup(vd);
+        }
+        // The effective group size depends on eew, it must not leave the register file
+        if(vd*regV.VLENB+end*eew > sizeof(regV.data))
+            throw Exception(Exception::Code::IllegalInstruction);
+
+        UInt8* data = regV.data+vd*regV.VLENB;
+        if(mop == 2) { // VLSE<eew>.V / VSSE<eew>.V
+            IntType stride = readRegXI(umop);
+            for(UInt32 i = start; i < end; ++i) {
+                if(!vectorMaskActive(mask, i))
+                    continue;
+                try {
+                    vectorElementAccess<store>(mat, address+stride*i, data+i*eew, eew);
+                } catch(MemoryAccessException& e) {
+                    csr.vstart = i;
+                    throw;
+                }
+            }
+        }else if(mask) {
+            for(UInt32 i = start; i < end; ++i) {
+                if(!vectorMaskActive(mask, i))
+                    continue;
+                try {
+                    vectorElementAccess<store>(mat, address+i*eew, data+i*eew, eew);
+                } catch(MemoryAccessException& e) {
+                    if(faultOnlyFirst && i > 0) {
+                        csr.vl = i;
+                        break;
+                    }
+                    csr.vstart = i;
+                    throw;
+                }
+            }
+        }else{
+            // Unit stride accesses are translated once per page and copied as a block
+            UIntType begin = address+start*eew, length = (end-start)*eew;
+            data += start*eew;
+            while(length) {
+                UIntType chunk = std::min<UIntType>(length, 4096-(begin&4095));
+                try {
+                    AddressType mappedAddress = translate(mat, begin);
+                    if(traceRecorder)
+                        traceAccess(mat, chunk, begin, mappedAddress);
+                    memoryAccessBlock<store>(mat, mappedAddress, data, chunk);
+                } catch(MemoryAccessException& e) {
+                    UInt32 element = (begin-address)/eew;
+                    if(faultOnlyFirst && element > 0) {
+                        csr.vl = element;
+                        break;
+                    }
+                    csr.vstart = element;
+                    throw;
+                }
+                begin += chunk;
+                data += chunk;
+                length -= chunk;
+            }
+        }
+        csr.vstart = 0;
+    }
+
+    void executeVectorConfiguration(const Instruction& instruction) {
+        UIntType vtype, avl;
+        bool immediateLength = false;
+        if(!getBitsFrom(instruction.funct[0], 6, 1)) // VSETVLI rd,rs1,vtypei
+            vtype = (getBitsFrom(instruction.funct[0], 0, 6)<<5)|instruction.reg[2];
+        else if(getBitsFrom(instruction.funct[0], 5, 2) == 3) { // VSETIVLI rd,uimm,vtypei
+            vtype = (getBitsFrom(instruction.funct[0], 0, 5)<<5)|instruction.reg[2];
+            immediateLength = true;
+        }else if(instruction.funct[0] == 0x40) // VSETVL rd,rs1,rs2
+            vtype = readRegXU(instruction.reg[2]);
+        else
+            throw Exception(Exception::Code::IllegalInstruction);
+
+        if(immediateLength)
+            avl = instruction.reg[1];
+        else if(instruction.reg[1])
+            avl = readRegXU(instruction.reg[1]);
+        else
+            avl = (instruction.reg[0]) ? ~static_cast<UIntType>(0) : csr.vl;
+
+        UInt32 vlmax = getVectorMaxLength(vtype);
+        if(vlmax == 0) {
+            csr.vtype = static_cast<UIntType>(1)<<(XLEN-1);
+            csr.vl = 0;
+        }else{
+            csr.vtype = vtype;
+            csr.vl = std::min<UIntType>(avl, vlmax);
+        }
+        csr.vstart = 0;
+        writeRegXU(instruction.reg[0], csr.vl);
+    }
+
+    template<typename type>
+    void executeVectorIntegerOperation(const Instruction& instruction, type* b) {
+        const UInt8* mask = getVectorMask(instruction);
+        type *vd = regV.template element<type>(instruction.reg[0]),
+             *vs2 = regV.template element<type>(instruction.reg[2]);
+        UInt32 start = csr.vstart, end = csr.vl;
+        bool saturated = false;
+        VectorOperation op;
+        switch(instruction.funct[0]>>1) {
+            case 0x00: // VADD.VV/VX/VI vd,vs2,vs1
+                op = VectorAdd;
+            break;
+            case 0x02: // VSUB.VV/VX vd,vs2,vs1
+                op = VectorSub;
+            break;
+            case 0x03: // VRSUB.VX/VI vd,vs2,rs1
+                op = VectorReverseSub;
+            break;
+            case 0x04: // VMINU.VV/VX vd,vs2,vs1
+                op = VectorMinU;
+            break;
+            case 0x05: // VMIN.VV/VX vd,vs2,vs1
+                op = VectorMin;
+            break;
+            case 0x06: // VMAXU.VV/VX vd,vs2,vs1
+                op = VectorMaxU;
+            break;
+            case 0x07: // VMAX.VV/VX vd,vs2,vs1
+                op = VectorMax;
+            break;
+            case 0x09: // VAND.VV/VX/VI vd,vs2,vs1
+                op = VectorAnd;
+            break;
+            case 0x0A: // VOR.VV/VX/VI vd,vs2,vs1
+                op = VectorOr;
+            break;
+            case 0x0B: // VXOR.VV/VX/VI vd,vs2,vs1
+                op = VectorXor;
+            break;
+            case 0x17: // VMERGE.VVM/VXM/VIM vd,vs2,vs1,v0 / VMV.V.V/X/I vd,vs1
+                checkVectorOperandGroups(instruction);
+                for(UInt32 i = start; i < end; ++i)
+                    vd[i] = vectorMaskActive(mask, i) ? b[i] : vs2[i];
+            return;
+            case 0x18: // VMSEQ.VV/VX/VI vd,vs2,vs1
+            case 0x19: // VMSNE.VV/VX/VI vd,vs2,vs1
+            case 0x1A: // VMSLTU.VV/VX vd,vs2,vs1
+            case 0x1B: // VMSLT.VV/VX vd,vs2,vs1
+            case 0x1C: // VMSLEU.VV/VX/VI vd,vs2,vs1
+            case 0x1D: // VMSLE.VV/VX/VI vd,vs2,vs1
+            case 0x1E: // VMSGTU.VX/VI vd,vs2,rs1
+            case 0x1F: // VMSGT.VX/VI vd,vs2,rs1
+                op = static_cast<VectorOperation>(VectorEqual+(instruction.funct[0]>>1)-0x18);
+                checkVectorOperandGroups(instruction, false);
+                vectorCompare(op, regV.data+instruction.reg[0]*regV.VLENB, vs2, b, start, end, mask,
+                    [](VectorOperation op, type a, type b) {
+                        bool saturated;
+                        return vectorElementOperation(op, a, b, saturated) != 0;
+                    });
+            return;
+            case 0x20: // VSADDU.VV/VX/VI vd,vs2,vs1
+                op = VectorSaturatingAddU;
+            break;
+            case 0x21: // VSADD.VV/VX/VI vd,vs2,vs1
+                op = VectorSaturatingAdd;
+            break;
+            case 0x22: // VSSUBU.VV/VX vd,vs2,vs1
+                op = VectorSaturatingSubU;
+            break;
+            case 0x23: // VSSUB.VV/VX vd,vs2,vs1
+                op = VectorSaturatingSub;
+            break;
+            case 0x25: // VSLL.VV/VX/VI vd,vs2,vs1
+                op = VectorShiftLeft;
+            break;
+            case 0x27: { // VMV<nr>R.V vd,vs2
+                UInt8 count = instruction.reg[1]+1;
+                if(instruction.funct[1] != 3 || (count&(count-1)) != 0 ||
+                   (instruction.reg[0]|instruction.reg[2])&(count-1))
+                    throw Exception(Exception::Code::IllegalInstruction);
+                memmove(vd, vs2, count*regV.VLENB);
+            } return;
+            case 0x28: // VSRL.VV/VX/VI vd,vs2,vs1
+                op = VectorShiftRightLogical;
+            break;
+            case 0x29: // VSRA.VV/VX/VI vd,vs2,vs1
+                op = VectorShiftRightArithmetic;
+            break;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+        checkVectorOperandGroups(instruction);
+        vectorArithmetic(op, vd, vs2, b, start, end, mask, saturated);
+        if(saturated)
+            csr.vxsat = 1;
+    }
+
+    template<typename type>
+    void executeVectorMultiplyOperation(const Instruction& instruction, type* b) {
+        const UInt8* mask = getVectorMask(instruction);
+        type *vd = regV.template element<type>(instruction.reg[0]),
+             *vs2 = regV.template element<type>(instruction.reg[2]);
+        UInt32 start = csr.vstart, end = csr.vl;
+        bool saturated = false;
+        UInt8 funct6 = instruction.funct[0]>>1;
+        VectorOperation op;
+        switch(funct6) {
+            case 0x00: // VREDSUM.VS vd,vs2,vs1
+            case 0x01: // VREDAND.VS vd,vs2,vs1
+            case 0x02: // VREDOR.VS vd,vs2,vs1
+            case 0x03: // VREDXOR.VS vd,vs2,vs1
+            case 0x04: // VREDMINU.VS vd,vs2,vs1
+            case 0x05: // VREDMIN.VS vd,vs2,vs1
+            case 0x06: // VREDMAXU.VS vd,vs2,vs1
+            case 0x07: { // VREDMAX.VS vd,vs2,vs1
+                const VectorOperation reductions[] = {
+                    VectorAdd, VectorAnd, VectorOr, VectorXor,
+                    VectorMinU, VectorMin, VectorMaxU, VectorMax
+                };
+                if(instruction.funct[1] != 2 || start != 0)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                checkVectorRegisterGroup(instruction.reg[2]);
+                if(end == 0)
+                    return;
+                type accumulator = b[0];
+                for(UInt32 i = 0; i < end; ++i)
+                    if(vectorMaskActive(mask, i))
+                        accumulator = vectorElementOperation(reductions[funct6], accumulator, vs2[i], saturated);
+                vd[0] = accumulator;
+            } return;
+            case 0x10:
+                if(instruction.funct[1] == 6) { // VMV.S.X vd,rs1
+                    if(instruction.reg[2] != 0)
+                        throw Exception(Exception::Code::IllegalInstruction);
+                    if(start < end)
+                        vd[0] = b[0];
+                    return;
+                }
+                switch(instruction.reg[1]) {
+                    case 0x00: // VMV.X.S rd,vs2
+                        writeRegXI(instruction.reg[0], static_cast<typename std::make_signed<type>::type>(vs2[0]));
+                    break;
+                    case 0x10: { // VCPOP.M rd,vs2
+                        UIntType count = 0;
+                        for(UInt32 i = start; i < end; ++i)
+                            if(vectorMaskActive(mask, i) && regV.getMaskBit(instruction.reg[2], i))
+                                ++count;
+                        writeRegXU(instruction.reg[0], count);
+                    } break;
+                    case 0x11: { // VFIRST.M rd,vs2
+                        IntType first = -1;
+                        for(UInt32 i = start; i < end; ++i)
+                            if(vectorMaskActive(mask, i) && regV.getMaskBit(instruction.reg[2], i)) {
+                                first = i;
+                                break;
+                            }
+                        writeRegXI(instruction.reg[0], first);
+                    } break;
+                    default:
+                        throw Exception(Exception::Code::IllegalInstruction);
+                }
+            return;
+            case 0x14: // VID.V vd
+                if(instruction.funct[1] != 2 || instruction.reg[1] != 0x11)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                checkVectorRegisterGroup(instruction.reg[0]);
+                for(UInt32 i = start; i < end; ++i)
+                    if(vectorMaskActive(mask, i))
+                        vd[i] = i;
+            return;
+            case 0x18: // VMANDN.MM vd,vs2,vs1
+            case 0x19: // VMAND.MM vd,vs2,vs1
+            case 0x1A: // VMOR.MM vd,vs2,vs1
+            case 0x1B: // VMXOR.MM vd,vs2,vs1
+            case 0x1C: // VMORN.MM vd,vs2,vs1
+            case 0x1D: // VMNAND.MM vd,vs2,vs1
+            case 0x1E: // VMNOR.MM vd,vs2,vs1
+            case 0x1F: { // VMXNOR.MM vd,vs2,vs1
+                if(instruction.funct[1] != 2 || mask)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                UInt8 *md = regV.data+instruction.reg[0]*regV.VLENB,
+                      *ma = regV.data+instruction.reg[2]*regV.VLENB,
+                      *mb = regV.data+instruction.reg[1]*regV.VLENB;
+                for(UInt32 i = 0; i < (end+7)/8; ++i)
+                    switch(funct6) {
+                        case 0x18: md[i] = ma[i]&~mb[i]; break;
+                        case 0x19: md[i] = ma[i]&mb[i]; break;
+                        case 0x1A: md[i] = ma[i]|mb[i]; break;
+                        case 0x1B: md[i] = ma[i]^mb[i]; break;
+                        case 0x1C: md[i] = ma[i]|~mb[i]; break;
+                        case 0x1D: md[i] = ~(ma[i]&mb[i]); break;
+                        case 0x1E: md[i] = ~(ma[i]|mb[i]); break;
+                        case 0x1F: md[i] = ~(ma[i]^mb[i]); break;
+                    }
+            } return;
+            case 0x20: // VDIVU.VV/VX vd,vs2,vs1
+                op = VectorDivU;
+            break;
+            case 0x21: // VDIV.VV/VX vd,vs2,vs1
+                op = VectorDiv;
+            break;
+            case 0x22: // VREMU.VV/VX vd,vs2,vs1
+                op = VectorRemU;
+            break;
+            case 0x23: // VREM.VV/VX vd,vs2,vs1
+                op = VectorRem;
+            break;
+            case 0x24: // VMULHU.VV/VX vd,vs2,vs1
+                op = VectorMulHighU;
+            break;
+            case 0x25: // VMUL.VV/VX vd,vs2,vs1
+                op = VectorMul;
+            break;
+            case 0x26: // VMULHSU.VV/VX vd,vs2,vs1
+                op = VectorMulHighSU;
+            break;
+            case 0x27: // VMULH.VV/VX vd,vs2,vs1
+                op = VectorMulHigh;
+            break;
+            case 0x29: // VMADD.VV/VX vd,vs1,vs2
+            case 0x2B: // VNMSUB.VV/VX vd,vs1,vs2
+            case 0x2D: // VMACC.VV/VX vd,vs1,vs2
+            case 0x2F: { // VNMSAC.VV/VX vd,vs1,vs2
+                checkVectorOperandGroups(instruction);
+                bool overwriteMultiplicand = (funct6 < 0x2C), subtract = (funct6&2);
+                for(UInt32 i = start; i < end; ++i) {
+                    if(!vectorMaskActive(mask, i))
+                        continue;
+                    type product = vectorElementOperation(VectorMul, b[i], (overwriteMultiplicand) ? vd[i] : vs2[i], saturated),
+                         addend = (overwriteMultiplicand) ? vs2[i] : vd[i];
+                    vd[i] = (subtract) ? addend-product : addend+product;
+                }
+            } return;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+        checkVectorOperandGroups(instruction);
+        vectorArithmetic(op, vd, vs2, b, start, end, mask, saturated);
+    }
+
+    template<typename type>
+    void executeVectorFloatOperation(const Instruction& instruction, type* b) {
+        if(!(EXT&F_Float) || sizeof(type) < 4 || (sizeof(type) == 8 && !(EXT&D_DoubleFloat)))
+            throw Exception(Exception::Code::IllegalInstruction);
+        const UInt8* mask = getVectorMask(instruction);
+        type *vd = regV.template element<type>(instruction.reg[0]),
+             *vs2 = regV.template element<type>(instruction.reg[2]);
+        UInt32 start = csr.vstart, end = csr.vl;
+        UInt8 funct6 = instruction.funct[0]>>1;
+        VectorFloatOperation op;
+        switch(funct6) {
+            case 0x00: // VFADD.VV/VF vd,vs2,vs1
+                op = VectorFloatAdd;
+            break;
+            case 0x02: // VFSUB.VV/VF vd,vs2,vs1
+                op = VectorFloatSub;
+            break;
+            case 0x04: // VFMIN.VV/VF vd,vs2,vs1
+                op = VectorFloatMin;
+            break;
+            case 0x06: // VFMAX.VV/VF vd,vs2,vs1
+                op = VectorFloatMax;
+            break;
+            case 0x08: // VFSGNJ.VV/VF vd,vs2,vs1
+                op = VectorFloatSignInject;
+            break;
+            case 0x09: // VFSGNJN.VV/VF vd,vs2,vs1
+                op = VectorFloatSignInjectNegated;
+            break;
+            case 0x0A: // VFSGNJX.VV/VF vd,vs2,vs1
+                op = VectorFloatSignInjectXor;
+            break;
+            case 0x20: // VFDIV.VV/VF vd,vs2,vs1
+                op = VectorFloatDiv;
+            break;
+            case 0x21: // VFRDIV.VF vd,vs2,rs1
+                op = VectorFloatReverseDiv;
+            break;
+            case 0x24: // VFMUL.VV/VF vd,vs2,vs1
+                op = VectorFloatMul;
+            break;
+            case 0x27: // VFRSUB.VF vd,vs2,rs1
+                op = VectorFloatReverseSub;
+            break;
+            case 0x01: // VFREDUSUM.VS vd,vs2,vs1
+            case 0x03: // VFREDOSUM.VS vd,vs2,vs1
+            case 0x05: // VFREDMIN.VS vd,vs2,vs1
+            case 0x07: { // VFREDMAX.VS vd,vs2,vs1
+                if(instruction.funct[1] != 1 || start != 0)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                checkVectorRegisterGroup(instruction.reg[2]);
+                if(end == 0)
+                    return;
+                op = (funct6 == 0x05) ? VectorFloatMin : (funct6 == 0x07) ? VectorFloatMax : VectorFloatAdd;
+                typedef typename std::conditional<sizeof(type) == 4, float, double>::type float_type;
+                float_type *fd = reinterpret_cast<float_type*>(vd), *fs2 = reinterpret_cast<float_type*>(vs2),
+                           accumulator = reinterpret_cast<float_type*>(b)[0];
+                for(UInt32 i = 0; i < end; ++i)
+                    if(vectorMaskActive(mask, i))
+                        accumulator = vectorFloatElementOperation(op, accumulator, fs2[i]);
+                fd[0] = accumulator;
+            } return;
+            case 0x10:
+                if(instruction.funct[1] == 5) { // VFMV.S.F vd,rs1
+                    if(instruction.reg[2] != 0)
+                        throw Exception(Exception::Code::IllegalInstruction);
+                    if(start < end)
+                        vd[0] = b[0];
+                }else if(instruction.reg[1] == 0) { // VFMV.F.S rd,vs2
+                    if(sizeof(type) == 4)
+                        regF[instruction.reg[0]].F32.raw = vs2[0];
+                    else
+                        regF[instruction.reg[0]].F64.raw = vs2[0];
+                }else
+                    throw Exception(Exception::Code::IllegalInstruction);
+            return;
+            case 0x17: // VFMERGE.VFM vd,vs2,rs1,v0 / VFMV.V.F vd,rs1
+                if(instruction.funct[1] != 5)
+                    throw Exception(Exception::Code::IllegalInstruction);
+                checkVectorOperandGroups(instruction);
+                for(UInt32 i = start; i < end; ++i)
+                    vd[i] = vectorMaskActive(mask, i) ? b[i] : vs2[i];
+            return;
+            case 0x18: // VMFEQ.VV/VF vd,vs2,vs1
+            case 0x19: // VMFLE.VV/VF vd,vs2,vs1
+            case 0x1B: // VMFLT.VV/VF vd,vs2,vs1
+            case 0x1C: // VMFNE.VV/VF vd,vs2,vs1
+            case 0x1D: // VMFGT.VF vd,vs2,rs1
+            case 0x1F: { // VMFGE.VF vd,vs2,rs1
+                typedef typename std::conditional<sizeof(type) == 4, float, double>::type float_type;
+                const VectorFloatOperation comparisons[] = {
+                    VectorFloatEqual, VectorFloatLessEqual, VectorFloatEqual, VectorFloatLess,
+                    VectorFloatNotEqual, VectorFloatGreater, VectorFloatEqual, VectorFloatGreaterEqual
+                };
+                checkVectorOperandGroups(instruction, false);
+                vectorCompare(comparisons[funct6-0x18], regV.data+instruction.reg[0]*regV.VLENB,
+                    reinterpret_cast<float_type*>(vs2), reinterpret_cast<float_type*>(b), start, end, mask,
+                    [](VectorFloatOperation op, float_type a, float_type b) {
+                        return vectorFloatElementOperation(op, a, b) != 0;
+                    });
+            } return;
+            case 0x28: // VFMADD.VV/VF vd,vs1,vs2
+            case 0x29: // VFNMADD.VV/VF vd,vs1,vs2
+            case 0x2A: // VFMSUB.VV/VF vd,vs1,vs2
+            case 0x2B: // VFNMSUB.VV/VF vd,vs1,vs2
+            case 0x2C: // VFMACC.VV/VF vd,vs1,vs2
+            case 0x2D: // VFNMACC.VV/VF vd,vs1,vs2
+            case 0x2E: // VFMSAC.VV/VF vd,vs1,vs2
+            case 0x2F: { // VFNMSAC.VV/VF vd,vs1,vs2
+                typedef typename std::conditional<sizeof(type) == 4, float, double>::type float_type;
+                checkVectorOperandGroups(instruction);
+                float_type *fd = reinterpret_cast<float_type*>(vd), *fs2 = reinterpret_cast<float_type*>(vs2),
+                           *fs1 = reinterpret_cast<float_type*>(b);
+                bool overwriteMultiplicand = (funct6 < 0x2C),
+                     negateProduct = (funct6&1),
+                     negateAddend = ((funct6&3) == 1 || (funct6&3) == 2);
+                for(UInt32 i = start; i < end; ++i) {
+                    if(!vectorMaskActive(mask, i))
+                        continue;
+                    float_type multiplicand = (overwriteMultiplicand) ? fd[i] : fs2[i],
+                               addend = (overwriteMultiplicand) ? fs2[i] : fd[i];
+                    fd[i] = std::fma((negateProduct) ? -fs1[i] : fs1[i], multiplicand, (negateAddend) ? -addend : addend);
+                }
+            } return;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+        typedef typename std::conditional<sizeof(type) == 4, float, double>::type float_type;
+        checkVectorOperandGroups(instruction);
+        vectorFloatArithmetic(op, reinterpret_cast<float_type*>(vd), reinterpret_cast<float_type*>(vs2),
+                              reinterpret_cast<float_type*>(b), start, end, mask);
+    }
+
+    template<typename type>
+    void executeVectorOperation(const Instruction& instruction) {
+        type* b;
+        switch(instruction.funct[1]) {
+            case 0: // OPIVV
+            case 2: // OPMVV
+            case 1: // OPFVV
+                b = regV.template element<type>(instruction.reg[1]);
+            break;
+            case 3: // OPIVI
+                if(getBitsFrom(instruction.funct[0], 1, 6) >= 0x25) // Shifts take an unsigned immediate
+                    b = broadcastVectorScalar<type>(instruction.reg[1]);
+                else
+                    b = broadcastVectorScalar<type>(static_cast<Int8>(instruction.reg[1]<<3)>>3);
+            break;
+            case 4: // OPIVX
+            case 6: // OPMVX
+                b = broadcastVectorScalar<type>(readRegXI(instruction.reg[1]));
+            break;
+            case 5: { // OPFVF
+                type value = (sizeof(type) == 4) ? regF[instruction.reg[1]].F32.raw : regF[instruction.reg[1]].F64.raw;
+                b = broadcastVectorScalar<type>(value);
+            } break;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+        switch(instruction.funct[1]) {
+            case 0:
+            case 3:
+            case 4:
+                executeVectorIntegerOperation<type>(instruction, b);
+            break;
+            case 2:
+            case 6:
+                executeVectorMultiplyOperation<type>(instruction, b);
+            break;
+            case 1:
+            case 5:
+                executeVectorFloatOperation<type>(instruction, b);
+            break;
+        }
+    }
+
+    void executeOpcode57(const Instruction& instruction) {
+        if(!(EXT&V_VectorOperations))
+            throw Exception(Exception::Code::IllegalInstruction);
+        if(instruction.funct[1] == 7) {
+            executeVectorConfiguration(instruction);
+            return;
+        }
+        if(getBitsFrom(csr.vtype, XLEN-1, 1))
+            throw Exception(Exception::Code::IllegalInstruction);
+        switch(getBitsFrom(csr.vtype, 3, 3)) {
+            case 0:
+                executeVectorOperation<UInt8>(instruction);
+            break;
+            case 1:
+                executeVectorOperation<UInt16>(instruction);
+            break;
+            case 2:
+                executeVectorOperation<UInt32>(instruction);
+            break;
+            case 3:
+                executeVectorOperation<UInt64>(instruction);
+            break;
+        }
+        csr.vstart = 0;
+    }
+
+    void executeOpcode63(const Instruction& instruction, UIntType pcNextValue) {
+        switch(instruction.funct[0]) {
+            case 0: // BEQ rs1,rs2,imm
+                if(readRegXU(instruction.reg[1]) == readRegXU(instruction.reg[2])) break;
+                pc = pcNextValue;
+            return;
+            case 1:// BNE rs1,rs2,imm
+                if(readRegXU(instruction.reg[1]) != readRegXU(instruction.reg[2])) break;
+                pc = pcNextValue;
+            return;
+            case 4:// BLT rs1,rs2,imm
+                if(readRegXI(instruction.reg[1]) < readRegXI(instruction.reg[2])) break;
+                pc = pcNextValue;
+            return;
+            case 5:// BGE rs1,rs2,imm
+                if(readRegXI(instruction.reg[1]) > readRegXI(instruction.reg[2])) break;
+                pc = pcNextValue;
+            return;
+            case 6:// BLTU rs1,rs2,imm
+                if(readRegXU(instruction.reg[1]) < readRegXU(instruction.reg[2])) break;
+                pc = pcNextValue;
+            return;
+            case 7:// BGEU rs1,rs2,imm
+                if(readRegXU(instruction.reg[1]) > readRegXU(instruction.reg[2])) break;
+                pc = pcNextValue;
+            return;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+        pc += instruction.imm;
+    }
+
+    void executeOpcode67(const Instruction& instruction, UIntType pcNextValue) {
+        // JALR rd,rs1,imm
+        pc = (readRegXU(instruction.reg[1])+instruction.imm)&~TrailingBitMask<UIntType>(1);
+        writeRegXU(instruction.reg[0], pcNextValue);
+        if(!highLevelRoutines.empty() && instruction.reg[0] && emulateHighLevelRoutine(pcNextValue))
+            return;
+        if(callStackProfiler)
+            callStackProfiler->jump(instruction.reg[0], instruction.reg[1], pc, pcNextValue);
+    }
+
+    void executeOpcode6F(const Instruction& instruction, UIntType pcNextValue) {
+        // JAL rd,imm
+        writeRegXU(instruction.reg[0], pcNextValue);
+        pc += instruction.imm;
+        if(!highLevelRoutines.empty() && instruction.reg[0] && emulateHighLevelRoutine(pcNextValue))
+            return;
+        if(callStackProfiler)
+            callStackProfiler->jump(instruction.reg[0], 0, pc, pcNextValue);
+    }
+
+    // High level emulation: Calls to recognised libc routines are performed
+    // on the host, directly on the Ram. It is off unless routines are added.
+    // Only the return value is written, as the caller saved registers are
+    // undefined after a call anyway. When a chunk of the memory is not Ram
+    // the guest routine runs instead. Faults trap at the entry of the
+    // routine, so that it runs again once the fault is resolved.
+
+    bool readCode(UIntType address, UInt8* code) {
+        UInt8* host = ram.getHostPointer(translate(FetchInstruction, address), 16);
+        if(!host || (address&4095) > 4096-16)
+            return false;
+        memcpy(code, host, 16);
+        return true;
+    }
+
+    bool addHighLevelRoutine(const std::string& name, UIntType address) {
+        static const std::map<std::string, HighLevelRoutine> names = {
+            { "memcpy", HighLevelMemcpy },
+            { "memset", HighLevelMemset },
+            { "strlen", HighLevelStrlen },
+            { "memcmp", HighLevelMemcmp }
+        };
+        auto iter = names.find(name);
+        if(iter == names.end())
+            return false;
+        HighLevelEntry entry;
+        entry.routine = iter->second;
+        try {
+            if(!readCode(address, entry.fingerprint))
+                return false;
+        } catch(Exception) {
+            return false;
+        }
+        highLevelRoutines[address] = entry;
+        return true;
+    }
+
+    void addHighLevelRoutines(const std::map<AddressType, std::string>& symbols) {
+        for(auto& symbol : symbols)
+            addHighLevelRoutine(symbol.second, symbol.first);
+    }
+
+    // Host pointer to guest memory, shortened to end in the same page
+    UInt8* getHostChunk(MemoryAccessType mat, UIntType address, AddressType& length) {
+        length = std::min<AddressType>(length, 4096-(address&4095));
+        AddressType physical = translate(mat, address);
+        translate(mat, address+length-1);
+        accessType = mat;
+        accessAddress = address;
+        UInt8* host = ram.getHostPointer(physical, length);
+        if(host && mat == StoreData)
+            ram.prepareWrite(physical, length);
+        return host;
+    }
+
+    bool emulateHighLevelRoutine(UIntType returnAddress) {
+        auto iter = highLevelRoutines.find(pc);
+        UInt8 code[16];
+        if(iter == highLevelRoutines.end() || !readCode(pc, code) ||
+           memcmp(code, iter->second.fingerprint, sizeof(code)) != 0)
+            return false;
+        UIntType destination = readRegXU(10), source = readRegXU(11), count = readRegXU(12), result = destination;
+        AddressType length;
+        switch(iter->second.routine) {
+            case HighLevelMemcpy:
+                for(; count; count -= length, destination += length, source += length) {
+                    length = count;
+                    UInt8* from = getHostChunk(LoadData, source, length);
+                    UInt8* to = getHostChunk(StoreData, destination, length);
+                    if(!from || !to)
+                        return false;
+                    memmove(to, from, length);
+                }
+            break;
+            case HighLevelMemset:
+                for(; count; count -= length, destination += length) {
+                    length = count;
+                    UInt8* to = getHostChunk(StoreData, destination, length);
+                    if(!to)
+                        return false;
+                    memset(to, static_cast<UInt8>(source), length);
+                }
+            break;
+            case HighLevelStrlen:
+                for(result = 0; ; result += length) {
+                    length = 4096;
+                    UInt8* from = getHostChunk(LoadData, destination+result, length);
+                    if(!from)
+                        return false;
+                    UInt8* end = static_cast<UInt8*>(memchr(from, 0, length));
+                    if(end) {
+                        result += end-from;
+                        break;
+                    }
+                }
+            break;
+            case HighLevelMemcmp:
+                for(result = 0; count; count -= length, destination += length, source += length) {
+                    length = count;
+                    UInt8* left = getHostChunk(LoadData, destination, length);
+                    UInt8* right = getHostChunk(LoadData, source, length);
+                    if(!left || !right)
+                        return false;
+                    if(memcmp(left, right, length) != 0) {
+                        AddressType i = 0;
+                        while(left[i] == right[i])
+                            ++i;
+                        result = static_cast<IntType>(left[i])-static_cast<IntType>(right[i]);
+                        break;
+                    }
+                }
+            break;
+        }
+        writeRegXU(10, result);
+        pc = returnAddress;
+        return true;
     }
 
     void executeOpcode73(const Instruction& instruction, UIntType pcNextValue) {
@@ -1597,6 +2848,13 @@ class Cpu {
                 switch(static_cast<UInt32>(instruction.imm)) {
                     case 0x0000: // ECALL
                         ++csr.instret;
+                        if(linuxUser && cpm == User) {
+                            UInt64 arguments[6];
+                            for(UInt8 i = 0; i < 6; ++i)
+                                arguments[i] = readRegXU(10+i);
+                            writeRegXU(10, static_cast<IntType>(linuxUser->syscall(readRegXU(17), arguments)));
+                            break;
+                        }
                         throw Exception((Exception::Code)(Exception::Code::EnvironmentCallFromU+cpm));
                     case 0x0001: // EBREAK
                         ++csr.instret;
@@ -1618,12 +2876,18 @@ class Cpu {
                         setBitsIn(csr.status, static_cast<UIntType>((csr.status&TrailingBitMask<UIntType>(12))>>3), 0, 12);
                         setBitsIn(csr.status, static_cast<UIntType>((EXT&U_UserMode)?1:7), (getLevels()-1)*3, 3);
                         ++csr.instret;
+                        if(timeline)
+                            recordEvent(Timeline::ModeSwitch, cpm, pc);
                     } return;
                     case 0x0101: // SFENCE.VM rs1
-                        // TODO : Flush caches
+                        if(instruction.reg[1])
+                            translationCache.flushPage(readRegXU(instruction.reg[1])>>12);
+                        else
+                            translationCache.flush();
                     break;
                     case 0x0102: // WFI
-                    return;
+                        waitForInterrupt();
+                    break;
                     case 0x0205: // HRTS
                         if(cpm != Hypervisor)
                             throw Exception(Exception::Code::IllegalInstruction);
@@ -1634,6 +2898,8 @@ class Cpu {
                         csr.sbadaddr = csr.hbadaddr;
                         pc = csr.stvec;
                         ++csr.instret;
+                        if(timeline)
+                            recordEvent(Timeline::ModeSwitch, cpm, pc);
                     return;
                     case 0x0305: // MRTS
                         if(cpm != Machine)
@@ -1645,6 +2911,8 @@ class Cpu {
                         csr.sbadaddr = csr.mbadaddr;
                         pc = csr.stvec;
                         ++csr.instret;
+                        if(timeline)
+                            recordEvent(Timeline::ModeSwitch, cpm, pc);
                     return;
                     case 0x0306: // MRTH
                         if(cpm != Machine)
@@ -1655,6 +2923,8 @@ class Cpu {
                         csr.hbadaddr = csr.mbadaddr;
                         pc = csr.htvec;
                         ++csr.instret;
+                        if(timeline)
+                            recordEvent(Timeline::ModeSwitch, cpm, pc);
                     return;
                     default:
                         throw Exception(Exception::Code::IllegalInstruction);
@@ -1710,36 +2980,414 @@ class Cpu {
         pc = pcNextValue;
     }
 
-    #define updateTimerOfMode(name, index) \
-    csr.name##time += averageElapsedTime; \
-    if(csr.name##time >= csr.name##timecmp) \
-        setBitsIn(csr.interruptPending, 1ULL, index, 1);
+    template<typename type>
+    void executePackedOperation(const Instruction& instruction, PackedOperation op) {
+        bool saturated = false;
+        writeRegXU(instruction.reg[0], packedOperation<type>(op, readRegXU(instruction.reg[1]), readRegXU(instruction.reg[2]), saturated));
+        if(saturated)
+            csr.vxsat = 1;
+    }
 
-    bool checkForInterrupt(PrivilegeMode cpm, PrivilegeMode mode, UInt8& delegationBit) {
-        if(mode < cpm) return false;
+    void executeOpcode77(const Instruction& instruction) {
+        if(!(EXT&P_PackedSIMD))
+            throw Exception(Exception::Code::IllegalInstruction);
+        PackedOperation op;
+        UInt8 funct = instruction.funct[0];
+        if(instruction.funct[1] == 0)
+            funct &= ~4;
+        else if(instruction.funct[1] != 2 || XLEN < 64 || funct >= 0x40)
+            throw Exception(Exception::Code::IllegalInstruction);
+        switch(funct) {
+            case 0x00: // RADD8/16/32 rd,rs1,rs2
+                op = PackedHalvingAdd;
+            break;
+            case 0x01: // RSUB8/16/32 rd,rs1,rs2
+                op = PackedHalvingSub;
+            break;
+            case 0x08: // KADD8/16/32 rd,rs1,rs2
+                op = PackedSaturatingAdd;
+            break;
+            case 0x09: // KSUB8/16/32 rd,rs1,rs2
+                op = PackedSaturatingSub;
+            break;
+            case 0x10: // URADD8/16/32 rd,rs1,rs2
+                op = PackedHalvingAddU;
+            break;
+            case 0x11: // URSUB8/16/32 rd,rs1,rs2
+                op = PackedHalvingSubU;
+            break;
+            case 0x18: // UKADD8/16/32 rd,rs1,rs2
+                op = PackedSaturatingAddU;
+            break;
+            case 0x19: // UKSUB8/16/32 rd,rs1,rs2
+                op = PackedSaturatingSubU;
+            break;
+            case 0x20: // ADD8/16/32 rd,rs1,rs2
+                op = PackedAdd;
+            break;
+            case 0x21: // SUB8/16/32 rd,rs1,rs2
+                op = PackedSub;
+            break;
+            case 0x40: // SMIN8/16 rd,rs1,rs2
+                op = PackedMin;
+            break;
+            case 0x41: // SMAX8/16 rd,rs1,rs2
+                op = PackedMax;
+            break;
+            case 0x43: // KHM8/16 rd,rs1,rs2
+                op = PackedSaturatingMulQ;
+            break;
+            case 0x48: // UMIN8/16 rd,rs1,rs2
+                op = PackedMinU;
+            break;
+            case 0x49: // UMAX8/16 rd,rs1,rs2
+                op = PackedMaxU;
+            break;
+            default:
+                throw Exception(Exception::Code::IllegalInstruction);
+        }
+        if(instruction.funct[1] == 2)
+            executePackedOperation<UInt32>(instruction, op);
+        else if(instruction.funct[0]&4)
+            executePackedOperation<UInt8>(instruction, op);
+        else
+            executePackedOperation<UInt16>(instruction, op);
+    }
 
-        for(UInt8 cause = 0; cause < 2; ++cause) {
-            delegationBit = cause*4+mode;
-            if(!getBitsFrom(csr.interruptPending, delegationBit, 1) ||
-               !getBitsFrom(csr.interruptEnabled, delegationBit, 1))
-                return false;
+    UInt8 fetchInstruction(UIntType address, UIntType mappedAddress, Instruction& instruction) {
+        if(EXT&C_CompressedInstructions) {
+            UInt16 rawInstruction[2];
+            memoryAccess<UInt16, false, true>(FetchInstruction, mappedAddress, &rawInstruction[0]);
+            if((rawInstruction[0]&3) != 3) {
+                instruction.decode16(rawInstruction[0], XLEN);
+                return 2;
+            }
+            // The upper half of a 32 bit instruction can lie on the next page
+            mappedAddress = (getBitsFrom(address, 0, 12) == 0xFFE) ? translate(FetchInstruction, address+2) : mappedAddress+2;
+            memoryAccess<UInt16, false, true>(FetchInstruction, mappedAddress, &rawInstruction[1]);
+            instruction.decode32(rawInstruction[0]|(static_cast<UInt32>(rawInstruction[1])<<16));
+        }else{
+            UInt32 rawInstruction;
+            memoryAccess<UInt32, false, true>(FetchInstruction, mappedAddress, &rawInstruction);
+            instruction.decode32(rawInstruction);
+        }
+        return 4;
+    }
+
+    // Calls which are performed by high level emulation return to the next
+    // instruction immediately and are not seen by the front end
+    void predictControlFlow(const Instruction& instruction, UIntType address, UIntType pcNextValue) {
+        bool conditional = instruction.opcode == 0x63;
+        if(!conditional && pc == pcNextValue)
+            return;
+        UInt32 penalty = branchPredictor->observe(address, conditional, instruction.reg[0],
+                                                  (instruction.opcode == 0x67) ? instruction.reg[1] : 0, pc, pcNextValue);
+        if(branchPredictor->chargeCycles) {
+            csr.cycle += penalty;
+            if(pipeline)
+                pipeline->stall(Pipeline::BranchMispredict, penalty);
+        }
+    }
+
+    bool executeInstruction(const Instruction& instruction, UIntType pcNextValue) {
+        switch(instruction.opcode) {
+            case 0x03:
+                executeOpcode03(instruction);
+            break;
+            case 0x07:
+                executeOpcode07(instruction);
+            break;
+            case 0x0F:
+                executeOpcode0F(instruction);
+            break;
+            case 0x13:
+                executeOpcode13(instruction);
+            break;
+            case 0x17:
+                executeOpcode17(instruction);
+            break;
+            case 0x1B:
+                executeOpcode1B(instruction);
+            break;
+            case 0x23:
+                executeOpcode23(instruction);
+            break;
+            case 0x27:
+                executeOpcode27(instruction);
+            break;
+            case 0x2F:
+                executeOpcode2F(instruction);
+            break;
+            case 0x33:
+                executeOpcode33(instruction);
+            break;
+            case 0x37:
+                executeOpcode37(instruction);
+            break;
+            case 0x3B:
+                executeOpcode3B(instruction);
+            break;
+            case 0x43:
+                executeOpcode43(instruction);
+            break;
+            case 0x47:
+                executeOpcode47(instruction);
+            break;
+            case 0x4B:
+                executeOpcode4B(instruction);
+            break;
+            case 0x4F:
+                executeOpcode4F(instruction);
+            break;
+            case 0x53:
+                executeOpcode53(instruction);
+            break;
+            case 0x57:
+                executeOpcode57(instruction);
+            break;
+            case 0x5B:
+                executeOpcode5B(instruction);
+            break;
+            case 0x63: {
+                UIntType address = pc;
+                executeOpcode63(instruction, pcNextValue);
+                if(branchPredictor)
+                    predictControlFlow(instruction, address, pcNextValue);
+            } return false;
+            case 0x67: {
+                UIntType address = pc;
+                executeOpcode67(instruction, pcNextValue);
+                if(branchPredictor)
+                    predictControlFlow(instruction, address, pcNextValue);
+            } return false;
+            case 0x6F: {
+                UIntType address = pc;
+                executeOpcode6F(instruction, pcNextValue);
+                if(branchPredictor)
+                    predictControlFlow(instruction, address, pcNextValue);
+            } return false;
+            case 0x73:
+                executeOpcode73(instruction, pcNextValue);
+            return false;
+            case 0x77:
+                executeOpcode77(instruction);
+            break;
+            case 0x7B:
+                executeOpcode7B(instruction);
+            break;
         }
+        return true;
+    }
 
-        if(mode == cpm && !getBitsFrom(csr.status, 0, 1))
+    // Macro-op fusion: common compiler idioms of two instructions are executed
+    // in one step, skipping the fetch, decode and dispatch of the second half.
+    // Both halves retire, so the architectural state is the same as without fusion.
+
+    bool isFusionCandidate(const Instruction& instruction) {
+        if(instruction.reg[0] == 0)
             return false;
+        switch(instruction.opcode) {
+            case 0x13: // SLLI, SLTI, SLTIU
+                return instruction.funct[0] >= 1 && instruction.funct[0] <= 3;
+            case 0x17: // AUIPC
+            case 0x37: // LUI
+                return true;
+            case 0x33: // SLT, SLTU
+                return instruction.funct[0] == 0 && (instruction.funct[1] == 2 || instruction.funct[1] == 3);
+            default:
+                return false;
+        }
+    }
 
-        delegationBit += 16;
+    UInt8 fetchFusionPartner(UIntType address, UIntType mappedAddress, Instruction& instruction) {
+        // Only reuse the translation of the first half inside the same page
+        UInt16 offset = getBitsFrom(address, 0, 12);
+        if(offset < 4 || offset > 0xFFC)
+            return 0;
+        try {
+            UInt8 vm = getBitsFrom(csr.status, 17, 5);
+            if(vm == 1 || vm == 2) // Mbb and Mbbid check bounds per address
+                mappedAddress = translate(FetchInstruction, address);
+            return fetchInstruction(address, mappedAddress, instruction);
+        } catch(Exception e) {
+            return 0;
+        }
+    }
+
+    void retireFusedFirstHalf(UInt8 index, UIntType value, UIntType pcNextValue) {
+        writeRegXU(index, value);
+        pc = pcNextValue;
+        ++csr.instret;
+        ++csr.cycle;
+    }
+
+    bool executeFused(const Instruction& first, const Instruction& second, UIntType secondPC, UIntType pcNextValue) {
+        UInt8 rd = first.reg[0];
+        if(second.reg[1] != rd)
+            return false;
+        UIntType value;
+        switch(first.opcode) {
+            case 0x37: // LUI rd,imm
+                if(second.reg[0] != rd || second.funct[0] != 0)
+                    return false;
+                value = static_cast<UIntType>(first.imm)+second.imm;
+                if(second.opcode == 0x13) // + ADDI rd,rd,imm
+                    break;
+                if(second.opcode == 0x1B && XLEN >= 64) { // + ADDIW rd,rd,imm
+                    value = static_cast<Int32>(value);
+                    break;
+                }
+            return false;
+            case 0x17: // AUIPC rd,imm
+                value = pc+first.imm;
+                switch(second.opcode) {
+                    case 0x03: // + L* rd,imm(rd)
+                        // The load can trap, so the AUIPC has to retire first
+                        retireFusedFirstHalf(rd, value, secondPC);
+                        executeOpcode03(second);
+                        pc = pcNextValue;
+                        ++csr.instret;
+                    return true;
+                    case 0x13: // + ADDI rd,rd,imm
+                        if(second.reg[0] != rd || second.funct[0] != 0)
+                            return false;
+                        value += second.imm;
+                    break;
+                    case 0x67: // + JALR rd,rd,imm
+                        retireFusedFirstHalf(rd, value, secondPC);
+                        writeRegXU(second.reg[0], pcNextValue);
+                        pc = (value+second.imm)&~TrailingBitMask<UIntType>(1);
+                        if(!highLevelRoutines.empty() && second.reg[0] && emulateHighLevelRoutine(pcNextValue))
+                            return true;
+                        if(callStackProfiler)
+                            callStackProfiler->jump(second.reg[0], second.reg[1], pc, pcNextValue);
+                        if(branchPredictor)
+                            predictControlFlow(second, secondPC, pcNextValue);
+                    return true;
+                    default:
+                        return false;
+                }
+            break;
+            case 0x13:
+                if(first.funct[0] == 1) { // SLLI rd,rs1,shamt + SRLI rd,rd,shamt
+                    if(second.opcode != 0x13 || second.funct[0] != 5 || second.reg[0] != rd ||
+                       first.imm != second.imm || first.imm >= (1<<getShiftBits()))
+                        return false;
+                    value = readRegXU(first.reg[1])<<first.imm;
+                    value >>= first.imm;
+                    break;
+                }
+                value = (first.funct[0] == 2)
+                    ? (readRegXI(first.reg[1]) < first.imm) // SLTI rd,rs1,imm
+                    : (readRegXU(first.reg[1]) < static_cast<UIntType>(static_cast<IntType>(first.imm))); // SLTIU rd,rs1,imm
+            goto compareAndBranch;
+            case 0x33:
+                value = (first.funct[1] == 2)
+                    ? (readRegXI(first.reg[1]) < readRegXI(first.reg[2])) // SLT rd,rs1,rs2
+                    : (readRegXU(first.reg[1]) < readRegXU(first.reg[2])); // SLTU rd,rs1,rs2
+            compareAndBranch:
+                // + BEQ/BNE rd,x0,imm
+                if(second.opcode != 0x63 || second.reg[2] != 0 || second.funct[0] > 1)
+                    return false;
+                retireFusedFirstHalf(rd, value, secondPC);
+                pc = ((value != 0) == (second.funct[0] == 1)) ? secondPC+second.imm : pcNextValue;
+                if(branchPredictor)
+                    predictControlFlow(second, secondPC, pcNextValue);
+            return true;
+            default:
+                return false;
+        }
+        writeRegXU(rd, value);
+        pc = pcNextValue;
+        csr.instret += 2;
+        ++csr.cycle;
         return true;
     }
 
+    #define updateTimerOfMode(name, index) \
+    csr.name##time += averageElapsedTime; \
+    if(csr.name##time >= csr.name##timecmp && !getBitsFrom(csr.interruptPending, index, 1)) { \
+        setBitsIn(csr.interruptPending, static_cast<UIntType>(1), index, 1); \
+        if(timeline) \
+            recordEvent(Timeline::TimerFired, getBitsFrom(csr.status, 1, 2), index-4); \
+    }
+
+    // Software pending bits and the lines driven by devices and other harts
+    UIntType getInterruptPending() {
+        return csr.interruptPending|static_cast<UIntType>(interruptLines.pending.load(std::memory_order_acquire));
+    }
+
+    bool checkForInterrupt(PrivilegeMode cpm, PrivilegeMode mode, UIntType pending, UInt8& cause) {
+        if(mode < cpm || (mode == cpm && !getBitsFrom(csr.status, 0, 1)))
+            return false;
+
+        // External before software before timer interrupts
+        const UInt8 priority[] = { 2, 0, 1 };
+        for(UInt8 i = 0; i < 3; ++i) {
+            cause = priority[i];
+            if(getBitsFrom(pending, cause*4+mode, 1))
+                return true;
+        }
+        return false;
+    }
+
+    #define getTimerDeadlineOfMode(name, index) \
+    if(getBitsFrom(csr.interruptEnabled, index, 1) && csr.name##timecmp > csr.name##time && \
+       csr.name##timecmp-csr.name##time < deadline-now) \
+        deadline = now+static_cast<UInt64>(csr.name##timecmp-csr.name##time);
+
+    // Parks the host thread until an enabled interrupt is pending, but at
+    // most until the next timer compare of a mode or for 100 ms. The guest
+    // times continue to advance by the time slept.
+    void waitForInterrupt() {
+        if(getInterruptPending()&csr.interruptEnabled)
+            return;
+        UInt64 now = InterruptLines::getHostTime(), deadline = now+100000000;
+        getTimerDeadlineOfMode(s, 5)
+        getTimerDeadlineOfMode(h, 6)
+        getTimerDeadlineOfMode(m, 7)
+        auto start = std::chrono::steady_clock::now();
+        interruptLines.wait(csr.interruptEnabled, deadline);
+        auto slept = std::chrono::steady_clock::now()-start;
+        UInt64 elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(slept).count();
+        csr.stime += elapsed;
+        csr.htime += elapsed;
+        csr.mtime += elapsed;
+        clockSync += slept;
+    }
+
+    // The mode after the event is taken from the status register
+    void recordEvent(Timeline::Kind kind, UInt8 from, UInt64 argument0 = 0, UInt64 argument1 = 0, UInt64 argument2 = 0) {
+        timeline->record(kind, from, getBitsFrom(csr.status, 1, 2), csr.instret, csr.mtime, argument0, argument1, argument2);
+    }
+
+    // Switches the detailed timing models on or off, depending on the phase of the sampler
+    void updateSampledModels() {
+        bool detailed = sampler->isDetailed();
+        cacheModel = (detailed) ? sampler->cacheModel : NULL;
+        branchPredictor = (detailed) ? sampler->branchPredictor : NULL;
+        pipeline = (detailed) ? sampler->pipeline : NULL;
+    }
+
+    void advanceSampler() {
+        sampler->advance(csr.cycle);
+        updateSampledModels();
+    }
+
     bool fetchAndExecute() {
         if(cyclesToClockSync == 0) {
-            auto now = std::chrono::system_clock::now();
+            auto now = std::chrono::steady_clock::now();
             auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now-clockSync).count();
             clockSync = now;
             averageElapsedTime = elapsed/(cyclesToClockSyncMax+1);
             cyclesToClockSync = cyclesToClockSyncMax;
             csr.mtime += elapsed;
+            if(static_cast<UInt64>(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count()) >=
+               interruptLines.timerDeadline.load(std::memory_order_relaxed)) {
+                if(timeline && !getBitsFrom(getInterruptPending(), 7, 1))
+                    recordEvent(Timeline::TimerFired, getBitsFrom(csr.status, 1, 2), Machine);
+                interruptLines.set(7, true);
+            }
         }else
             --cyclesToClockSync;
         updateTimerOfMode(s, 5)
@@ -1748,96 +3396,72 @@ class Cpu {
         ++csr.cycle;
 
         UInt8 cause, delegationBit;
-        UIntType badaddr = 0, pcNextValue = pc;
+        UIntType badaddr = 0, pcNextValue = pc, interrupt = 0, pending;
         PrivilegeMode cpm = static_cast<PrivilegeMode>(getBitsFrom(csr.status, 1, 2));
 
         //TODO : Non Maskable Interrupts
-        for(UInt8 mode = Supervisor; mode <= Machine; ++mode)
-            if(checkForInterrupt(cpm, static_cast<PrivilegeMode>(mode), delegationBit))
-                goto handleException;
+        pending = getInterruptPending()&csr.interruptEnabled;
+        if(pending)
+            for(UInt8 mode = Machine; mode >= Supervisor; --mode)
+                if(checkForInterrupt(cpm, static_cast<PrivilegeMode>(mode), pending, cause)) {
+                    delegationBit = cause*4+mode+16;
+                    interrupt = static_cast<UIntType>(1)<<(XLEN-1);
+                    goto handleException;
+                }
+
+        FastmemFault* fault;
+        fault = &FastmemView::getFault();
+        if(sigsetjmp(fault->recovery, 0)) {
+            // A memory access hit a guard region of the Ram or a FastmemView
+            badaddr = accessAddress;
+            delegationBit = cause = accessType+1;
+            goto handleException;
+        }
+        fault->armed = true;
 
         try {
             UIntType mappedPC = translate(FetchInstruction, pc);
             Instruction instruction;
-            bool compressed = false; // TODO : Waiting for next riscv-compressed-spec
-            if(compressed) {
-                UInt16 rawInstruction;
-                memoryAccess<UInt16, false, true>(FetchInstruction, mappedPC, &rawInstruction);
-                instruction.decode16(rawInstruction);
-                pcNextValue += 2;
-            }else{
-                UInt32 rawInstruction;
-                memoryAccess<UInt32, false, true>(FetchInstruction, mappedPC, &rawInstruction);
-                instruction.decode32(rawInstruction);
-                pcNextValue += 4;
+            pcNextValue += fetchInstruction(pc, mappedPC, instruction);
+            if(traceRecorder)
+                traceAccess(FetchInstruction, pcNextValue-pc, pc, mappedPC);
+            if(profiler)
+                profiler->count(pc);
+            if(callStackProfiler)
+                callStackProfiler->count(pc);
+            if(macroOpFusion && isFusionCandidate(instruction)) {
+                Instruction nextInstruction;
+                UInt8 length = fetchFusionPartner(pcNextValue, mappedPC+(pcNextValue-pc), nextInstruction);
+                if(length && executeFused(instruction, nextInstruction, pcNextValue, pcNextValue+length)) {
+                    if(traceRecorder)
+                        traceRecorder->record(TraceRecord::Fetch, length, pcNextValue, mappedPC+(pcNextValue-pc), pcNextValue);
+                    if(profiler)
+                        profiler->count(pcNextValue);
+                    if(callStackProfiler)
+                        callStackProfiler->count(pcNextValue);
+                    if(instructionMix) {
+                        instructionMix->count(instruction);
+                        instructionMix->count(nextInstruction, pc != pcNextValue+length);
+                    }
+                    if(pipeline)
+                        csr.cycle += pipeline->issue(instruction)+pipeline->issue(nextInstruction);
+                    if(sampler && (sampler->retire(pc, false) | sampler->retire(pc, pc != pcNextValue+length)))
+                        advanceSampler();
+                    fault->armed = false;
+                    return true;
+                }
             }
-            switch(instruction.opcode) {
-                case 0x03:
-                    executeOpcode03(instruction);
-                break;
-        		case 0x07:
-                    executeOpcode07(instruction);
-                break;
-        		case 0x0F:
-                    executeOpcode0F(instruction);
-                break;
-        		case 0x13:
-                    executeOpcode13(instruction);
-                break;
-                case 0x17:
-                    executeOpcode17(instruction);
-                break;
-        		case 0x1B:
-                    executeOpcode1B(instruction);
-                break;
-                case 0x23:
-                    executeOpcode23(instruction);
-                break;
-        		case 0x27:
-                    executeOpcode27(instruction);
-                break;
-                case 0x2F:
-                    executeOpcode2F(instruction);
-                break;
-        		case 0x33:
-                    executeOpcode33(instruction);
-                break;
-                case 0x37:
-                    executeOpcode37(instruction);
-                break;
-        		case 0x3B:
-                    executeOpcode3B(instruction);
-                break;
-                case 0x43:
-                    executeOpcode43(instruction);
-                break;
-        		case 0x47:
-                    executeOpcode47(instruction);
-                break;
-        		case 0x4B:
-                    executeOpcode4B(instruction);
-                break;
-        		case 0x4F:
-                    executeOpcode4F(instruction);
-                break;
-        		case 0x53:
-                    executeOpcode53(instruction);
-                break;
-                case 0x63:
-                    executeOpcode63(instruction, pcNextValue);
-                return true;
-        		case 0x67:
-                    executeOpcode67(instruction, pcNextValue);
-                return true;
-                case 0x6F:
-                    executeOpcode6F(instruction, pcNextValue);
-                return true;
-        		case 0x73:
-                    executeOpcode73(instruction, pcNextValue);
-                return true;
+            if(executeInstruction(instruction, pcNextValue)) {
+                pc = pcNextValue;
+                ++csr.instret;
             }
-            pc = pcNextValue;
-            ++csr.instret;
+            if(instructionMix)
+                instructionMix->count(instruction, pc != pcNextValue);
+            if(pipeline)
+                csr.cycle += pipeline->issue(instruction);
+            if(sampler && sampler->retire(pc, pc != pcNextValue))
+                advanceSampler();
+            fault->armed = false;
             return true;
         } catch(MemoryAccessException e) {
             badaddr = e.address;
@@ -1845,8 +3469,10 @@ class Cpu {
         } catch(Exception e) {
             delegationBit = cause = e.cause;
         }
+        fault->armed = false;
 
         handleException:
+        PrivilegeMode previousMode = cpm;
         pcNextValue = cpm*0x40;
         if(getBitsFrom(csr.mtdeleg, delegationBit, 1)) {
             if(EXT&H_HypervisorMode) {
@@ -1856,19 +3482,21 @@ class Cpu {
                     cpm = Machine;
             }else if(EXT&S_SupervisorMode)
                 cpm = (cpm <= Supervisor) ? Supervisor : Machine;
-        }
+        }else
+            cpm = Machine;
 
         pc &= ~TrailingBitMask<UIntType>((EXT&C_CompressedInstructions)?1:2);
+        UIntType epc = pc;
         switch(cpm) {
             case Supervisor:
                 csr.sbadaddr = badaddr;
-                csr.scause = cause;
+                csr.scause = interrupt|cause;
                 csr.sepc = pc;
                 pcNextValue += csr.stvec;
             break;
             case Hypervisor:
                 csr.hbadaddr = badaddr;
-                csr.hcause = cause;
+                csr.hcause = interrupt|cause;
                 csr.hepc = pc;
                 pcNextValue += csr.htvec;
             break;
@@ -1876,7 +3504,7 @@ class Cpu {
                 cpm = Machine;
             case Machine:
                 csr.mbadaddr = badaddr;
-                csr.mcause = cause;
+                csr.mcause = interrupt|cause;
                 csr.mepc = pc;
                 pcNextValue += csr.mtvec;
             break;
@@ -1885,10 +3513,8 @@ class Cpu {
         setBitsIn(csr.status, getBitsFrom(csr.status, 3, 12), 0, 12);
         setBitsIn(csr.status, static_cast<UIntType>(cpm<<1), 0, 3);
         setBitsIn(csr.status, static_cast<UIntType>(0), 16, 1);
-
-        // TODO : Debugging
-        printf("TRAPED!\n");
-
+        if(timeline)
+            recordEvent((interrupt) ? Timeline::Interrupt : Timeline::Trap, previousMode, interrupt|cause, epc, badaddr);
         return false;
     }
 };
@@ -1,18 +1,25 @@
 #ifndef CSR
 #define CSR
 
-#include "RAM.hpp"
+#include "LinuxUser.hpp"
 
 enum CSR {
     csr_fflags = 0x001,
     csr_frm = 0x002,
     csr_fcsr = 0x003,
+    csr_vstart = 0x008,
+    csr_vxsat = 0x009,
+    csr_vxrm = 0x00A,
+    csr_vcsr = 0x00F,
     csr_cycle = 0xC00,
     csr_time = 0xC01,
     csr_instret = 0xC02,
     csr_cycleh = 0xC80,
     csr_timeh = 0xC81,
     csr_instreth = 0xC82,
+    csr_vl = 0xC20,
+    csr_vtype = 0xC21,
+    csr_vlenb = 0xC22,
     csr_sstatus = 0x100,
     csr_stvec = 0x101,
     csr_sie = 0x104,
@@ -44,7 +51,8 @@ enum CSR {
     csr_hcause = 0x242,
     csr_hbadaddr = 0x243,
     //csr_hip = 0x244,
-    //csr_ = 0x28X, // To Be Determined (TBD)
+    csr_hptbr = 0x280,
+    csr_hvmid = 0x281,
     csr_stimew = 0xA01,
     csr_stimehw = 0xA81,
     csr_mcpuid = 0xF00,
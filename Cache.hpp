@@ -0,0 +1,257 @@
+#ifndef CACHE
+#define CACHE
+
+#include "Profiler.hpp"
+#include <unordered_map>
+
+// Timing model of a set associative, write back and write allocate cache.
+// Only the tags are simulated, the data always comes from the Ram. Misses
+// are passed on to the next level or cost the memory latency in the last.
+
+class Cache {
+    public:
+    enum ReplacementPolicy {
+        LeastRecentlyUsed,
+        FirstInFirstOut,
+        Random
+    };
+
+    struct Config {
+        AddressType size;
+        UInt32 associativity, lineSize, latency;
+        ReplacementPolicy policy;
+    };
+
+    struct Line {
+        AddressType block;
+        UInt64 stamp;
+        bool valid, dirty;
+    };
+
+    Config config;
+    std::vector<Line> lines;
+    UInt8 lineBits;
+    AddressType setMask;
+    UInt64 clock, random, hits, misses, writebacks;
+    Cache* next;
+    UInt32 memoryLatency;
+
+    Cache() :lineBits(0), setMask(0), next(NULL), memoryLatency(0) {
+        config = { 0, 0, 0, 0, LeastRecentlyUsed };
+        clear();
+    }
+
+    // Size, associativity and line size have to be powers of two
+    bool configure(const Config& _config) {
+        AddressType sets = (_config.associativity && _config.lineSize) ? _config.size/_config.associativity/_config.lineSize : 0;
+        if(sets == 0 || (sets&(sets-1)) || (_config.lineSize&(_config.lineSize-1)))
+            return false;
+        config = _config;
+        lineBits = __builtin_ctzll(config.lineSize);
+        setMask = sets-1;
+        lines.assign(sets*config.associativity, { 0, 0, false, false });
+        clear();
+        return true;
+    }
+
+    void clear() {
+        for(auto& line : lines)
+            line.valid = line.dirty = false;
+        clock = hits = misses = writebacks = 0;
+        random = 0x2545F4914F6CDD1DULL;
+    }
+
+    Line* selectVictim(Line* ways) {
+        for(UInt32 way = 0; way < config.associativity; ++way)
+            if(!ways[way].valid)
+                return &ways[way];
+        if(config.policy == Random) {
+            random ^= random<<13;
+            random ^= random>>7;
+            random ^= random<<17;
+            return &ways[random%config.associativity];
+        }
+        Line* victim = ways;
+        for(UInt32 way = 1; way < config.associativity; ++way)
+            if(ways[way].stamp < victim->stamp)
+                victim = &ways[way];
+        return victim;
+    }
+
+    // Returns the latency of the access in cycles
+    UInt32 access(AddressType address, bool store) {
+        AddressType block = address>>lineBits;
+        Line* ways = &lines[(block&setMask)*config.associativity];
+        ++clock;
+        for(UInt32 way = 0; way < config.associativity; ++way)
+            if(ways[way].valid && ways[way].block == block) {
+                ++hits;
+                if(config.policy == LeastRecentlyUsed)
+                    ways[way].stamp = clock;
+                ways[way].dirty |= store;
+                return config.latency;
+            }
+        ++misses;
+        Line* victim = selectVictim(ways);
+        if(victim->valid && victim->dirty) {
+            ++writebacks;
+            if(next)
+                next->access(victim->block<<lineBits, true);
+        }
+        *victim = { block, clock, true, store };
+        return config.latency+((next) ? next->access(address, false) : memoryLatency);
+    }
+
+    void writeReport(std::ostream& out, const char* name) {
+        char line[256];
+        UInt64 accesses = hits+misses;
+        snprintf(line, sizeof(line), "%-4s %8llu KiB %2u-way %3u B lines: %14llu accesses %6.2f%% misses %12llu writebacks",
+                 name, static_cast<unsigned long long>(config.size>>10), config.associativity, config.lineSize,
+                 static_cast<unsigned long long>(accesses), (accesses) ? misses*100.0/accesses : 0.0,
+                 static_cast<unsigned long long>(writebacks));
+        out << line << std::endl;
+    }
+};
+
+// Separate L1 caches for instructions and data in front of a unified L2.
+// An access which is served by the L1 cache costs no extra cycles, as the
+// Cpu already counts one cycle per instruction. Misses are also recorded
+// per instruction address, to be reported per guest function.
+
+class CacheModel {
+    public:
+    enum Level {
+        L1I,
+        L1D,
+        L2,
+        Levels
+    };
+
+    struct Counters {
+        UInt64 accesses[Levels], misses[Levels];
+    };
+
+    Cache caches[Levels];
+    bool chargeCycles;
+    UInt64 stallCycles;
+    std::unordered_map<AddressType, Counters> instructions;
+    AddressType lastPC;
+    Counters* lastCounters;
+
+    CacheModel() :chargeCycles(true), stallCycles(0), lastCounters(NULL) {
+        caches[L1I].configure({ 32<<10, 8, 64, 4, Cache::LeastRecentlyUsed });
+        caches[L1D].configure({ 32<<10, 8, 64, 4, Cache::LeastRecentlyUsed });
+        caches[L2].configure({ 1<<20, 16, 64, 14, Cache::LeastRecentlyUsed });
+        caches[L1I].next = caches[L1D].next = &caches[L2];
+        caches[L2].memoryLatency = 100;
+    }
+
+    // Format: level=size:associativity:lineSize:latency:policy, for example
+    // "l2=2M:16:64:14:lru", or "memory=latency"
+    bool configure(const char* text) {
+        static const std::map<std::string, Cache::ReplacementPolicy> policies = {
+            { "lru", Cache::LeastRecentlyUsed },
+            { "fifo", Cache::FirstInFirstOut },
+            { "random", Cache::Random }
+        };
+        static const std::map<std::string, Level> levels = {
+            { "l1i", L1I },
+            { "l1d", L1D },
+            { "l2", L2 }
+        };
+        char name[8], policy[8], unit = 0;
+        unsigned long long size;
+        unsigned int associativity, lineSize, latency;
+        if(sscanf(text, "memory=%u", &latency) == 1) {
+            caches[L2].memoryLatency = latency;
+            return true;
+        }
+        if(sscanf(text, "%7[^=]=%llu%c:%u:%u:%u:%7s", name, &size, &unit, &associativity, &lineSize, &latency, policy) != 7 &&
+           (unit = 0, sscanf(text, "%7[^=]=%llu:%u:%u:%u:%7s", name, &size, &associativity, &lineSize, &latency, policy) != 6))
+            return false;
+        if(unit == 'K' || unit == 'k')
+            size <<= 10;
+        else if(unit == 'M' || unit == 'm')
+            size <<= 20;
+        else if(unit != 0)
+            return false;
+        auto level = levels.find(name);
+        auto replacement = policies.find(policy);
+        if(level == levels.end() || replacement == policies.end())
+            return false;
+        return caches[level->second].configure({ size, associativity, lineSize, latency, replacement->second });
+    }
+
+    void clear() {
+        for(UInt8 level = 0; level < Levels; ++level)
+            caches[level].clear();
+        instructions.clear();
+        lastCounters = NULL;
+        stallCycles = 0;
+    }
+
+    // Returns the cycles the access stalls the Cpu, pc is the instruction
+    // which caused it
+    UInt32 access(bool fetch, bool store, AddressType address, AddressType length, AddressType pc) {
+        Cache& first = caches[(fetch) ? L1I : L1D];
+        UInt64 missesBefore[Levels], accessesBefore[Levels];
+        for(UInt8 level = 0; level < Levels; ++level) {
+            missesBefore[level] = caches[level].misses;
+            accessesBefore[level] = caches[level].hits+caches[level].misses;
+        }
+        UInt32 latency = 0;
+        AddressType lastBlock = (address+length-1)>>first.lineBits;
+        for(AddressType block = address>>first.lineBits; block <= lastBlock; ++block)
+            latency += first.access(block<<first.lineBits, store)-first.config.latency;
+        // References to the elements stay valid when the map grows
+        if(!lastCounters || lastPC != pc) {
+            lastPC = pc;
+            lastCounters = &instructions[pc];
+        }
+        for(UInt8 level = 0; level < Levels; ++level) {
+            lastCounters->misses[level] += caches[level].misses-missesBefore[level];
+            lastCounters->accesses[level] += caches[level].hits+caches[level].misses-accessesBefore[level];
+        }
+        stallCycles += latency;
+        return latency;
+    }
+
+    void writeReport(std::ostream& out, const std::map<AddressType, std::string>& symbols, size_t functionCount = 20) {
+        static const char* names[Levels] = { "L1I", "L1D", "L2" };
+        out << "Caches (" << stallCycles << " stall cycles)" << std::endl;
+        for(UInt8 level = 0; level < Levels; ++level)
+            caches[level].writeReport(out, names[level]);
+
+        std::map<std::string, Counters> functions;
+        for(auto& instruction : instructions) {
+            auto symbol = symbols.upper_bound(instruction.first);
+            std::string name = (symbol == symbols.begin()) ? "[unknown]" : (--symbol)->second;
+            Counters& counters = functions[name];
+            for(UInt8 level = 0; level < Levels; ++level) {
+                counters.accesses[level] += instruction.second.accesses[level];
+                counters.misses[level] += instruction.second.misses[level];
+            }
+        }
+        std::vector<std::pair<std::string, Counters>> rows(functions.begin(), functions.end());
+        auto getMisses = [](const Counters& counters) {
+            return counters.misses[L1I]+counters.misses[L1D]+counters.misses[L2];
+        };
+        std::sort(rows.begin(), rows.end(), [&](const std::pair<std::string, Counters>& a, const std::pair<std::string, Counters>& b) {
+            return getMisses(a.second) > getMisses(b.second);
+        });
+        char line[256];
+        out << std::endl << "Misses per function" << std::endl;
+        for(size_t i = 0; i < std::min(functionCount, rows.size()); ++i) {
+            Counters& counters = rows[i].second;
+            std::string columns;
+            for(UInt8 level = 0; level < Levels; ++level) {
+                snprintf(line, sizeof(line), "  %s %12llu %6.2f%%", names[level], static_cast<unsigned long long>(counters.misses[level]),
+                         (counters.accesses[level]) ? counters.misses[level]*100.0/counters.accesses[level] : 0.0);
+                columns += line;
+            }
+            out << columns << "  " << rows[i].first << std::endl;
+        }
+    }
+};
+
+#endif
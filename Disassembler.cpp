@@ -61,7 +61,7 @@ void printFloatRegister(Disassembler& self, UInt8 index) {
 void printRoundingMode(Disassembler& self, const Instruction& instruction) {
 	if(instruction.funct[1] <= 4) {
 		strcat(self.buffer, ".");
-		strcat(self.buffer, getDisassemblerEntry(disassembler_FloatRoundingModes, instruction.funct[0]));
+		strcat(self.buffer, getDisassemblerEntry(disassembler_FloatRoundingModes, instruction.funct[1]));
 	}
 }
 
@@ -108,6 +108,11 @@ void disassembleOpcode07(Disassembler& self, const Instruction& instruction) {
 }
 
 void disassembleOpcode0F(Disassembler& self, const Instruction& instruction) {
+	if(instruction.funct[0] == 2) {
+		strcpy(self.buffer, "LQ");
+		print_x_x_i(self, instruction);
+		return;
+	}
 	if(instruction.funct[0] > 1)
 		throw Exception(Exception::Code::IllegalInstruction);
 	strcpy(self.buffer, "FENCE");
@@ -192,29 +197,32 @@ void disassembleOpcode17(Disassembler& self, const Instruction& instruction, Add
 
 void disassembleOpcode1B(Disassembler& self, const Instruction& instruction) {
 	UInt32 imm = instruction.imm;
+	const char* suffix = (instruction.opcode == 0x5B) ? "D" : "W";
 	switch(instruction.funct[0]) {
 		case 0:
 		if(self.flags&Disassembler::FlagArithmeticPseudo && imm == 0) {
-			strcpy(self.buffer, "SEXT.W");
+			strcpy(self.buffer, "SEXT.");
+			strcat(self.buffer, suffix);
 			print_x_x(self, instruction);
 			return;
 		}
-		strcpy(self.buffer, "ADDIW");
+		strcpy(self.buffer, "ADDI");
 		break;
 		case 1:
-		strcpy(self.buffer, "SLLIW");
+		strcpy(self.buffer, "SLLI");
 		break;
 		case 5:
 		if((imm&(1ULL<<10)) == 0)
-			strcpy(self.buffer, "SRLIW");
+			strcpy(self.buffer, "SRLI");
 		else{
-			strcpy(self.buffer, "SRAIW");
+			strcpy(self.buffer, "SRAI");
 			imm &= TrailingBitMask<UInt32>(5);
 		}
 		break;
 		default:
 		throw Exception(Exception::Code::IllegalInstruction);
 	}
+	strcat(self.buffer, suffix);
 	print_x_x_i(self, instruction);
 }
 
@@ -340,7 +348,7 @@ void disassembleOpcode3B(Disassembler& self, const Instruction& instruction) {
 			default:
 			throw Exception(Exception::Code::IllegalInstruction);
 		}
-	strcat(self.buffer, "W");
+	strcat(self.buffer, (instruction.opcode == 0x7B) ? "D" : "W");
 	print_x_x_x(self, instruction);
 }
 
@@ -469,6 +477,28 @@ void disassembleOpcode53(Disassembler& self, const Instruction& instruction) {
 	printFloatRegister(self, instruction.reg[2]);
 }
 
+void disassembleOpcode57(Disassembler& self, const Instruction& instruction) {
+	if(instruction.funct[1] != 7)
+		throw Exception(Exception::Code::IllegalInstruction);
+	if(!(instruction.funct[0]&0x40)) {
+		strcpy(self.buffer, "VSETVLI");
+		print_x_x(self, instruction);
+		printSeperator(self);
+		printUInt32(self, ((instruction.funct[0]&TrailingBitMask<UInt8>(6))<<5)|instruction.reg[2]);
+	}else if((instruction.funct[0]&0x60) == 0x60) {
+		strcpy(self.buffer, "VSETIVLI");
+		printIntRegister(self, instruction.reg[0]);
+		printSeperator(self);
+		printUInt32(self, instruction.reg[1]);
+		printSeperator(self);
+		printUInt32(self, ((instruction.funct[0]&TrailingBitMask<UInt8>(5))<<5)|instruction.reg[2]);
+	}else if(instruction.funct[0] == 0x40) {
+		strcpy(self.buffer, "VSETVL");
+		print_x_x_x(self, instruction);
+	}else
+		throw Exception(Exception::Code::IllegalInstruction);
+}
+
 void disassembleOpcode63(Disassembler& self, const Instruction& instruction, AddressType address) {
 	strcpy(self.buffer, getDisassemblerEntry(disassembler_63, instruction.funct[0]));
 	print_x_x(self, instruction, 1);
@@ -496,6 +526,24 @@ void disassembleOpcode6F(Disassembler& self, const Instruction& instruction, Add
 	self.addJumpMark(address+instruction.imm);
 }
 
+void disassembleOpcode77(Disassembler& self, const Instruction& instruction) {
+	switch(instruction.funct[1]) {
+		case 0:
+		strcpy(self.buffer, getDisassemblerEntry(disassembler_77, instruction.funct[0]&~4));
+		strcat(self.buffer, (instruction.funct[0]&4) ? "8" : "16");
+		break;
+		case 2:
+		if(instruction.funct[0] >= 0x40)
+			throw Exception(Exception::Code::IllegalInstruction);
+		strcpy(self.buffer, getDisassemblerEntry(disassembler_77, instruction.funct[0]));
+		strcat(self.buffer, "32");
+		break;
+		default:
+		throw Exception(Exception::Code::IllegalInstruction);
+	}
+	print_x_x_x(self, instruction);
+}
+
 void disassembleOpcode73(Disassembler& self, const Instruction& instruction) {
 	if(instruction.funct[0] == 0) {
 		switch(instruction.imm) {
@@ -625,6 +673,7 @@ void Disassembler::addInstruction(AddressType address, const Instruction& instru
 		disassembleOpcode17(*this, instruction, address);
 		break;
 		case 0x1B:
+		case 0x5B:
 		disassembleOpcode1B(*this, instruction);
 		break;
 		case 0x23:
@@ -643,6 +692,7 @@ void Disassembler::addInstruction(AddressType address, const Instruction& instru
 		disassembleOpcode37(*this, instruction);
 		break;
 		case 0x3B:
+		case 0x7B:
 		disassembleOpcode3B(*this, instruction);
 		break;
 		case 0x43:
@@ -654,6 +704,9 @@ void Disassembler::addInstruction(AddressType address, const Instruction& instru
 		case 0x53:
 		disassembleOpcode53(*this, instruction);
 		break;
+		case 0x57:
+		disassembleOpcode57(*this, instruction);
+		break;
 		case 0x63:
 		disassembleOpcode63(*this, instruction, address);
 		break;
@@ -666,6 +719,9 @@ void Disassembler::addInstruction(AddressType address, const Instruction& instru
 		case 0x73:
 		disassembleOpcode73(*this, instruction);
 		break;
+		case 0x77:
+		disassembleOpcode77(*this, instruction);
+		break;
 	}
 	addToTextSection(address);
 }
@@ -674,15 +730,22 @@ void Disassembler::addFunction(const UInt8* base, const std::string& name, Addre
 	if(!base) return;
 
 	Instruction instruction;
-	for(AddressType i = 0; i < size; i += sizeof(UInt32)) {
-		UInt32 data = *reinterpret_cast<const UInt32*>(base+i);
+	for(AddressType i = 0; i < size; ) {
+		UInt32 data = *reinterpret_cast<const UInt16*>(base+i);
+		bool compressed = (data&3) != 3 || i+sizeof(UInt32) > size;
+		if(!compressed)
+			data |= *reinterpret_cast<const UInt16*>(base+i+2)<<16;
 		try {
-			instruction.decode32(data);
+			if(compressed)
+				instruction.decode16(data);
+			else
+				instruction.decode32(data);
 			addInstruction(address+i, instruction);
 		}catch(Exception e) {
-			sprintf(buffer, ".word 0x%08x", data);
+			sprintf(buffer, (compressed) ? ".half 0x%04x" : ".word 0x%08x", data);
 			addToTextSection(address+i);
 		}
+		i += (compressed) ? sizeof(UInt16) : sizeof(UInt32);
 	}
 }
 
@@ -813,6 +876,30 @@ bool Disassembler::readFromFile(const std::string& path) {
 	return true;
 }
 
+bool Disassembler::readSymbolsFromFile(const std::string& path) {
+	ELFIO::elfio reader;
+	if(!reader.load(path) || reader.get_encoding() != ELFDATA2LSB || reader.get_machine() != ELF_machine)
+		return false;
+
+	std::string name;
+	ELFIO::Elf64_Addr address;
+	ELFIO::Elf_Xword size;
+	UInt8 bind, type, other;
+	ELFIO::Elf_Half section_index;
+	for(unsigned int i = 0; i < reader.sections.size(); ++i) {
+		ELFIO::section* psec = reader.sections[i];
+		if(psec->get_type() != SHT_SYMTAB) continue;
+		const ELFIO::symbol_section_accessor symbolAccessor(reader, psec);
+		for(unsigned int j = 0; j < symbolAccessor.get_symbols_num(); ++j) {
+			symbolAccessor.get_symbol(j, name, address, size, bind, type, section_index, other);
+			if(type != STT_FUNC || size == 0 || name.size() == 0) continue;
+			symbols.insert(std::pair<AddressType, std::string>(address, name));
+		}
+	}
+
+	return true;
+}
+
 
 
 void Assembler::writeInSection(UInt8 index, UInt8 length, const void* data) {
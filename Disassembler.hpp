@@ -53,6 +53,7 @@ class Disassembler {
 	void addFunction(const UInt8* base, const std::string& name, AddressType address, AddressType size);
 	bool writeToFile(const std::string& path);
 	bool readFromFile(const std::string& path);
+	bool readSymbolsFromFile(const std::string& path);
 };
 
 class Assembler {
@@ -19,7 +19,8 @@ class Exception {
 		EnvironmentCallFromH = 10,
 		EnvironmentCallFromM = 11,
         SoftwareInterrupt = 0,
-        TimerInterrupt = 1
+        TimerInterrupt = 1,
+        ExternalInterrupt = 2
 	} cause;
     bool interrupt;
 
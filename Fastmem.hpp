@@ -0,0 +1,120 @@
+#ifndef FASTMEM
+#define FASTMEM
+
+#include "Disassembler.hpp"
+#include <csetjmp>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// A FastmemView is a reservation of host address space in which guest
+// memory is mirrored, so that guest accesses become plain host loads and
+// stores. Everything which is not mapped stays PROT_NONE and the resulting
+// host faults are turned back into guest access faults.
+
+class FastmemView;
+
+struct FastmemFault {
+    sigjmp_buf recovery;
+    bool armed;
+    FastmemView* view;
+    AddressType offset;
+};
+
+class FastmemView {
+    public:
+    UInt8* base;
+    AddressType size;
+
+    static FastmemView*& getRegistered(UInt8 index) {
+        static FastmemView* registered[8];
+        return registered[index];
+    }
+
+    static FastmemFault& getFault() {
+        static thread_local FastmemFault fault;
+        return fault;
+    }
+
+    static void signalHandler(int signal, siginfo_t* info, void*) {
+        FastmemFault& fault = getFault();
+        UInt8* address = static_cast<UInt8*>(info->si_addr);
+        for(UInt8 i = 0; i < 8 && fault.armed; ++i) {
+            FastmemView* view = getRegistered(i);
+            if(view && address >= view->base && address < view->base+view->size) {
+                fault.armed = false;
+                fault.view = view;
+                fault.offset = address-view->base;
+                siglongjmp(fault.recovery, 1);
+            }
+        }
+        // Not a guest access: fall back to the default action
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = SIG_DFL;
+        sigaction(signal, &action, NULL);
+    }
+
+    static void installSignalHandler() {
+        static bool installed = false;
+        if(installed) return;
+        installed = true;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = signalHandler;
+        action.sa_flags = SA_SIGINFO|SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, NULL);
+        sigaction(SIGBUS, &action, NULL);
+    }
+
+    FastmemView() :base(NULL), size(0) { }
+
+    ~FastmemView() {
+        release();
+    }
+
+    bool reserve(AddressType _size) {
+        release();
+        void* reservation = mmap(NULL, _size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if(reservation == MAP_FAILED)
+            return false;
+        for(UInt8 i = 0; i < 8; ++i)
+            if(!getRegistered(i)) {
+                getRegistered(i) = this;
+                base = static_cast<UInt8*>(reservation);
+                size = _size;
+                installSignalHandler();
+                return true;
+            }
+        munmap(reservation, _size);
+        return false;
+    }
+
+    void release() {
+        if(!base) return;
+        for(UInt8 i = 0; i < 8; ++i)
+            if(getRegistered(i) == this)
+                getRegistered(i) = NULL;
+        munmap(base, size);
+        base = NULL;
+        size = 0;
+    }
+
+    // Mirrors length bytes of the shared memory object at offset to the
+    // start of the view (or fresh memory without an object) and makes
+    // everything behind it inaccessible again
+    bool map(int fd, AddressType offset, AddressType length, int protection) {
+        length = std::min(length, size);
+        if(length > 0 &&
+           mmap(base, length, protection, MAP_FIXED|((fd < 0) ? MAP_PRIVATE|MAP_ANONYMOUS : MAP_SHARED), fd, offset) == MAP_FAILED)
+            return false;
+        if(length < size &&
+           mmap(base+length, size-length, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0) == MAP_FAILED)
+            return false;
+        return true;
+    }
+};
+
+#endif
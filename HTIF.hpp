@@ -0,0 +1,192 @@
+#ifndef HTIF
+#define HTIF
+
+#include "CLINT.hpp"
+#include <cerrno>
+
+// Host target interface: Every value the guest writes to mtohost is a
+// request, encoded as device (bits 56..63), command (bits 48..55) and
+// payload (bits 0..47). Device 0 proxies system calls to the host, device 1
+// is a console. The response is returned to the guest in mfromhost.
+//
+// The system calls are not sandboxed: A guest can open, create and
+// overwrite any host file the emulator has access to. So the Htif is only
+// attached to a Cpu (Cpu::htif) for trusted guests, mtohost is plain
+// storage otherwise.
+
+class Htif {
+    public:
+    const static size_t ConsoleBufferSize = 1<<16;
+    std::vector<int> files;
+    std::string console;
+    bool exited;
+    UInt64 exitCode;
+
+    Htif() :files({ 0, 1, 2 }), exited(false), exitCode(0) { }
+
+    ~Htif() {
+        flush();
+        for(size_t fd = 3; fd < files.size(); ++fd)
+            if(files[fd] >= 0)
+                close(files[fd]);
+    }
+
+    // Console output is collected and written to the host in large chunks
+    void flush() {
+        for(size_t done = 0; done < console.size(); ) {
+            ssize_t written = write(1, console.data()+done, console.size()-done);
+            if(written <= 0)
+                break;
+            done += written;
+        }
+        console.clear();
+    }
+
+    void output(const void* data, size_t length) {
+        console.append(static_cast<const char*>(data), length);
+        if(console.size() >= ConsoleBufferSize)
+            flush();
+    }
+
+    struct Snapshot {
+        std::vector<int> files;
+        bool exited;
+        UInt64 exitCode;
+    };
+
+    void takeSnapshot(Snapshot& snapshot) {
+        flush();
+        snapshot = { files, exited, exitCode };
+    }
+
+    // Files opened since the snapshot are closed again. Files closed since
+    // can not be reopened and stay closed.
+    void restoreSnapshot(const Snapshot& snapshot) {
+        flush();
+        std::vector<int> restored = snapshot.files;
+        for(size_t fd = 0; fd < restored.size(); ++fd)
+            if(fd >= files.size() || files[fd] != restored[fd])
+                restored[fd] = -1;
+        for(size_t fd = 3; fd < files.size(); ++fd)
+            if(files[fd] >= 0 && (fd >= restored.size() || restored[fd] != files[fd]))
+                close(files[fd]);
+        files = restored;
+        exited = snapshot.exited;
+        exitCode = snapshot.exitCode;
+    }
+
+    int getHostFile(UInt64 fd) {
+        return (fd < files.size()) ? files[fd] : -1;
+    }
+
+    Int64 addFile(int file) {
+        if(file < 0)
+            return -errno;
+        for(size_t fd = 0; fd < files.size(); ++fd)
+            if(files[fd] < 0) {
+                files[fd] = file;
+                return fd;
+            }
+        files.push_back(file);
+        return files.size()-1;
+    }
+
+    Int64 syscall(UInt64 number, UInt64 arguments[]) {
+        switch(number) {
+            case 56: // openat (only relative to the working directory)
+                if(static_cast<Int32>(arguments[0]) != AT_FDCWD)
+                    return -EBADF;
+                return syscall(1024, arguments+1);
+            case 57: { // close
+                int file = getHostFile(arguments[0]);
+                if(file < 0)
+                    return -EBADF;
+                files[arguments[0]] = -1;
+                return (file > 2 && close(file) != 0) ? -errno : 0;
+            }
+            case 62: { // lseek
+                int file = getHostFile(arguments[0]);
+                if(file < 0)
+                    return -EBADF;
+                off_t offset = lseek(file, arguments[1], arguments[2]);
+                return (offset < 0) ? -errno : offset;
+            }
+            // Guest buffers are accessed in place, without copying them out of the Ram
+            case 63: { // read
+                int file = getHostFile(arguments[0]);
+                UInt8* buffer = ram.getHostPointer(arguments[1], arguments[2]);
+                if(file < 0)
+                    return -EBADF;
+                if(!buffer)
+                    return -EFAULT;
+                if(file == 0)
+                    flush();
+                ram.prepareWrite(arguments[1], arguments[2]);
+                ssize_t done = read(file, buffer, arguments[2]);
+                return (done < 0) ? -errno : done;
+            }
+            case 64: { // write
+                int file = getHostFile(arguments[0]);
+                UInt8* buffer = ram.getHostPointer(arguments[1], arguments[2]);
+                if(file < 0)
+                    return -EBADF;
+                if(!buffer)
+                    return -EFAULT;
+                if(file == 1) {
+                    output(buffer, arguments[2]);
+                    return arguments[2];
+                }
+                flush();
+                ssize_t done = write(file, buffer, arguments[2]);
+                return (done < 0) ? -errno : done;
+            }
+            case 93: // exit
+                exited = true;
+                exitCode = arguments[0];
+                flush();
+                return 0;
+            case 1024: { // open
+                UInt8* path = ram.getHostPointer(arguments[0], 1);
+                if(!path || !memchr(path, 0, (static_cast<AddressType>(1)<<ram.size)-arguments[0]))
+                    return -EFAULT;
+                return addFile(open(reinterpret_cast<char*>(path), arguments[1], arguments[2]));
+            }
+            default:
+                return -ENOSYS;
+        }
+    }
+
+    UInt64 handle(UInt64 tohost) {
+        UInt8 device = tohost>>56, command = tohost>>48;
+        UInt64 payload = getBitsFrom(tohost, 0, 48);
+        switch(device) {
+            case 0:
+                if(payload&1) {
+                    exited = true;
+                    exitCode = payload>>1;
+                    flush();
+                    return 0;
+                }else{
+                    // The payload points to the system call number followed by its arguments
+                    UInt8* request = ram.getHostPointer(payload, 8*sizeof(UInt64));
+                    if(!request)
+                        return 0;
+                    UInt64 arguments[8];
+                    memcpy(arguments, request, sizeof(arguments));
+                    Int64 result = syscall(arguments[0], arguments+1);
+                    ram.setBlock(payload, &result, sizeof(result));
+                }
+            break;
+            case 1:
+                if(command != 1)
+                    return 0;
+                output(&payload, 1);
+            break;
+            default:
+                return 0;
+        }
+        return (tohost&~TrailingBitMask<UInt64>(48))|1;
+    }
+};
+
+#endif
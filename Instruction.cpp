@@ -29,237 +29,244 @@ type moveBitsFromTo(type data, UInt8 bits, UInt8 from, UInt8 to) {
 
 
 
-void decodeTypeCR(Instruction& self, UInt16 data) {
-	self.reg[2] = readBitsFrom(data, 5);
-	self.reg[0] = self.reg[1] = readBitsFrom(data, 5);
-	self.funct[0] = readBitsFrom(data, 4);
-}
-
-void decodeTypeCI(Instruction& self, UInt16 data) {
-	self.imm = readBitsFrom(data, 5);
-	self.reg[0] = self.reg[1] = readBitsFrom(data, 5);
-	self.imm |= readBitsFrom(data, 1)<<5;
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCSS(Instruction& self, UInt16 data) {
-	self.reg[2] = readBitsFrom(data, 5);
-	self.imm = readBitsFrom(data, 6);
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCIW(Instruction& self, UInt16 data) {
-	self.reg[0] = readBitsFrom(data, 3)+8;
-	self.imm = readBitsFrom(data, 8);
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCL(Instruction& self, UInt16 data) {
-	self.reg[0] = readBitsFrom(data, 3)+8;
-	self.imm = readBitsFrom(data, 2);
-	self.reg[1] = readBitsFrom(data, 3)+8;
-	self.imm |= readBitsFrom(data, 3)<<2;
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCS(Instruction& self, UInt16 data) {
-	self.reg[2] = readBitsFrom(data, 3)+8;
-	self.imm = readBitsFrom(data, 2);
-	self.reg[1] = readBitsFrom(data, 3)+8;
-	self.imm |= readBitsFrom(data, 3)<<2;
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCB(Instruction& self, UInt16 data) {
-	self.imm = readBitsFrom(data, 5);
-	self.reg[1] = readBitsFrom(data, 3)+8;
-	self.imm |= readBitsFrom(data, 3)<<5;
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCJ(Instruction& self, UInt16 data) {
-	self.imm = readBitsFrom(data, 11);
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCDS(Instruction& self, UInt16 data) {
-	self.reg[2] = readBitsFrom(data, 3)+8;
-	self.funct[1] = readBitsFrom(data, 2);
-	self.reg[0] = readBitsFrom(data, 3)+8;
-	self.funct[0] = readBitsFrom(data, 6);
-}
-
-void decodeTypeCSD(Instruction& self, UInt16 data) {
-	self.reg[0] = readBitsFrom(data, 3)+8;
-	self.funct[1] = readBitsFrom(data, 2);
-	self.reg[1] = readBitsFrom(data, 3)+8;
-	self.funct[0] = readBitsFrom(data, 6);
-}
-
-void decodeTypeCRI(Instruction& self, UInt16 data) {
-	self.reg[0] = readBitsFrom(data, 3)+8;
-	self.funct[1] = readBitsFrom(data, 2);
-	self.reg[1] = readBitsFrom(data, 3)+8;
-	self.imm = readBitsFrom(data, 3);
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-void decodeTypeCR3(Instruction& self, UInt16 data) {
-	self.reg[2] = readBitsFrom(data, 3)+8;
-	self.funct[1] = readBitsFrom(data, 2);
-	self.reg[1] = readBitsFrom(data, 3)+8;
-	self.reg[0] = readBitsFrom(data, 3)+8;
-	self.funct[0] = readBitsFrom(data, 3);
-}
-
-UInt16 encodeTypeCR(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 4, self.funct[0]);
-	writeBitsTo(data, 5, self.reg[0]);
-	writeBitsTo(data, 5, self.reg[2]);
-	return data;
-}
-
-UInt16 encodeTypeCI(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeBitsTo(data, 1, self.imm>>5);
-	writeBitsTo(data, 5, self.reg[0]);
-	writeTruncatedBitsTo(data, 5, self.imm);
-	return data;
-}
-
-UInt16 encodeTypeCSS(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeBitsTo(data, 6, self.imm);
-	writeBitsTo(data, 5, self.reg[2]);
-	return data;
-}
-
-UInt16 encodeTypeCIW(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeBitsTo(data, 8, self.imm);
-	writeTruncatedBitsTo(data, 3, self.reg[0]);
-	return data;
-}
-
-UInt16 encodeTypeCL(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeBitsTo(data, 3, self.imm>>2);
-	writeTruncatedBitsTo(data, 3, self.reg[1]);
-	writeTruncatedBitsTo(data, 2, self.imm);
-	writeTruncatedBitsTo(data, 3, self.reg[0]);
-	return data;
-}
-
-UInt16 encodeTypeCS(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeBitsTo(data, 3, self.imm>>2);
-	writeTruncatedBitsTo(data, 3, self.reg[1]);
-	writeTruncatedBitsTo(data, 2, self.imm);
-	writeTruncatedBitsTo(data, 3, self.reg[2]);
-	return data;
-}
-
-UInt32 encodeTypeCB(const Instruction& self) {
-	UInt32 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeBitsTo(data, 3, self.imm>>5);
-	writeTruncatedBitsTo(data, 3, self.reg[1]);
-	writeTruncatedBitsTo(data, 5, self.imm);
-	return data;
-}
-
-UInt16 encodeTypeCJ(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeBitsTo(data, 11, self.imm);
-	return data;
-}
-
-UInt16 encodeTypeCDS(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 6, self.funct[0]);
-	writeTruncatedBitsTo(data, 3, self.reg[0]);
-	writeBitsTo(data, 2, self.funct[1]);
-	writeTruncatedBitsTo(data, 3, self.reg[2]);
-	return data;
-}
-
-UInt16 encodeTypeCSD(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 6, self.funct[0]);
-	writeTruncatedBitsTo(data, 3, self.reg[1]);
-	writeBitsTo(data, 2, self.funct[1]);
-	writeTruncatedBitsTo(data, 3, self.reg[0]);
-	return data;
+Int32 signExtend(UInt32 data, UInt8 bits) {
+	return static_cast<Int32>(data<<(32-bits))>>(32-bits);
+}
+
+void expandTypeR(Instruction& self, UInt8 opcode, UInt8 funct3, UInt8 funct7, UInt8 rd, UInt8 rs1, UInt8 rs2) {
+	self.opcode = opcode;
+	self.funct[1] = funct3;
+	self.funct[0] = funct7;
+	self.reg[0] = rd;
+	self.reg[1] = rs1;
+	self.reg[2] = rs2;
+}
+
+void expandTypeI(Instruction& self, UInt8 opcode, UInt8 funct3, UInt8 rd, UInt8 rs1, Int32 imm) {
+	self.opcode = opcode;
+	self.funct[0] = funct3;
+	self.reg[0] = rd;
+	self.reg[1] = rs1;
+	self.imm = imm;
+}
+
+void expandTypeS(Instruction& self, UInt8 opcode, UInt8 funct3, UInt8 rs1, UInt8 rs2, Int32 imm) {
+	self.opcode = opcode;
+	self.funct[0] = funct3;
+	self.reg[1] = rs1;
+	self.reg[2] = rs2;
+	self.imm = imm;
+}
+
+void expandQuadrant0(Instruction& self, UInt32 data, UInt8 xlen) {
+	UInt8 rd = moveBitsFromTo(data, 3, 2, 0)+8,
+	      rs1 = moveBitsFromTo(data, 3, 7, 0)+8;
+	UInt32 offsetW = moveBitsFromTo(data, 3, 10, 3)|moveBitsFromTo(data, 1, 6, 2)|moveBitsFromTo(data, 1, 5, 6),
+	       offsetD = moveBitsFromTo(data, 3, 10, 3)|moveBitsFromTo(data, 2, 5, 6),
+	       offsetQ = moveBitsFromTo(data, 2, 11, 4)|moveBitsFromTo(data, 1, 10, 8)|moveBitsFromTo(data, 2, 5, 6);
+	switch(data>>13) {
+		case 0: { // C.ADDI4SPN
+			UInt32 imm = moveBitsFromTo(data, 2, 11, 4)|moveBitsFromTo(data, 4, 7, 6)|
+			             moveBitsFromTo(data, 1, 6, 2)|moveBitsFromTo(data, 1, 5, 3);
+			if(imm == 0)
+				throw Exception(Exception::Code::IllegalInstruction);
+			expandTypeI(self, 0x13, 0, rd, 2, imm);
+		} break;
+		case 1: // C.FLD / C.LQ
+			if(xlen == 128)
+				expandTypeI(self, 0x0F, 2, rd, rs1, offsetQ);
+			else
+				expandTypeI(self, 0x07, 3, rd, rs1, offsetD);
+		break;
+		case 2: // C.LW
+			expandTypeI(self, 0x03, 2, rd, rs1, offsetW);
+		break;
+		case 3: // C.FLW / C.LD
+			if(xlen == 32)
+				expandTypeI(self, 0x07, 2, rd, rs1, offsetW);
+			else
+				expandTypeI(self, 0x03, 3, rd, rs1, offsetD);
+		break;
+		case 5: // C.FSD / C.SQ
+			if(xlen == 128)
+				expandTypeS(self, 0x23, 4, rs1, rd, offsetQ);
+			else
+				expandTypeS(self, 0x27, 3, rs1, rd, offsetD);
+		break;
+		case 6: // C.SW
+			expandTypeS(self, 0x23, 2, rs1, rd, offsetW);
+		break;
+		case 7: // C.FSW / C.SD
+			if(xlen == 32)
+				expandTypeS(self, 0x27, 2, rs1, rd, offsetW);
+			else
+				expandTypeS(self, 0x23, 3, rs1, rd, offsetD);
+		break;
+		default:
+			throw Exception(Exception::Code::IllegalInstruction);
+	}
 }
 
-UInt16 encodeTypeCRI(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeTruncatedBitsTo(data, 3, self.imm);
-	writeTruncatedBitsTo(data, 3, self.reg[1]);
-	writeBitsTo(data, 2, self.funct[1]);
-	writeTruncatedBitsTo(data, 3, self.reg[0]);
-	return data;
+void expandQuadrant1(Instruction& self, UInt32 data, UInt8 xlen) {
+	UInt8 rd = moveBitsFromTo(data, 5, 7, 0),
+	      rdShort = moveBitsFromTo(data, 3, 7, 0)+8,
+	      rs2Short = moveBitsFromTo(data, 3, 2, 0)+8;
+	Int32 imm = signExtend(moveBitsFromTo(data, 1, 12, 5)|moveBitsFromTo(data, 5, 2, 0), 6);
+	switch(data>>13) {
+		case 0: // C.ADDI / C.NOP
+			expandTypeI(self, 0x13, 0, rd, rd, imm);
+		break;
+		case 1: // C.JAL / C.ADDIW
+			if(xlen == 32)
+				goto jump;
+			if(rd == 0)
+				throw Exception(Exception::Code::IllegalInstruction);
+			expandTypeI(self, 0x1B, 0, rd, rd, imm);
+		break;
+		case 2: // C.LI
+			expandTypeI(self, 0x13, 0, rd, 0, imm);
+		break;
+		case 3:
+			if(rd == 2) { // C.ADDI16SP
+				imm = signExtend(moveBitsFromTo(data, 1, 12, 9)|moveBitsFromTo(data, 1, 6, 4)|moveBitsFromTo(data, 1, 5, 6)|
+				                 moveBitsFromTo(data, 2, 3, 7)|moveBitsFromTo(data, 1, 2, 5), 10);
+				if(imm == 0)
+					throw Exception(Exception::Code::IllegalInstruction);
+				expandTypeI(self, 0x13, 0, 2, 2, imm);
+			}else{ // C.LUI
+				if(imm == 0)
+					throw Exception(Exception::Code::IllegalInstruction);
+				self.opcode = 0x37;
+				self.reg[0] = rd;
+				self.imm = imm<<12;
+			}
+		break;
+		case 4: {
+			UInt32 shamt = moveBitsFromTo(data, 1, 12, 5)|moveBitsFromTo(data, 5, 2, 0);
+			if(shamt == 0 && xlen == 128)
+				shamt = 64;
+			switch(moveBitsFromTo(data, 2, 10, 0)) {
+				case 0: // C.SRLI
+					expandTypeI(self, 0x13, 5, rdShort, rdShort, shamt);
+				break;
+				case 1: // C.SRAI
+					expandTypeI(self, 0x13, 5, rdShort, rdShort, shamt|0x400);
+				break;
+				case 2: // C.ANDI
+					expandTypeI(self, 0x13, 7, rdShort, rdShort, imm);
+				break;
+				case 3: {
+					const UInt8 functs[] = { 0, 4, 6, 7 };
+					UInt8 funct = moveBitsFromTo(data, 2, 5, 0);
+					if(!getBitsFrom(data, 12, 1)) // C.SUB / C.XOR / C.OR / C.AND
+						expandTypeR(self, 0x33, functs[funct], (funct == 0) ? 0x20 : 0, rdShort, rdShort, rs2Short);
+					else if(funct < 2 && xlen > 32) // C.SUBW / C.ADDW
+						expandTypeR(self, 0x3B, 0, (funct == 0) ? 0x20 : 0, rdShort, rdShort, rs2Short);
+					else
+						throw Exception(Exception::Code::IllegalInstruction);
+				} break;
+			}
+		} break;
+		case 5: // C.J
+		jump:
+			self.opcode = 0x6F;
+			self.reg[0] = (data>>13 == 1) ? 1 : 0;
+			self.imm = signExtend(moveBitsFromTo(data, 1, 12, 11)|moveBitsFromTo(data, 1, 11, 4)|moveBitsFromTo(data, 2, 9, 8)|
+			                      moveBitsFromTo(data, 1, 8, 10)|moveBitsFromTo(data, 1, 7, 6)|moveBitsFromTo(data, 1, 6, 7)|
+			                      moveBitsFromTo(data, 3, 3, 1)|moveBitsFromTo(data, 1, 2, 5), 12);
+		break;
+		case 6: // C.BEQZ
+		case 7: // C.BNEZ
+			expandTypeS(self, 0x63, (data>>13)-6, rdShort, 0,
+			            signExtend(moveBitsFromTo(data, 1, 12, 8)|moveBitsFromTo(data, 2, 10, 3)|moveBitsFromTo(data, 2, 5, 6)|
+			                       moveBitsFromTo(data, 2, 3, 1)|moveBitsFromTo(data, 1, 2, 5), 9));
+		break;
+	}
 }
 
-UInt16 encodeTypeCR3(const Instruction& self) {
-	UInt16 data = 0;
-	writeBitsTo(data, 3, self.funct[0]);
-	writeTruncatedBitsTo(data, 3, self.reg[0]);
-	writeTruncatedBitsTo(data, 3, self.reg[1]);
-	writeBitsTo(data, 2, self.funct[1]);
-	writeTruncatedBitsTo(data, 3, self.reg[2]);
-	return data;
+void expandQuadrant2(Instruction& self, UInt32 data, UInt8 xlen) {
+	UInt8 rd = moveBitsFromTo(data, 5, 7, 0),
+	      rs2 = moveBitsFromTo(data, 5, 2, 0);
+	UInt32 offsetW = moveBitsFromTo(data, 1, 12, 5)|moveBitsFromTo(data, 3, 4, 2)|moveBitsFromTo(data, 2, 2, 6),
+	       offsetD = moveBitsFromTo(data, 1, 12, 5)|moveBitsFromTo(data, 2, 5, 3)|moveBitsFromTo(data, 3, 2, 6),
+	       offsetQ = moveBitsFromTo(data, 1, 12, 5)|moveBitsFromTo(data, 1, 6, 4)|moveBitsFromTo(data, 4, 2, 6),
+	       storeOffsetW = moveBitsFromTo(data, 4, 9, 2)|moveBitsFromTo(data, 2, 7, 6),
+	       storeOffsetD = moveBitsFromTo(data, 3, 10, 3)|moveBitsFromTo(data, 3, 7, 6),
+	       storeOffsetQ = moveBitsFromTo(data, 2, 11, 4)|moveBitsFromTo(data, 4, 7, 6);
+	switch(data>>13) {
+		case 0: { // C.SLLI
+			UInt32 shamt = moveBitsFromTo(data, 1, 12, 5)|rs2;
+			if(shamt == 0 && xlen == 128)
+				shamt = 64;
+			expandTypeI(self, 0x13, 1, rd, rd, shamt);
+		} break;
+		case 1: // C.FLDSP / C.LQSP
+			if(xlen == 128) {
+				if(rd == 0)
+					throw Exception(Exception::Code::IllegalInstruction);
+				expandTypeI(self, 0x0F, 2, rd, 2, offsetQ);
+			}else
+				expandTypeI(self, 0x07, 3, rd, 2, offsetD);
+		break;
+		case 2: // C.LWSP
+			if(rd == 0)
+				throw Exception(Exception::Code::IllegalInstruction);
+			expandTypeI(self, 0x03, 2, rd, 2, offsetW);
+		break;
+		case 3: // C.FLWSP / C.LDSP
+			if(xlen == 32)
+				expandTypeI(self, 0x07, 2, rd, 2, offsetW);
+			else{
+				if(rd == 0)
+					throw Exception(Exception::Code::IllegalInstruction);
+				expandTypeI(self, 0x03, 3, rd, 2, offsetD);
+			}
+		break;
+		case 4:
+			if(!getBitsFrom(data, 12, 1)) {
+				if(rs2 != 0) // C.MV
+					expandTypeR(self, 0x33, 0, 0, rd, 0, rs2);
+				else if(rd != 0) // C.JR
+					expandTypeI(self, 0x67, 0, 0, rd, 0);
+				else
+					throw Exception(Exception::Code::IllegalInstruction);
+			}else{
+				if(rs2 != 0) // C.ADD
+					expandTypeR(self, 0x33, 0, 0, rd, rd, rs2);
+				else if(rd != 0) // C.JALR
+					expandTypeI(self, 0x67, 0, 1, rd, 0);
+				else // C.EBREAK
+					expandTypeI(self, 0x73, 0, 0, 0, 1);
+			}
+		break;
+		case 5: // C.FSDSP / C.SQSP
+			if(xlen == 128)
+				expandTypeS(self, 0x23, 4, 2, rs2, storeOffsetQ);
+			else
+				expandTypeS(self, 0x27, 3, 2, rs2, storeOffsetD);
+		break;
+		case 6: // C.SWSP
+			expandTypeS(self, 0x23, 2, 2, rs2, storeOffsetW);
+		break;
+		case 7: // C.FSWSP / C.SDSP
+			if(xlen == 32)
+				expandTypeS(self, 0x27, 2, 2, rs2, storeOffsetW);
+			else
+				expandTypeS(self, 0x23, 3, 2, rs2, storeOffsetD);
+		break;
+	}
 }
 
-static std::function<void(Instruction&, UInt16)> decode16Type[] = {
-	decodeTypeCR,
-	decodeTypeCI,
-	decodeTypeCSS,
-	decodeTypeCIW,
-	decodeTypeCL,
-	decodeTypeCS,
-	decodeTypeCB,
-	decodeTypeCJ,
-	decodeTypeCDS,
-	decodeTypeCSD,
-	decodeTypeCRI,
-	decodeTypeCR3
+static std::function<void(Instruction&, UInt32, UInt8)> expand16Quadrant[] = {
+	expandQuadrant0,
+	expandQuadrant1,
+	expandQuadrant2
 };
 
-static std::function<UInt16(const Instruction&)> encode16Type[] = {
-	encodeTypeCR,
-	encodeTypeCI,
-	encodeTypeCSS,
-	encodeTypeCIW,
-	encodeTypeCL,
-	encodeTypeCS,
-	encodeTypeCB,
-	encodeTypeCJ,
-	encodeTypeCDS,
-	encodeTypeCSD,
-	encodeTypeCRI,
-	encodeTypeCR3
-};
-
-void Instruction::decode16(UInt16 data) {
-	// TODO: Waiting for next riscv-compressed-spec
-	opcode = readBitsFrom(data, 2);
-	decode16Type[getType()](*this, data);
-}
-
-UInt16 Instruction::encode16() const {
-	// TODO: Waiting for next riscv-compressed-spec
-	UInt32 data = encode16Type[getType()](*this);
-	writeBitsTo(data, 2, opcode);
-	return data;
+void Instruction::decode16(UInt16 data, UInt8 xlen) {
+	if(data == 0 || (data&3) == 3)
+		throw Exception(Exception::Code::IllegalInstruction);
+	expand16Quadrant[data&3](*this, data, xlen);
 }
 
 
@@ -358,7 +365,7 @@ UInt32 encodeTypeS(const Instruction& self) {
 
 UInt32 encodeTypeSB(const Instruction& self) {
 	UInt32 data = 0, imm = self.imm;
-	imm |= imm>>11;
+	imm = (imm&~TrailingBitMask<UInt32>(1))|((imm>>11)&1);
 	writeTruncatedBitsTo(data, 7, imm>>5);
 	writeBitsTo(data, 5, self.reg[2]);
 	writeBitsTo(data, 5, self.reg[1]);
@@ -419,15 +426,13 @@ UInt32 Instruction::encode32() const {
 
 Instruction::Type Instruction::getType() const {
 	switch(opcode) {
-		/*case 0x00:
-		case 0x01:
-		case 0x02:
-		// TODO: Waiting for next riscv-compressed-spec
-		return ;*/
 		case 0x2F:
 		case 0x33:
 		case 0x3B:
 		case 0x53:
+		case 0x57:
+		case 0x77:
+		case 0x7B:
 		return R;
 		case 0x43:
 		case 0x47:
@@ -439,6 +444,7 @@ Instruction::Type Instruction::getType() const {
 		case 0x0F:
 		case 0x13:
 		case 0x1B:
+		case 0x5B:
 		case 0x67:
 		case 0x73:
 		return I;
@@ -9,13 +9,10 @@ class Instruction {
 	Int32 imm;
 
 	enum Type {
-		R, R4, I, S, SB, U, UJ,
-		CR, CI, CSS, CIW, CL, CS, CB, CJ,
-		CDS, CSD, CRI, CR3
+		R, R4, I, S, SB, U, UJ
 	};
 
-	void decode16(UInt16 data);
-	UInt16 encode16() const;
+	void decode16(UInt16 data, UInt8 xlen = 64);
 	void decode32(UInt32 data);
 	UInt32 encode32() const;
 	Type getType() const;
@@ -0,0 +1,408 @@
+#ifndef LINUX_USER
+#define LINUX_USER
+
+#include "HTIF.hpp"
+#include <elfio/elfio.hpp>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <sys/ioctl.h>
+#include <climits>
+#include <ctime>
+
+// Runs statically linked Linux user binaries without a kernel: The ELF is
+// loaded to its virtual addresses in the Ram (Mbare translation), the Cpu
+// runs in user mode and every ECALL is serviced here by the matching host
+// system call. File descriptors are the ones of the host and guest buffers
+// are passed in place.
+//
+// Memory layout: program and heap (brk) from the bottom, the stack at the
+// top of the Ram and anonymous mappings growing down from below the stack.
+
+class LinuxUser {
+    public:
+    const static AddressType PageSize = 4096, StackSize = 8<<20;
+    UInt8 xlen;
+    std::string executable;
+    AddressType brkStart, brk, mmapBottom;
+    bool exited;
+    UInt64 exitCode, syscalls;
+
+    LinuxUser() :xlen(64), brkStart(0), brk(0), mmapBottom(0), exited(false), exitCode(0), syscalls(0) { }
+
+    static AddressType alignToPage(AddressType address) {
+        return (address+PageSize-1)&~(PageSize-1);
+    }
+
+    // The process state besides the hart and the Ram. The file descriptors
+    // are the ones of the host and are not part of it.
+    struct Snapshot {
+        AddressType brk, mmapBottom;
+        bool exited;
+        UInt64 exitCode, syscalls;
+    };
+
+    void takeSnapshot(Snapshot& snapshot) const {
+        snapshot = { brk, mmapBottom, exited, exitCode, syscalls };
+    }
+
+    void restoreSnapshot(const Snapshot& snapshot) {
+        brk = snapshot.brk;
+        mmapBottom = snapshot.mmapBottom;
+        exited = snapshot.exited;
+        exitCode = snapshot.exitCode;
+        syscalls = snapshot.syscalls;
+    }
+
+    void writeWord(UInt8* at, UInt64 value) {
+        memcpy(at, &value, xlen/8);
+    }
+
+    UInt64 readWord(const UInt8* at) {
+        UInt64 value = 0;
+        memcpy(&value, at, xlen/8);
+        return value;
+    }
+
+    // struct stat of the generic Linux ABI, which RISC-V uses
+    bool writeStat(AddressType address, const struct stat& host) {
+        UInt8* guest = ram.getHostPointer(address, 128);
+        if(!guest)
+            return false;
+        ram.prepareWrite(address, 128);
+        UInt64 words[16] = {
+            static_cast<UInt64>(host.st_dev), static_cast<UInt64>(host.st_ino),
+            static_cast<UInt64>(host.st_mode)|(static_cast<UInt64>(host.st_nlink)<<32),
+            static_cast<UInt64>(host.st_uid)|(static_cast<UInt64>(host.st_gid)<<32),
+            static_cast<UInt64>(host.st_rdev), 0, static_cast<UInt64>(host.st_size),
+            static_cast<UInt64>(static_cast<UInt32>(host.st_blksize)), static_cast<UInt64>(host.st_blocks),
+            static_cast<UInt64>(host.st_atim.tv_sec), static_cast<UInt64>(host.st_atim.tv_nsec),
+            static_cast<UInt64>(host.st_mtim.tv_sec), static_cast<UInt64>(host.st_mtim.tv_nsec),
+            static_cast<UInt64>(host.st_ctim.tv_sec), static_cast<UInt64>(host.st_ctim.tv_nsec), 0
+        };
+        memcpy(guest, words, sizeof(words));
+        return true;
+    }
+
+    // Guest strings have to be terminated inside of the Ram
+    const char* getString(AddressType address) {
+        UInt8* string = ram.getHostPointer(address, 1);
+        if(!string || !memchr(string, 0, (static_cast<AddressType>(1)<<ram.size)-address))
+            return NULL;
+        return reinterpret_cast<const char*>(string);
+    }
+
+    Int64 transferVector(bool store, int file, AddressType address, UInt64 count) {
+        UInt8* guest = ram.getHostPointer(address, count*xlen/4);
+        if(!guest || count > IOV_MAX)
+            return -EFAULT;
+        struct iovec vector[IOV_MAX];
+        for(UInt64 i = 0; i < count; ++i) {
+            UInt64 base = readWord(guest+i*xlen/4), length = readWord(guest+i*xlen/4+xlen/8);
+            vector[i].iov_base = ram.getHostPointer(base, length);
+            vector[i].iov_len = length;
+            if(!vector[i].iov_base)
+                return -EFAULT;
+            if(store)
+                ram.prepareWrite(base, length);
+        }
+        ssize_t done = (store) ? readv(file, vector, count) : writev(file, vector, count);
+        return (done < 0) ? -errno : done;
+    }
+
+    #define LinuxGuestBuffer(name, address, length, store) \
+        UInt8* name = ram.getHostPointer(address, length); \
+        if(!name) \
+            return -EFAULT; \
+        if(store) \
+            ram.prepareWrite(address, length);
+
+    #define LinuxGuestString(name, address) \
+        const char* name = getString(address); \
+        if(!name) \
+            return -EFAULT;
+
+    #define LinuxHostResult(expression) \
+        { \
+            auto result = expression; \
+            return (result < 0) ? -errno : result; \
+        }
+
+    Int64 syscall(UInt64 number, const UInt64 arguments[6]) {
+        ++syscalls;
+        // 32 bit guests pass AT_FDCWD and other negative values in a 32 bit register
+        Int64 fd = (xlen == 32) ? static_cast<Int32>(arguments[0]) : static_cast<Int64>(arguments[0]);
+        switch(number) {
+            case 17: { // getcwd
+                LinuxGuestBuffer(buffer, arguments[0], arguments[1], true)
+                if(!getcwd(reinterpret_cast<char*>(buffer), arguments[1]))
+                    return -errno;
+                return strlen(reinterpret_cast<char*>(buffer))+1;
+            }
+            case 23: // dup
+                LinuxHostResult(dup(fd))
+            case 25: // fcntl
+                switch(arguments[1]) {
+                    case F_DUPFD:
+                    case F_DUPFD_CLOEXEC:
+                    case F_GETFD:
+                    case F_SETFD:
+                    case F_GETFL:
+                    case F_SETFL:
+                        LinuxHostResult(fcntl(fd, arguments[1], static_cast<int>(arguments[2])))
+                    default:
+                        return -EINVAL;
+                }
+            case 29: // ioctl
+                switch(arguments[1]) {
+                    case TCGETS:
+                    case TIOCGWINSZ: {
+                        LinuxGuestBuffer(buffer, arguments[2], 60, true)
+                        LinuxHostResult(ioctl(fd, arguments[1], buffer))
+                    }
+                    default:
+                        return -ENOTTY;
+                }
+            case 48: { // faccessat
+                LinuxGuestString(path, arguments[1])
+                LinuxHostResult(faccessat(fd, path, arguments[2], 0))
+            }
+            case 56: { // openat
+                LinuxGuestString(path, arguments[1])
+                LinuxHostResult(openat(fd, path, arguments[2], arguments[3]))
+            }
+            case 57: // close
+                // Keep the standard streams of the host usable
+                if(fd >= 0 && fd <= 2)
+                    return 0;
+                LinuxHostResult(close(fd))
+            case 62: // lseek
+                LinuxHostResult(lseek(fd, arguments[1], arguments[2]))
+            case 63: { // read
+                LinuxGuestBuffer(buffer, arguments[1], arguments[2], true)
+                LinuxHostResult(read(fd, buffer, arguments[2]))
+            }
+            case 64: { // write
+                LinuxGuestBuffer(buffer, arguments[1], arguments[2], false)
+                LinuxHostResult(write(fd, buffer, arguments[2]))
+            }
+            case 65: // readv
+                return transferVector(true, fd, arguments[1], arguments[2]);
+            case 66: // writev
+                return transferVector(false, fd, arguments[1], arguments[2]);
+            case 78: { // readlinkat
+                LinuxGuestString(path, arguments[1])
+                LinuxGuestBuffer(buffer, arguments[2], arguments[3], true)
+                if(strcmp(path, "/proc/self/exe") == 0) {
+                    char resolved[PATH_MAX];
+                    if(!realpath(executable.c_str(), resolved))
+                        return -errno;
+                    size_t length = std::min(strlen(resolved), static_cast<size_t>(arguments[3]));
+                    memcpy(buffer, resolved, length);
+                    return length;
+                }
+                LinuxHostResult(readlinkat(fd, path, reinterpret_cast<char*>(buffer), arguments[3]))
+            }
+            case 79: // newfstatat
+            case 80: { // fstat
+                struct stat host;
+                if(number == 79) {
+                    LinuxGuestString(path, arguments[1])
+                    if(fstatat(fd, path, &host, arguments[3]) < 0)
+                        return -errno;
+                }else if(fstat(fd, &host) < 0)
+                    return -errno;
+                return writeStat(arguments[(number == 79) ? 2 : 1], host) ? 0 : -EFAULT;
+            }
+            case 93: // exit
+            case 94: // exit_group
+                exited = true;
+                exitCode = arguments[0]&0xFF;
+                return 0;
+            case 96: // set_tid_address
+                return getpid();
+            case 98: // futex, there is only one thread
+            case 99: // set_robust_list
+            case 132: // sigaltstack
+            case 134: // rt_sigaction
+            case 135: // rt_sigprocmask
+            case 226: // mprotect
+            case 233: // madvise
+                return 0;
+            case 113: // clock_gettime
+            case 403: { // clock_gettime64
+                struct timespec time;
+                if(clock_gettime(arguments[0], &time) < 0)
+                    return -errno;
+                UInt8 size = (number == 403) ? 8 : xlen/8;
+                LinuxGuestBuffer(buffer, arguments[1], size*2, true)
+                UInt64 seconds = time.tv_sec, nanoseconds = time.tv_nsec;
+                memcpy(buffer, &seconds, size);
+                memcpy(buffer+size, &nanoseconds, size);
+                return 0;
+            }
+            case 160: { // uname
+                LinuxGuestBuffer(buffer, arguments[0], 6*65, true)
+                struct utsname host;
+                uname(&host);
+                memset(buffer, 0, 6*65);
+                const char* fields[] = { "Linux", host.nodename, "5.15.0", host.version, (xlen == 32) ? "riscv32" : "riscv64" };
+                for(size_t i = 0; i < sizeof(fields)/sizeof(fields[0]); ++i)
+                    memcpy(buffer+i*65, fields[i], std::min<size_t>(strlen(fields[i]), 64));
+                return 0;
+            }
+            case 172: // getpid
+            case 178: // gettid
+                return getpid();
+            case 173: // getppid
+                return getppid();
+            case 174: // getuid
+                return getuid();
+            case 175: // geteuid
+                return geteuid();
+            case 176: // getgid
+                return getgid();
+            case 177: // getegid
+                return getegid();
+            case 214: // brk
+                if(arguments[0] >= brkStart && arguments[0] <= mmapBottom) {
+                    if(arguments[0] > brk) {
+                        ram.prepareWrite(brk, arguments[0]-brk);
+                        memset(ram.data+brk, 0, arguments[0]-brk);
+                    }
+                    brk = arguments[0];
+                }
+                return brk;
+            case 215: // munmap, the address space is not reused
+                return 0;
+            case 222: { // mmap
+                AddressType length = alignToPage(arguments[1]), address;
+                if(arguments[3]&MAP_FIXED) {
+                    address = arguments[0];
+                    if(address%PageSize || !ram.getHostPointer(address, length))
+                        return -ENOMEM;
+                    ram.prepareWrite(address, length);
+                    memset(ram.data+address, 0, length);
+                }else{
+                    // Fresh host memory reads as zero, so only fixed mappings need clearing
+                    if(length == 0 || length > mmapBottom-brk)
+                        return -ENOMEM;
+                    mmapBottom -= length;
+                    address = mmapBottom;
+                    ram.prepareWrite(address, length);
+                }
+                if(!(arguments[3]&MAP_ANONYMOUS) &&
+                   pread(static_cast<Int32>(arguments[4]), ram.data+address, arguments[1], arguments[5]) < 0)
+                    return -errno;
+                return address;
+            }
+            case 261: { // prlimit64
+                if(arguments[0] != 0 || arguments[2] != 0)
+                    return -EPERM;
+                if(arguments[3]) {
+                    LinuxGuestBuffer(buffer, arguments[3], 16, true)
+                    struct rlimit limit;
+                    if(getrlimit(arguments[1], &limit) < 0)
+                        return -errno;
+                    UInt64 values[2] = { limit.rlim_cur, limit.rlim_max };
+                    if(arguments[1] == RLIMIT_STACK)
+                        values[0] = values[1] = StackSize;
+                    memcpy(buffer, values, sizeof(values));
+                }
+                return 0;
+            }
+            case 278: { // getrandom
+                LinuxGuestBuffer(buffer, arguments[0], arguments[1], true)
+                LinuxHostResult(getrandom(buffer, arguments[1], arguments[2]))
+            }
+            default:
+                return -ENOSYS;
+        }
+    }
+
+    // Loads the executable and prepares the initial stack with the
+    // arguments, environment and auxiliary vector, as the kernel would
+    template<class CpuType>
+    bool load(CpuType& cpu, const std::string& path, const std::vector<std::string>& arguments, const std::vector<std::string>& environment) {
+        typedef typename CpuType::UIntType UIntType;
+        ELFIO::elfio reader;
+        if(!reader.load(path) || reader.get_machine() != 243 ||
+           reader.get_class() != ((sizeof(UIntType) == 4) ? ELFCLASS32 : ELFCLASS64))
+            return false;
+        xlen = sizeof(UIntType)*8;
+        executable = path;
+        exited = false;
+        syscalls = 0;
+
+        AddressType ramSize = static_cast<AddressType>(1)<<ram.size, end = 0, programHeaders = 0;
+        mmapBottom = ramSize-StackSize;
+        for(auto segment : reader.segments) {
+            if(segment->get_type() == PT_PHDR)
+                programHeaders = segment->get_virtual_address();
+            if(segment->get_type() != PT_LOAD)
+                continue;
+            AddressType address = segment->get_virtual_address();
+            if(address > mmapBottom || segment->get_memory_size() > mmapBottom-address)
+                return false;
+            ram.setBlock(address, segment->get_data(), segment->get_file_size());
+            ram.prepareWrite(address, segment->get_memory_size());
+            memset(ram.data+address+segment->get_file_size(), 0, segment->get_memory_size()-segment->get_file_size());
+            if(segment->get_offset() == 0 && !programHeaders)
+                programHeaders = address+reader.get_segments_offset();
+            end = std::max(end, address+segment->get_memory_size());
+        }
+        brkStart = brk = alignToPage(end);
+
+        // Strings at the top, then the pointer vectors below them
+        AddressType stackPointer = ramSize;
+        std::vector<UInt64> argumentPointers, environmentPointers;
+        auto pushData = [&](const void* data, AddressType length) {
+            stackPointer -= length;
+            ram.prepareWrite(stackPointer, length);
+            memcpy(ram.data+stackPointer, data, length);
+            return stackPointer;
+        };
+        for(auto& argument : arguments)
+            argumentPointers.push_back(pushData(argument.c_str(), argument.size()+1));
+        for(auto& variable : environment)
+            environmentPointers.push_back(pushData(variable.c_str(), variable.size()+1));
+        UInt8 random[16];
+        if(getrandom(random, sizeof(random), 0) != sizeof(random))
+            memset(random, 0, sizeof(random));
+        UInt64 randomPointer = pushData(random, sizeof(random));
+        const UInt64 auxiliaryVector[] = {
+            3, programHeaders, // AT_PHDR
+            4, reader.get_segment_entry_size(), // AT_PHENT
+            5, reader.segments.size(), // AT_PHNUM
+            6, PageSize, // AT_PAGESZ
+            9, reader.get_entry(), // AT_ENTRY
+            11, getuid(), 12, geteuid(), 13, getgid(), 14, getegid(), // AT_UID, AT_EUID, AT_GID, AT_EGID
+            23, 0, // AT_SECURE
+            25, randomPointer, // AT_RANDOM
+            0, 0 // AT_NULL
+        };
+        std::vector<UInt64> words;
+        words.push_back(arguments.size());
+        words.insert(words.end(), argumentPointers.begin(), argumentPointers.end());
+        words.push_back(0);
+        words.insert(words.end(), environmentPointers.begin(), environmentPointers.end());
+        words.push_back(0);
+        words.insert(words.end(), auxiliaryVector, auxiliaryVector+sizeof(auxiliaryVector)/sizeof(UInt64));
+        stackPointer = (stackPointer-words.size()*xlen/8)&~static_cast<AddressType>(15);
+        ram.prepareWrite(stackPointer, words.size()*xlen/8);
+        for(size_t i = 0; i < words.size(); ++i)
+            writeWord(ram.data+stackPointer+i*xlen/8, words[i]);
+
+        cpu.reset();
+        cpu.linuxUser = this;
+        cpu.regX[2].U = stackPointer;
+        cpu.pc = reader.get_entry();
+        setBitsIn(cpu.csr.status, static_cast<UIntType>(CpuType::User), 1, 2);
+        cpu.updateFastmem();
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef PLIC
+#define PLIC
+
+#include "Bus.hpp"
+
+// Platform level interrupt controller in the register layout of the SiFive
+// PLIC. Every attached hart gets two contexts, one for machine and one for
+// supervisor external interrupts. Devices drive the level of their source
+// from any thread, the result is delivered to the harts via InterruptLines.
+
+class Plic : public Device {
+    public:
+    const static UInt16 Sources = 64;
+    const static AddressType Size = 0x4000000;
+    struct Context {
+        InterruptLines* lines;
+        UInt8 bit;
+        UInt32 threshold;
+        UInt64 enabled[Sources/64];
+    };
+    std::vector<Context> contexts;
+    UInt32 priority[Sources];
+    UInt64 level[Sources/64], pending[Sources/64], claimed[Sources/64];
+    std::mutex mutex;
+
+    Plic() {
+        memset(priority, 0, sizeof(priority));
+        memset(level, 0, sizeof(level));
+        memset(pending, 0, sizeof(pending));
+        memset(claimed, 0, sizeof(claimed));
+    }
+
+    void attachHart(UInt32 hartid, InterruptLines* lines) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(hartid*2+2 > contexts.size())
+            contexts.resize(hartid*2+2, { NULL, 0, 0, { 0 } });
+        contexts[hartid*2] = { lines, 11, 0, { 0 } };
+        contexts[hartid*2+1] = { lines, 9, 0, { 0 } };
+    }
+
+    void setLevel(UInt16 source, bool value) {
+        if(source == 0 || source >= Sources)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        setBitsIn(level[source/64], static_cast<UInt64>(value), source%64, 1);
+        if(value && !getBitsFrom(claimed[source/64], source%64, 1))
+            setBitsIn(pending[source/64], static_cast<UInt64>(1), source%64, 1);
+        update();
+    }
+
+    UInt16 getBestSource(const Context& context) {
+        UInt16 best = 0;
+        for(UInt16 source = 1; source < Sources; ++source)
+            if(getBitsFrom(pending[source/64]&context.enabled[source/64], source%64, 1) &&
+               priority[source] > context.threshold && priority[source] > priority[best])
+                best = source;
+        return best;
+    }
+
+    void update() {
+        for(auto& context : contexts)
+            if(context.lines)
+                context.lines->set(context.bit, getBestSource(context) != 0);
+    }
+
+    UInt16 claim(Context& context) {
+        UInt16 source = getBestSource(context);
+        if(source) {
+            setBitsIn(pending[source/64], static_cast<UInt64>(0), source%64, 1);
+            setBitsIn(claimed[source/64], static_cast<UInt64>(1), source%64, 1);
+            update();
+        }
+        return source;
+    }
+
+    void complete(UInt32 source) {
+        if(source == 0 || source >= Sources)
+            return;
+        setBitsIn(claimed[source/64], static_cast<UInt64>(0), source%64, 1);
+        if(getBitsFrom(level[source/64], source%64, 1))
+            setBitsIn(pending[source/64], static_cast<UInt64>(1), source%64, 1);
+        update();
+    }
+
+    bool read(AddressType offset, UInt8* data, AddressType length) {
+        if(length != 4 || offset%4 != 0)
+            return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        UInt32 value;
+        if(offset < 4*Sources)
+            value = priority[offset/4];
+        else if(offset >= 0x1000 && offset < 0x1000+Sources/8)
+            value = pending[(offset-0x1000)/8]>>(offset%8*8);
+        else if(offset >= 0x2000 && offset < 0x200000) {
+            AddressType index = (offset-0x2000)/0x80, word = (offset-0x2000)%0x80;
+            if(index >= contexts.size() || word >= Sources/8)
+                return false;
+            value = contexts[index].enabled[word/8]>>(word%8*8);
+        }else if(offset >= 0x200000) {
+            AddressType index = (offset-0x200000)/0x1000;
+            if(index >= contexts.size())
+                return false;
+            switch(offset%0x1000) {
+                case 0:
+                    value = contexts[index].threshold;
+                break;
+                case 4:
+                    value = claim(contexts[index]);
+                break;
+                default:
+                    return false;
+            }
+        }else
+            return false;
+        memcpy(data, &value, length);
+        return true;
+    }
+
+    bool write(AddressType offset, const UInt8* data, AddressType length) {
+        if(length != 4 || offset%4 != 0)
+            return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        UInt32 value;
+        memcpy(&value, data, length);
+        if(offset < 4*Sources) {
+            if(offset > 0)
+                priority[offset/4] = value;
+        }else if(offset >= 0x1000 && offset < 0x1000+Sources/8)
+            return true;
+        else if(offset >= 0x2000 && offset < 0x200000) {
+            AddressType index = (offset-0x2000)/0x80, word = (offset-0x2000)%0x80;
+            if(index >= contexts.size() || word >= Sources/8)
+                return false;
+            setBitsIn(contexts[index].enabled[word/8], static_cast<UInt64>(value&~static_cast<UInt32>(word == 0)), word%8*8, 32);
+        }else if(offset >= 0x200000) {
+            AddressType index = (offset-0x200000)/0x1000;
+            if(index >= contexts.size())
+                return false;
+            switch(offset%0x1000) {
+                case 0:
+                    contexts[index].threshold = value;
+                break;
+                case 4:
+                    complete(value);
+                break;
+                default:
+                    return false;
+            }
+        }else
+            return false;
+        update();
+        return true;
+    }
+};
+
+#endif
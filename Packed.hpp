@@ -0,0 +1,160 @@
+#ifndef PACKED
+#define PACKED
+
+#include "Vector.hpp"
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+enum PackedOperation {
+    PackedAdd,
+    PackedSub,
+    PackedHalvingAdd,
+    PackedHalvingAddU,
+    PackedHalvingSub,
+    PackedHalvingSubU,
+    PackedSaturatingAdd,
+    PackedSaturatingAddU,
+    PackedSaturatingSub,
+    PackedSaturatingSubU,
+    PackedMin,
+    PackedMinU,
+    PackedMax,
+    PackedMaxU,
+    PackedSaturatingMulQ
+};
+
+template<typename type>
+type packedLaneOperation(PackedOperation op, type a, type b, bool& saturated) {
+    typedef typename std::make_signed<type>::type signed_type;
+    typedef typename Integer<sizeof(type)*16>::signed_type wide_signed_type;
+    const UInt8 bits = sizeof(type)*8;
+    const signed_type minValue = static_cast<signed_type>(static_cast<type>(1)<<(bits-1));
+    signed_type sa = a, sb = b;
+    switch(op) {
+        case PackedAdd:
+            return a+b;
+        case PackedSub:
+            return a-b;
+        case PackedHalvingAdd:
+            return (static_cast<wide_signed_type>(sa)+sb)>>1;
+        case PackedHalvingAddU:
+            return (static_cast<wide_signed_type>(a)+b)>>1;
+        case PackedHalvingSub:
+            return (static_cast<wide_signed_type>(sa)-sb)>>1;
+        case PackedHalvingSubU:
+            return (static_cast<wide_signed_type>(a)-b)>>1;
+        case PackedSaturatingAdd:
+            return vectorElementOperation(VectorSaturatingAdd, a, b, saturated);
+        case PackedSaturatingAddU:
+            return vectorElementOperation(VectorSaturatingAddU, a, b, saturated);
+        case PackedSaturatingSub:
+            return vectorElementOperation(VectorSaturatingSub, a, b, saturated);
+        case PackedSaturatingSubU:
+            return vectorElementOperation(VectorSaturatingSubU, a, b, saturated);
+        case PackedMin:
+            return std::min(sa, sb);
+        case PackedMinU:
+            return std::min(a, b);
+        case PackedMax:
+            return std::max(sa, sb);
+        case PackedMaxU:
+            return std::max(a, b);
+        case PackedSaturatingMulQ:
+            if(sa == minValue && sb == minValue) {
+                saturated = true;
+                return static_cast<type>(~static_cast<type>(minValue));
+            }
+            return (static_cast<wide_signed_type>(sa)*sb)>>(bits-1);
+    }
+    return 0;
+}
+
+// The host SIMD path works on 64 bit chunks of a register in a single SSE2
+// register and reports whether it could handle the operation.
+
+#if defined(__SSE2__) && defined(__x86_64__)
+#define PackedSimdCase(operation, size, expression) \
+    case operation*16+size: \
+        r = expression; \
+    break;
+
+#define PackedSimdSaturatingCase(operation, size, expression, wrapping) \
+    case operation*16+size: \
+        r = expression; \
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(r, wrapping)) != 0xFFFF) \
+            saturated = true; \
+    break;
+
+template<typename type>
+bool packedSimdOperation(PackedOperation op, UInt64 a, UInt64 b, UInt64& result, bool& saturated) {
+    const __m128i x = _mm_cvtsi64_si128(a), y = _mm_cvtsi64_si128(b),
+                  sign8 = _mm_set1_epi8(-0x80), sign16 = _mm_set1_epi16(-0x8000),
+                  one8 = _mm_set1_epi8(1), one16 = _mm_set1_epi16(1);
+    __m128i r;
+    switch(op*16+sizeof(type)) {
+        PackedSimdCase(PackedAdd, 1, _mm_add_epi8(x, y))
+        PackedSimdCase(PackedAdd, 2, _mm_add_epi16(x, y))
+        PackedSimdCase(PackedSub, 1, _mm_sub_epi8(x, y))
+        PackedSimdCase(PackedSub, 2, _mm_sub_epi16(x, y))
+        // avg rounds up, the halving add truncates: subtract the carried out low bit again
+        PackedSimdCase(PackedHalvingAddU, 1, _mm_sub_epi8(_mm_avg_epu8(x, y), _mm_and_si128(_mm_xor_si128(x, y), one8)))
+        PackedSimdCase(PackedHalvingAddU, 2, _mm_sub_epi16(_mm_avg_epu16(x, y), _mm_and_si128(_mm_xor_si128(x, y), one16)))
+        PackedSimdCase(PackedHalvingAdd, 1, _mm_xor_si128(sign8, _mm_sub_epi8(
+            _mm_avg_epu8(_mm_xor_si128(x, sign8), _mm_xor_si128(y, sign8)), _mm_and_si128(_mm_xor_si128(x, y), one8))))
+        PackedSimdCase(PackedHalvingAdd, 2, _mm_xor_si128(sign16, _mm_sub_epi16(
+            _mm_avg_epu16(_mm_xor_si128(x, sign16), _mm_xor_si128(y, sign16)), _mm_and_si128(_mm_xor_si128(x, y), one16))))
+        PackedSimdSaturatingCase(PackedSaturatingAdd, 1, _mm_adds_epi8(x, y), _mm_add_epi8(x, y))
+        PackedSimdSaturatingCase(PackedSaturatingAdd, 2, _mm_adds_epi16(x, y), _mm_add_epi16(x, y))
+        PackedSimdSaturatingCase(PackedSaturatingAddU, 1, _mm_adds_epu8(x, y), _mm_add_epi8(x, y))
+        PackedSimdSaturatingCase(PackedSaturatingAddU, 2, _mm_adds_epu16(x, y), _mm_add_epi16(x, y))
+        PackedSimdSaturatingCase(PackedSaturatingSub, 1, _mm_subs_epi8(x, y), _mm_sub_epi8(x, y))
+        PackedSimdSaturatingCase(PackedSaturatingSub, 2, _mm_subs_epi16(x, y), _mm_sub_epi16(x, y))
+        PackedSimdSaturatingCase(PackedSaturatingSubU, 1, _mm_subs_epu8(x, y), _mm_sub_epi8(x, y))
+        PackedSimdSaturatingCase(PackedSaturatingSubU, 2, _mm_subs_epu16(x, y), _mm_sub_epi16(x, y))
+        PackedSimdCase(PackedMin, 2, _mm_min_epi16(x, y))
+        PackedSimdCase(PackedMinU, 1, _mm_min_epu8(x, y))
+        PackedSimdCase(PackedMax, 2, _mm_max_epi16(x, y))
+        PackedSimdCase(PackedMaxU, 1, _mm_max_epu8(x, y))
+        case PackedSaturatingMulQ*16+2: {
+            __m128i overflow = _mm_and_si128(_mm_cmpeq_epi16(x, sign16), _mm_cmpeq_epi16(y, sign16));
+            r = _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epi16(x, y), 1), _mm_srli_epi16(_mm_mullo_epi16(x, y), 15));
+            r = _mm_xor_si128(r, overflow);
+            if(_mm_movemask_epi8(overflow))
+                saturated = true;
+        } break;
+        default:
+            return false;
+    }
+    result = _mm_cvtsi128_si64(r);
+    return true;
+}
+#else
+template<typename type>
+bool packedSimdOperation(PackedOperation op, UInt64 a, UInt64 b, UInt64& result, bool& saturated) {
+    return false;
+}
+#endif
+
+template<typename type, typename register_type>
+register_type packedOperation(PackedOperation op, register_type a, register_type b, bool& saturated) {
+    const UInt8 chunks = (sizeof(register_type)+7)/8;
+    UInt64 chunkResult;
+    register_type result = 0;
+    for(UInt8 i = 0; i < chunks; ++i) {
+        if(!packedSimdOperation<type>(op, a>>(i*64), b>>(i*64), chunkResult, saturated))
+            break;
+        result |= static_cast<register_type>(chunkResult)<<(i*64);
+        if(i+1 == chunks)
+            return result;
+    }
+    type lanesA[sizeof(register_type)/sizeof(type)], lanesB[sizeof(register_type)/sizeof(type)];
+    memcpy(lanesA, &a, sizeof(register_type));
+    memcpy(lanesB, &b, sizeof(register_type));
+    for(UInt8 i = 0; i < sizeof(register_type)/sizeof(type); ++i)
+        lanesA[i] = packedLaneOperation(op, lanesA[i], lanesB[i], saturated);
+    memcpy(&result, lanesA, sizeof(register_type));
+    return result;
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef PIPELINE
+#define PIPELINE
+
+#include "BranchPredictor.hpp"
+
+// Cycle approximate model of a single issue, in order pipeline. Every
+// retired instruction issues once its source registers are ready (register
+// scoreboard) and its functional unit is free, as division and square root
+// units are not pipelined. The model runs its own clock and returns the
+// cycles an instruction stalls in addition to the one it issues in.
+
+class Pipeline {
+    public:
+    enum Unit {
+        Integer,
+        Branch,
+        Load,
+        Store,
+        Multiply,
+        Divide,
+        FloatAdd,
+        FloatMultiply,
+        FloatFusedMultiplyAdd,
+        FloatDivide,
+        FloatSquareRoot,
+        FloatMisc,
+        System,
+        Units
+    };
+
+    enum StallReason {
+        LoadUse,
+        MultiplyResult,
+        DivideResult,
+        FloatResult,
+        UnitBusy,
+        Serialization,
+        CacheMiss,
+        BranchMispredict,
+        StallReasons
+    };
+
+    // Registers 0 to 31 are the integer and 32 to 63 the float registers
+    const static UInt8 NoRegister = 0xFF, FloatRegisters = 32;
+    struct Operation {
+        Unit unit;
+        UInt8 sources[3], destination;
+    };
+
+    UInt32 latencies[Units];
+    bool pipelined[Units];
+    UInt64 clock, instructions, ready[64], busyUntil[Units];
+    Unit producers[64];
+    UInt64 stallCycles[StallReasons];
+
+    Pipeline() {
+        const UInt32 defaultLatencies[Units] = { 1, 1, 3, 1, 3, 20, 4, 4, 5, 15, 20, 2, 5 };
+        for(UInt8 unit = 0; unit < Units; ++unit) {
+            latencies[unit] = defaultLatencies[unit];
+            pipelined[unit] = unit != Divide && unit != FloatDivide && unit != FloatSquareRoot;
+        }
+        clear();
+    }
+
+    void clear() {
+        clock = instructions = 0;
+        memset(ready, 0, sizeof(ready));
+        memset(busyUntil, 0, sizeof(busyUntil));
+        memset(stallCycles, 0, sizeof(stallCycles));
+        for(UInt8 index = 0; index < 64; ++index)
+            producers[index] = Integer;
+    }
+
+    static const char* getUnitName(UInt8 unit) {
+        static const char* names[Units] = {
+            "alu", "branch", "load", "store", "mul", "div", "fadd", "fmul", "fmadd", "fdiv", "fsqrt", "fmisc", "system"
+        };
+        return names[unit];
+    }
+
+    // Format: unit=latency, for example "load=4"
+    bool configure(const char* text) {
+        char name[16];
+        unsigned int latency;
+        if(sscanf(text, "%15[^=]=%u", name, &latency) != 2 || latency == 0)
+            return false;
+        for(UInt8 unit = 0; unit < Units; ++unit)
+            if(strcmp(name, getUnitName(unit)) == 0) {
+                latencies[unit] = latency;
+                return true;
+            }
+        return false;
+    }
+
+    static Operation decode(const Instruction& instruction) {
+        UInt8 rd = instruction.reg[0], rs1 = instruction.reg[1], rs2 = instruction.reg[2], rs3 = instruction.reg[3],
+              fd = rd+FloatRegisters, fs1 = rs1+FloatRegisters, fs2 = rs2+FloatRegisters, fs3 = rs3+FloatRegisters;
+        switch(instruction.opcode) {
+            case 0x03:
+                return { Load, { rs1, NoRegister, NoRegister }, rd };
+            case 0x07:
+                return { Load, { rs1, NoRegister, NoRegister }, fd };
+            case 0x23:
+                return { Store, { rs1, rs2, NoRegister }, NoRegister };
+            case 0x27:
+                return { Store, { rs1, fs2, NoRegister }, NoRegister };
+            case 0x2F:
+                return { Load, { rs1, rs2, NoRegister }, rd };
+            case 0x33:
+            case 0x3B:
+                if(instruction.funct[0] == 1)
+                    return { (instruction.funct[1] < 4) ? Multiply : Divide, { rs1, rs2, NoRegister }, rd };
+                return { Integer, { rs1, rs2, NoRegister }, rd };
+            case 0x43:
+            case 0x47:
+            case 0x4B:
+            case 0x4F:
+                return { FloatFusedMultiplyAdd, { fs1, fs2, fs3 }, fd };
+            case 0x53:
+                switch(instruction.funct[0]>>2) {
+                    case 0x00: // FADD
+                    case 0x01: // FSUB
+                        return { FloatAdd, { fs1, fs2, NoRegister }, fd };
+                    case 0x02: // FMUL
+                        return { FloatMultiply, { fs1, fs2, NoRegister }, fd };
+                    case 0x03: // FDIV
+                        return { FloatDivide, { fs1, fs2, NoRegister }, fd };
+                    case 0x0B: // FSQRT
+                        return { FloatSquareRoot, { fs1, NoRegister, NoRegister }, fd };
+                    case 0x08: // FCVT between float formats
+                        return { FloatAdd, { fs1, NoRegister, NoRegister }, fd };
+                    case 0x14: // FEQ, FLT, FLE
+                        return { FloatMisc, { fs1, fs2, NoRegister }, rd };
+                    case 0x18: // FCVT to integer
+                        return { FloatAdd, { fs1, NoRegister, NoRegister }, rd };
+                    case 0x1A: // FCVT from integer
+                        return { FloatAdd, { rs1, NoRegister, NoRegister }, fd };
+                    case 0x1C: // FMV.X, FCLASS
+                        return { FloatMisc, { fs1, NoRegister, NoRegister }, rd };
+                    case 0x1E: // FMV from integer
+                        return { FloatMisc, { rs1, NoRegister, NoRegister }, fd };
+                    default: // FSGNJ, FMIN, FMAX
+                        return { FloatMisc, { fs1, fs2, NoRegister }, fd };
+                }
+            case 0x63:
+                return { Branch, { rs1, rs2, NoRegister }, NoRegister };
+            case 0x67:
+                return { Branch, { rs1, NoRegister, NoRegister }, rd };
+            case 0x6F:
+                return { Branch, { NoRegister, NoRegister, NoRegister }, rd };
+            case 0x17:
+            case 0x37:
+                return { Integer, { NoRegister, NoRegister, NoRegister }, rd };
+            case 0x13:
+            case 0x1B:
+            case 0x5B:
+                return { Integer, { rs1, NoRegister, NoRegister }, rd };
+            case 0x73:
+                return { System, { (instruction.funct[0]&4) ? NoRegister : rs1, NoRegister, NoRegister }, rd };
+            case 0x0F:
+                return { Integer, { NoRegister, NoRegister, NoRegister }, NoRegister };
+            default: // Vector and packed operations are not modeled in detail
+                return { Integer, { NoRegister, NoRegister, NoRegister }, NoRegister };
+        }
+    }
+
+    static StallReason getStallReason(Unit producer) {
+        switch(producer) {
+            case Load:
+                return LoadUse;
+            case Multiply:
+                return MultiplyResult;
+            case Divide:
+                return DivideResult;
+            default:
+                return FloatResult;
+        }
+    }
+
+    // Stalls which are modeled elsewhere, like cache misses
+    void stall(StallReason reason, UInt64 cycles) {
+        clock += cycles;
+        stallCycles[reason] += cycles;
+    }
+
+    UInt64 issue(const Instruction& instruction) {
+        Operation operation = decode(instruction);
+        UInt64 start = clock+1, earliest = start;
+        StallReason reason = StallReasons;
+        for(UInt8 i = 0; i < 3; ++i) {
+            UInt8 source = operation.sources[i];
+            if(source < 64 && ready[source] > start) {
+                start = ready[source];
+                reason = getStallReason(producers[source]);
+            }
+        }
+        if(busyUntil[operation.unit] > start) {
+            start = busyUntil[operation.unit];
+            reason = UnitBusy;
+        }
+        // System instructions wait for all results, as they can change the state of the hart
+        if(operation.unit == System)
+            for(UInt8 index = 0; index < 64; ++index)
+                if(ready[index] > start) {
+                    start = ready[index];
+                    reason = Serialization;
+                }
+        if(reason != StallReasons)
+            stallCycles[reason] += start-earliest;
+        clock = start;
+        ++instructions;
+        UInt32 latency = latencies[operation.unit];
+        if(operation.destination < 64 && operation.destination != 0) {
+            ready[operation.destination] = start+latency;
+            producers[operation.destination] = operation.unit;
+        }
+        if(!pipelined[operation.unit])
+            busyUntil[operation.unit] = start+latency;
+        return start-earliest;
+    }
+
+    void writeReport(std::ostream& out) {
+        static const char* names[StallReasons] = {
+            "load use", "multiply result", "divide result", "float result",
+            "unit busy", "serialization", "cache miss", "branch mispredict"
+        };
+        char line[256];
+        snprintf(line, sizeof(line), "Pipeline: %llu instructions in %llu cycles, %.3f cycles per instruction",
+                 static_cast<unsigned long long>(instructions), static_cast<unsigned long long>(clock),
+                 (instructions) ? static_cast<double>(clock)/instructions : 0.0);
+        out << line << std::endl;
+        for(UInt8 reason = 0; reason < StallReasons; ++reason) {
+            snprintf(line, sizeof(line), "%16llu %6.2f%%  %s", static_cast<unsigned long long>(stallCycles[reason]),
+                     (clock) ? stallCycles[reason]*100.0/clock : 0.0, names[reason]);
+            out << line << std::endl;
+        }
+    }
+};
+
+#endif
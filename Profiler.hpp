@@ -0,0 +1,446 @@
+#ifndef PROFILER
+#define PROFILER
+
+#include "Packed.hpp"
+
+// Counts how often every instruction is executed, keyed by its virtual
+// address, in an open addressing hash table which doubles in size when it
+// is three quarters full. The report groups the counts by the function
+// symbols and annotates the hottest functions with their disassembly.
+
+class Profiler {
+    public:
+    const static AddressType Empty = ~static_cast<AddressType>(0);
+    struct Entry {
+        AddressType pc;
+        UInt64 count;
+    };
+    std::vector<Entry> entries;
+    UInt8 bits;
+    size_t used;
+
+    Profiler() :entries(static_cast<size_t>(1)<<16, { Empty, 0 }), bits(16), used(0) { }
+
+    size_t getIndex(AddressType pc) {
+        return (pc*0x9E3779B97F4A7C15ULL)>>(64-bits);
+    }
+
+    void count(AddressType pc) {
+        size_t mask = entries.size()-1;
+        for(size_t index = getIndex(pc); ; index = (index+1)&mask) {
+            Entry& entry = entries[index];
+            if(entry.pc == pc) {
+                ++entry.count;
+                return;
+            }
+            if(entry.pc == Empty) {
+                entry.pc = pc;
+                entry.count = 1;
+                if(++used*4 >= entries.size()*3)
+                    grow();
+                return;
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<Entry> previous(entries.size()*2, { Empty, 0 });
+        previous.swap(entries);
+        ++bits;
+        size_t mask = entries.size()-1;
+        for(auto& entry : previous)
+            if(entry.pc != Empty) {
+                size_t index = getIndex(entry.pc);
+                while(entries[index].pc != Empty)
+                    index = (index+1)&mask;
+                entries[index] = entry;
+            }
+    }
+
+    void clear() {
+        std::fill(entries.begin(), entries.end(), Entry{ Empty, 0 });
+        used = 0;
+    }
+
+    // getCode returns a host pointer to the code at a virtual address or NULL
+    void writeReport(std::ostream& out, Disassembler& disassembler,
+                     std::function<const UInt8*(AddressType, AddressType)> getCode,
+                     size_t hottestInstructions = 20, size_t annotatedFunctions = 3) {
+        struct Function {
+            AddressType address, end;
+            std::string name;
+            UInt64 count;
+        };
+        std::vector<Entry> hits;
+        UInt64 total = 0;
+        for(auto& entry : entries)
+            if(entry.pc != Empty) {
+                hits.push_back(entry);
+                total += entry.count;
+            }
+        if(total == 0)
+            return;
+        std::sort(hits.begin(), hits.end(), [](const Entry& a, const Entry& b) { return a.pc < b.pc; });
+
+        std::vector<Function> functions;
+        std::map<AddressType, std::string> labels;
+        for(auto& hit : hits) {
+            auto symbol = disassembler.symbols.upper_bound(hit.pc);
+            AddressType address = 0;
+            std::string name = "[unknown]";
+            if(symbol != disassembler.symbols.begin()) {
+                --symbol;
+                address = symbol->first;
+                name = symbol->second;
+            }
+            if(functions.empty() || functions.back().address != address || functions.back().name != name)
+                functions.push_back({ address, hit.pc, name, 0 });
+            functions.back().count += hit.count;
+            functions.back().end = hit.pc;
+            char label[32];
+            snprintf(label, sizeof(label), "+0x%llx", static_cast<unsigned long long>(hit.pc-address));
+            labels[hit.pc] = name+label;
+        }
+        std::sort(functions.begin(), functions.end(), [](const Function& a, const Function& b) { return a.count > b.count; });
+        std::sort(hits.begin(), hits.end(), [](const Entry& a, const Entry& b) { return a.count > b.count; });
+
+        char line[256];
+        out << "Functions (" << total << " instructions executed)" << std::endl;
+        for(auto& function : functions) {
+            snprintf(line, sizeof(line), "%16llu %6.2f%%  %s", static_cast<unsigned long long>(function.count),
+                     function.count*100.0/total, function.name.c_str());
+            out << line << std::endl;
+        }
+        out << std::endl << "Hottest instructions" << std::endl;
+        for(size_t i = 0; i < std::min(hottestInstructions, hits.size()); ++i) {
+            snprintf(line, sizeof(line), "%16llu %6.2f%%  %s", static_cast<unsigned long long>(hits[i].count),
+                     hits[i].count*100.0/total, labels[hits[i].pc].c_str());
+            out << line << std::endl;
+        }
+
+        // The disassembly covers a function up to its last executed instruction
+        std::map<AddressType, UInt64> counts;
+        for(auto& hit : hits)
+            counts[hit.pc] = hit.count;
+        for(size_t i = 0; i < std::min(annotatedFunctions, functions.size()); ++i) {
+            Function& function = functions[i];
+            AddressType length = function.end+sizeof(UInt32)-function.address;
+            const UInt8* code = getCode(function.address, length);
+            if(!code || function.name == "[unknown]")
+                continue;
+            disassembler.textSection.clear();
+            disassembler.addFunction(code, function.name, function.address, length);
+            out << std::endl << function.name << ":" << std::endl;
+            for(auto& text : disassembler.textSection) {
+                if(text.first > function.end)
+                    break;
+                auto count = counts.find(text.first);
+                UInt64 executed = (count == counts.end()) ? 0 : count->second;
+                snprintf(line, sizeof(line), "%16llu %6.2f%%  %8llx  %s", static_cast<unsigned long long>(executed),
+                         executed*100.0/total, static_cast<unsigned long long>(text.first), text.second.c_str());
+                out << line << std::endl;
+            }
+        }
+    }
+};
+
+// Follows the guest calls and returns on a shadow stack and counts the
+// executed instructions per unique call stack. The stacks form a tree,
+// whose nodes are identified by their parent and the called address.
+// Calls are jumps which link into ra or t0, returns are JALR through them.
+
+class CallStackProfiler {
+    public:
+    const static size_t MaxDepth = 1024;
+    struct Node {
+        size_t parent;
+        AddressType address;
+        UInt64 count;
+    };
+    struct Frame {
+        size_t node;
+        AddressType returnAddress;
+    };
+    std::vector<Node> nodes;
+    std::map<std::pair<size_t, AddressType>, size_t> children;
+    std::vector<Frame> stack;
+    size_t current;
+
+    CallStackProfiler() {
+        clear();
+    }
+
+    void clear() {
+        nodes.assign(1, { 0, 0, 0 });
+        children.clear();
+        stack.clear();
+        current = 0;
+    }
+
+    // The root is the function in which the profiling started
+    void count(AddressType pc, UInt64 instructions = 1) {
+        if(nodes.size() == 1 && nodes[0].count == 0)
+            nodes[0].address = pc;
+        nodes[current].count += instructions;
+    }
+
+    static bool isLinkRegister(UInt8 index) {
+        return index == 1 || index == 5;
+    }
+
+    void jump(UInt8 rd, UInt8 rs1, AddressType target, AddressType returnAddress) {
+        if(isLinkRegister(rd))
+            call(target, returnAddress);
+        else if(rd == 0 && isLinkRegister(rs1))
+            ret(target);
+    }
+
+    void call(AddressType target, AddressType returnAddress) {
+        size_t node = current;
+        if(stack.size() < MaxDepth) {
+            auto iter = children.find(std::make_pair(current, target));
+            if(iter == children.end()) {
+                node = nodes.size();
+                nodes.push_back({ current, target, 0 });
+                children[std::make_pair(current, target)] = node;
+            }else
+                node = iter->second;
+        }else // Calls which never return would grow the stack forever
+            stack.erase(stack.begin());
+        stack.push_back({ current, returnAddress });
+        current = node;
+    }
+
+    // Unwinds to the frame which returns to target, frames skipped by
+    // longjmp or exceptions are dropped and unmatched returns are ignored
+    void ret(AddressType target) {
+        for(size_t depth = stack.size(); depth > 0; --depth)
+            if(stack[depth-1].returnAddress == target) {
+                current = stack[depth-1].node;
+                stack.resize(depth-1);
+                return;
+            }
+    }
+
+    // One line per call stack: the function names from the root to the
+    // leaf separated by semicolons, followed by the instruction count
+    void writeFoldedStacks(std::ostream& out, const std::map<AddressType, std::string>& symbols) {
+        std::vector<std::string> names(nodes.size());
+        for(size_t index = 0; index < nodes.size(); ++index) {
+            auto symbol = symbols.upper_bound(nodes[index].address);
+            if(symbol == symbols.begin()) {
+                char name[32];
+                snprintf(name, sizeof(name), "0x%llx", static_cast<unsigned long long>(nodes[index].address));
+                names[index] = name;
+            }else
+                names[index] = (--symbol)->second;
+            // Parents are always created before their children
+            if(index > 0)
+                names[index] = names[nodes[index].parent]+";"+names[index];
+        }
+        for(size_t index = 0; index < nodes.size(); ++index)
+            if(nodes[index].count)
+                out << names[index] << " " << nodes[index].count << std::endl;
+    }
+};
+
+// Dynamic instruction mix: One counter per operation, indexed by the opcode
+// and the funct fields which select it. Immediate bits which select the
+// operation and the outcome of branches go into otherwise unused bits of
+// the index, so that counting is a single increment.
+
+class InstructionMix {
+    public:
+    const static size_t Size = static_cast<size_t>(1)<<17;
+    std::vector<UInt64> counts;
+
+    InstructionMix() :counts(Size, 0) { }
+
+    static size_t getIndex(const Instruction& instruction, bool taken) {
+        size_t funct3 = 0, funct7 = 0, variant = 0;
+        switch(instruction.opcode) {
+            case 0x53: // FCVT is selected by rs2
+                funct3 = instruction.funct[1];
+                funct7 = instruction.funct[0];
+                variant = instruction.reg[2]&3;
+            break;
+            case 0x2F:
+            case 0x33:
+            case 0x3B:
+            case 0x57:
+            case 0x77:
+            case 0x7B:
+                funct3 = instruction.funct[1];
+                funct7 = instruction.funct[0];
+            break;
+            case 0x43:
+            case 0x47:
+            case 0x4B:
+            case 0x4F:
+                funct7 = instruction.funct[0];
+            break;
+            case 0x13:
+            case 0x1B:
+            case 0x5B:
+                funct3 = instruction.funct[0];
+                if(funct3 == 5) // SRLI or SRAI
+                    variant = (instruction.imm>>10)&1;
+            break;
+            case 0x73:
+                funct3 = instruction.funct[0];
+                if(funct3 == 0) // ECALL, EBREAK, ERET, WFI, ...
+                    funct7 = (instruction.imm&0x1F)|((instruction.imm>>3)&0x60);
+            break;
+            case 0x63:
+                funct3 = instruction.funct[0];
+                variant = taken;
+            break;
+            case 0x03:
+            case 0x07:
+            case 0x0F:
+            case 0x23:
+            case 0x27:
+            case 0x67:
+                funct3 = instruction.funct[0];
+            break;
+        }
+        return (instruction.opcode>>2)|(funct3<<5)|(funct7<<8)|(variant<<15);
+    }
+
+    // Operations which do not check their funct fields are counted as one
+    void count(const Instruction& instruction, bool taken = false) {
+        ++counts[getIndex(instruction, taken)];
+    }
+
+    void clear() {
+        std::fill(counts.begin(), counts.end(), 0);
+    }
+
+    static Instruction getInstruction(size_t index) {
+        Instruction instruction;
+        UInt8 funct3 = getBitsFrom(index, 5, 3), funct7 = getBitsFrom(index, 8, 7), variant = getBitsFrom(index, 15, 2);
+        instruction.opcode = (getBitsFrom(index, 0, 5)<<2)|3;
+        instruction.reg[0] = 1;
+        instruction.reg[1] = 2;
+        instruction.reg[2] = 3;
+        instruction.reg[3] = 4;
+        instruction.imm = 0;
+        switch(instruction.getType()) {
+            case Instruction::R:
+                instruction.funct[0] = funct7;
+                instruction.funct[1] = funct3;
+                if(instruction.opcode == 0x53)
+                    instruction.reg[2] = variant;
+            break;
+            case Instruction::R4:
+                instruction.funct[0] = funct7;
+                instruction.funct[1] = 7;
+            break;
+            default:
+                instruction.funct[0] = funct3;
+                if(instruction.opcode == 0x73 && funct3 == 0)
+                    instruction.imm = (funct7&0x1F)|((funct7>>5)<<8);
+                else if(funct3 == 5 && variant)
+                    instruction.imm = 1<<10;
+            break;
+        }
+        return instruction;
+    }
+
+    static const char* getExtension(const Instruction& instruction) {
+        switch(instruction.opcode) {
+            case 0x2F:
+                return "A";
+            case 0x33:
+            case 0x3B:
+                return (instruction.funct[0] == 1) ? "M" : "I";
+            case 0x07:
+            case 0x27:
+                return (instruction.funct[0] == 2) ? "F" : (instruction.funct[0] == 3) ? "D" : "V";
+            case 0x43:
+            case 0x47:
+            case 0x4B:
+            case 0x4F:
+            case 0x53:
+                return (instruction.funct[0]&1) ? "D" : "F";
+            case 0x57:
+                return "V";
+            case 0x77:
+                return "P";
+            default:
+                return "I";
+        }
+    }
+
+    static const char* getClass(const Instruction& instruction, bool taken) {
+        switch(instruction.opcode) {
+            case 0x03:
+            case 0x07:
+                return "load";
+            case 0x23:
+            case 0x27:
+                return "store";
+            case 0x2F:
+                return "atomic";
+            case 0x63:
+                return (taken) ? "branch taken" : "branch not taken";
+            case 0x67:
+            case 0x6F:
+                return "jump";
+            case 0x73:
+                return "system";
+            default:
+                return "compute";
+        }
+    }
+
+    void writeReport(std::ostream& out) {
+        Disassembler disassembler;
+        disassembler.flags = static_cast<decltype(disassembler.flags)>(0);
+        std::map<std::string, UInt64> operations, extensions, classes;
+        UInt64 total = 0;
+        for(size_t index = 0; index < Size; ++index) {
+            if(!counts[index])
+                continue;
+            Instruction instruction = getInstruction(index);
+            bool taken = instruction.opcode == 0x63 && getBitsFrom(index, 15, 1);
+            std::string name;
+            try {
+                disassembler.addInstruction(0, instruction);
+                name = disassembler.buffer;
+                name = name.substr(0, name.find(' '));
+            } catch(Exception) {
+                char unknown[32];
+                snprintf(unknown, sizeof(unknown), "[opcode 0x%02x]", instruction.opcode);
+                name = unknown;
+            }
+            operations[name] += counts[index];
+            extensions[getExtension(instruction)] += counts[index];
+            classes[getClass(instruction, taken)] += counts[index];
+            total += counts[index];
+        }
+        if(total == 0)
+            return;
+        auto writeTable = [&](const char* title, const std::map<std::string, UInt64>& table) {
+            std::vector<std::pair<std::string, UInt64>> rows(table.begin(), table.end());
+            std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, UInt64>& a, const std::pair<std::string, UInt64>& b) {
+                return a.second > b.second;
+            });
+            char line[256];
+            out << title << std::endl;
+            for(auto& row : rows) {
+                snprintf(line, sizeof(line), "%16llu %6.2f%%  %s", static_cast<unsigned long long>(row.second),
+                         row.second*100.0/total, row.first.c_str());
+                out << line << std::endl;
+            }
+        };
+        out << "Instruction mix (" << total << " instructions retired)" << std::endl;
+        writeTable("Operations", operations);
+        out << std::endl;
+        writeTable("Extensions", extensions);
+        out << std::endl;
+        writeTable("Classes", classes);
+    }
+};
+
+#endif
@@ -1,27 +1,84 @@
 #ifndef RAM
 #define RAM
 
-#include "Disassembler.hpp"
+#include "Fastmem.hpp"
+#include <atomic>
+#include <sys/stat.h>
 
 class Ram {
     public:
     UInt8 size;
-    std::unique_ptr<UInt8> data;
+    UInt8* data;
+    AddressType addressMask;
+    int fastmemFile;
+    FastmemView view;
     std::recursive_mutex sealsMutex;
     std::set<std::pair<AddressType, UInt8>> seals;
+    // Mirrors !seals.empty(), so that writers can skip the lock
+    std::atomic<bool> sealed;
+    const static AddressType PageSize = 4096;
+    // Bounds of the size (log2) accepted from images
+    const static UInt8 MinSize = 12, MaxSize = 40;
+    bool snapshotActive;
+    std::vector<std::atomic<UInt64>> snapshotDirty;
+    std::vector<AddressType> snapshotPages;
+    std::vector<UInt8> snapshotData;
 
+    // The memory lies at the start of a host reservation of at least 64 GiB.
+    // Addresses are wrapped into the reservation and everything behind the
+    // memory is inaccessible, so that out of range accesses fault in the
+    // host instead of reaching other host memory. Cpu::fetchAndExecute()
+    // turns these faults into access fault traps.
     void setSize(UInt8 _size) {
+        disableFastmem();
+        releaseSnapshot();
         size = _size;
-        data.reset((size) ? new UInt8[1ULL<<size] : NULL);
+        AddressType reservation = static_cast<AddressType>(1)<<std::max(size+1, 36);
+        if(!view.reserve(reservation+(1ULL<<20)) || !view.map(-1, 0, 1ULL<<size, PROT_READ|PROT_WRITE))
+            throw std::bad_alloc();
+        data = view.base;
+        addressMask = reservation-1;
     }
 
-    Ram() :size(0) { }
+    // Moves the memory into a shared memory object, so that Cpus can mirror
+    // it into their own FastmemViews
+    bool enableFastmem() {
+        if(fastmemFile >= 0)
+            return true;
+        AddressType length = 1ULL<<size;
+        char name[32];
+        snprintf(name, sizeof(name), "/riscv-ram-%d", getpid());
+        int file = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+        if(file < 0)
+            return false;
+        shm_unlink(name);
+        if(ftruncate(file, length) != 0 || pwrite(file, data, length, 0) != static_cast<ssize_t>(length) ||
+           !view.map(file, 0, length, PROT_READ|PROT_WRITE)) {
+            close(file);
+            return false;
+        }
+        fastmemFile = file;
+        return true;
+    }
+
+    void disableFastmem() {
+        if(fastmemFile < 0)
+            return;
+        close(fastmemFile);
+        fastmemFile = -1;
+    }
+
+    Ram() :size(0), data(NULL), addressMask(0), fastmemFile(-1), sealed(false), snapshotActive(false) { }
+
+    ~Ram() {
+        disableFastmem();
+    }
 
     void dump(std::ostream& out) {
         if(size < 6) return;
         AddressType upTo = 1ULL<<size;
         out << std::setfill('0') << std::hex;
-        out << std::setw(16) << *reinterpret_cast<UInt64*>(data.get());
+        out << std::setw(16) << *reinterpret_cast<UInt64*>(data);
         for(AddressType i = sizeof(UInt64); i < upTo; i += sizeof(UInt64)) {
             if(i%(8*sizeof(UInt64)) == 0) {
                 out << std::endl;
@@ -29,33 +86,166 @@ class Ram {
                     out << std::endl;
             }else
                 out << " ";
-            out << std::setw(16) << *reinterpret_cast<UInt64*>(data.get()+i);
+            out << std::setw(16) << *reinterpret_cast<UInt64*>(data+i);
         }
         out << std::endl;
     }
 
+    bool isZeroPage(AddressType address, AddressType length) {
+        return data[address] == 0 && memcmp(data+address, data+address+1, length-1) == 0;
+    }
+
+    // Writes the memory into file at the page aligned offset. Pages which
+    // only contain zeros are skipped, leaving holes in a sparse file.
+    bool saveImage(int file, AddressType offset) {
+        AddressType length = static_cast<AddressType>(1)<<size;
+        for(AddressType begin = 0; begin < length; ) {
+            AddressType end = begin;
+            while(end < length && !isZeroPage(end, std::min(PageSize, length-end)))
+                end += std::min(PageSize, length-end);
+            for(AddressType done = begin; done < end; ) {
+                ssize_t written = pwrite(file, data+done, end-done, offset+done);
+                if(written <= 0)
+                    return false;
+                done += written;
+            }
+            begin = end+std::min(PageSize, length-end);
+        }
+        return ftruncate(file, offset+length) == 0;
+    }
+
+    // Maps an image copy-on-write instead of reading it, so that only the
+    // pages which are accessed get loaded from the file. A shared memory
+    // object can not be copy-on-write, so with fastmem the image is copied.
+    bool mapImage(int file, AddressType offset, UInt8 _size) {
+        // Pages behind the end of the file would raise SIGBUS when accessed
+        struct stat status;
+        if(_size < MinSize || _size > MaxSize || fstat(file, &status) < 0 ||
+           static_cast<AddressType>(status.st_size) < offset+(static_cast<AddressType>(1)<<_size))
+            return false;
+        bool fastmem = fastmemFile >= 0;
+        if(size != _size)
+            setSize(_size);
+        disableFastmem();
+        releaseSnapshot();
+        clearSeals();
+        if(mmap(data, static_cast<AddressType>(1)<<size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, file, offset) == MAP_FAILED)
+            return false;
+        return !fastmem || enableFastmem();
+    }
+
+    // Lets host code work on guest buffers in place, NULL if out of range
+    UInt8* getHostPointer(AddressType address, AddressType length) {
+        AddressType upTo = static_cast<AddressType>(1)<<size;
+        if(address > upTo || length > upTo-address)
+            return NULL;
+        return data+address;
+    }
+
     template<typename type, bool aligned>
     void get(AddressType address, type* value) {
         if(aligned)
-            *value = *reinterpret_cast<type*>(data.get()+address);
+            *value = *reinterpret_cast<type*>(data+(address&addressMask));
         else
-            memcpy(value, data.get()+address, sizeof(type));
+            memcpy(value, data+(address&addressMask), sizeof(type));
     }
 
-    template<typename type, bool aligned>
-    void set(AddressType address, type* value) {
-        std::lock_guard<std::recursive_mutex> lock(sealsMutex);
+    void breakSeals(AddressType address, AddressType length) {
         for(auto iter = seals.begin(); iter != seals.end(); )
             if((address >= iter->first && address < iter->first+iter->second) ||
-               (iter->first >= address && iter->first < address+sizeof(type)))
-                seals.erase(iter);
+               (iter->first >= address && iter->first < address+length))
+                iter = seals.erase(iter);
             else
                 ++iter;
+        sealed.store(!seals.empty(), std::memory_order_release);
+    }
+
+    void clearSeals() {
+        std::lock_guard<std::recursive_mutex> lock(sealsMutex);
+        seals.clear();
+        sealed.store(false, std::memory_order_release);
+    }
+
+    // Copy-on-write snapshot: After takeSnapshot() the first write to every
+    // page saves its old content, so that restoreSnapshot() only has to copy
+    // back the pages which were written since.
+    void takeSnapshot() {
+        releaseSnapshot();
+        snapshotDirty = std::vector<std::atomic<UInt64>>((static_cast<AddressType>(1)<<size)/PageSize/64+1);
+        snapshotActive = true;
+    }
+
+    void releaseSnapshot() {
+        snapshotActive = false;
+        snapshotDirty.clear();
+        snapshotPages.clear();
+        snapshotData.clear();
+    }
+
+    void restoreSnapshot() {
+        std::lock_guard<std::recursive_mutex> lock(sealsMutex);
+        for(size_t i = 0; i < snapshotPages.size(); ++i) {
+            memcpy(data+snapshotPages[i]*PageSize, &snapshotData[i*PageSize], PageSize);
+            snapshotDirty[snapshotPages[i]/64].fetch_and(~(static_cast<UInt64>(1)<<(snapshotPages[i]%64)), std::memory_order_relaxed);
+        }
+        snapshotPages.clear();
+        snapshotData.clear();
+        clearSeals();
+    }
+
+    void saveSnapshotPages(AddressType address, AddressType length) {
+        AddressType upTo = static_cast<AddressType>(1)<<size;
+        address &= addressMask;
+        if(length == 0 || address >= upTo)
+            return;
+        AddressType last = (std::min(address+length, upTo)-1)/PageSize;
+        for(AddressType page = address/PageSize; page <= last; ++page) {
+            UInt64 bit = static_cast<UInt64>(1)<<(page%64);
+            if(snapshotDirty[page/64].load(std::memory_order_acquire)&bit)
+                continue;
+            std::lock_guard<std::recursive_mutex> lock(sealsMutex);
+            if(snapshotDirty[page/64].load(std::memory_order_relaxed)&bit)
+                continue;
+            snapshotPages.push_back(page);
+            snapshotData.insert(snapshotData.end(), data+page*PageSize, data+(page+1)*PageSize);
+            snapshotDirty[page/64].fetch_or(bit, std::memory_order_release);
+        }
+    }
+
+    // Has to be called before the host writes into the memory directly
+    void prepareWrite(AddressType address, AddressType length) {
+        if(snapshotActive)
+            saveSnapshotPages(address, length);
+        if(sealed.load(std::memory_order_acquire)) {
+            std::lock_guard<std::recursive_mutex> lock(sealsMutex);
+            breakSeals(address, length);
+        }
+    }
+
+    template<typename type, bool aligned>
+    void set(AddressType address, type* value) {
+        std::lock_guard<std::recursive_mutex> lock(sealsMutex);
+        breakSeals(address, sizeof(type));
+        if(snapshotActive)
+            saveSnapshotPages(address, sizeof(type));
 
         if(aligned)
-            *reinterpret_cast<type*>(data.get()+address) = *value;
+            *reinterpret_cast<type*>(data+(address&addressMask)) = *value;
         else
-            memcpy(data.get()+address, value, sizeof(type));
+            memcpy(data+(address&addressMask), value, sizeof(type));
+    }
+
+    void getBlock(AddressType address, void* value, AddressType length) {
+        memcpy(value, data+(address&addressMask), length);
+    }
+
+    void setBlock(AddressType address, const void* value, AddressType length) {
+        std::lock_guard<std::recursive_mutex> lock(sealsMutex);
+        breakSeals(address, length);
+        if(snapshotActive)
+            saveSnapshotPages(address, length);
+
+        memcpy(data+(address&addressMask), value, length);
     }
 
     void seal(std::set<std::pair<AddressType, UInt8>>& prev, std::set<std::pair<AddressType, UInt8>> next) {
@@ -67,6 +257,7 @@ class Ram {
             prev.insert(entry);
             seals.insert(entry);
         }
+        sealed.store(!seals.empty(), std::memory_order_release);
     }
 
     bool unseal(const std::pair<AddressType, UInt8>& entry) {
@@ -74,6 +265,7 @@ class Ram {
         if(iter == seals.end())
             return false;
         seals.erase(iter);
+        sealed.store(!seals.empty(), std::memory_order_release);
         return true;
     }
 };
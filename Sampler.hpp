@@ -0,0 +1,177 @@
+#ifndef SAMPLER
+#define SAMPLER
+
+#include "Pipeline.hpp"
+
+// Sampled simulation: Most instructions are fast-forwarded by the plain
+// interpreter. Once per period the detailed timing models are switched on,
+// first to warm up their state and then to measure the cycles of a window
+// of instructions. The total cycles are extrapolated from the measured
+// cycles per instruction. Independently the basic block vectors of fixed
+// length intervals can be written in the SimPoint format, so that
+// representative intervals can be chosen offline.
+
+class Sampler {
+    public:
+    enum Phase {
+        FastForward,
+        Warmup,
+        Measure
+    };
+
+    struct Sample {
+        UInt64 instructions, cycles;
+    };
+
+    UInt64 period, warmup, window, interval;
+    CacheModel* cacheModel;
+    BranchPredictor* branchPredictor;
+    Pipeline* pipeline;
+    Phase phase;
+    UInt64 instructions, nextEvent, phaseEnd, phaseInstructions, phaseCycles, intervalEnd, intervals;
+    std::vector<Sample> samples;
+    std::ostream* basicBlockVectors;
+    std::unordered_map<AddressType, UInt64> blockCounts;
+    std::unordered_map<AddressType, UInt32> blockIds;
+    AddressType blockStart;
+    UInt64 blockLength;
+
+    // A period of 0 disables the sampling, only the intervals are tracked
+    Sampler() :period(0), warmup(0), window(0), interval(10000000),
+               cacheModel(NULL), branchPredictor(NULL), pipeline(NULL), basicBlockVectors(NULL) { }
+
+    // Format: period:warmup:window in instructions, for example "10000000:1000000:100000"
+    bool configure(const char* text) {
+        unsigned long long _period, _warmup, _window;
+        if(sscanf(text, "%llu:%llu:%llu", &_period, &_warmup, &_window) != 3 ||
+           _window == 0 || _warmup+_window > _period)
+            return false;
+        period = _period;
+        warmup = _warmup;
+        window = _window;
+        return true;
+    }
+
+    bool isDetailed() const {
+        return phase != FastForward;
+    }
+
+    void begin(AddressType pc, UInt64 cycles) {
+        phase = FastForward;
+        instructions = phaseInstructions = intervals = blockLength = 0;
+        phaseCycles = cycles;
+        phaseEnd = (period) ? period-warmup-window : ~0ULL;
+        intervalEnd = (basicBlockVectors) ? interval : ~0ULL;
+        samples.clear();
+        blockCounts.clear();
+        blockIds.clear();
+        blockStart = pc;
+        advance(cycles);
+    }
+
+    // Called for every retired instruction, nextPC is only used if taken.
+    // Returns true when advance() has to be called.
+    bool retire(AddressType nextPC, bool taken) {
+        ++blockLength;
+        if(taken) {
+            if(basicBlockVectors)
+                blockCounts[blockStart] += blockLength;
+            blockStart = nextPC;
+            blockLength = 0;
+        }
+        return ++instructions >= nextEvent;
+    }
+
+    void advance(UInt64 cycles) {
+        if(instructions >= intervalEnd) {
+            writeInterval();
+            intervalEnd += interval;
+        }
+        while(instructions >= phaseEnd) {
+            switch(phase) {
+                case FastForward:
+                    phase = Warmup;
+                    phaseEnd += warmup;
+                    break;
+                case Warmup:
+                    phase = Measure;
+                    phaseEnd += window;
+                    break;
+                case Measure:
+                    samples.push_back({ instructions-phaseInstructions, cycles-phaseCycles });
+                    phase = FastForward;
+                    phaseEnd += period-warmup-window;
+                    break;
+            }
+            phaseInstructions = instructions;
+            phaseCycles = cycles;
+        }
+        nextEvent = std::min(phaseEnd, intervalEnd);
+    }
+
+    // Records the incomplete sample and interval at the end of the program
+    void finish(UInt64 cycles) {
+        if(phase == Measure && instructions > phaseInstructions)
+            samples.push_back({ instructions-phaseInstructions, cycles-phaseCycles });
+        if(basicBlockVectors && instructions > intervals*interval)
+            writeInterval();
+        phase = FastForward;
+    }
+
+    // One line per interval: "T" followed by ":id:count" of each basic
+    // block, where count is the number of instructions executed in it
+    void writeInterval() {
+        if(blockLength) {
+            blockCounts[blockStart] += blockLength;
+            blockLength = 0;
+        }
+        std::vector<std::pair<AddressType, UInt64>> blocks(blockCounts.begin(), blockCounts.end());
+        std::sort(blocks.begin(), blocks.end());
+        *basicBlockVectors << "T";
+        for(auto& block : blocks) {
+            auto id = blockIds.insert(std::make_pair(block.first, blockIds.size()+1)).first;
+            *basicBlockVectors << ":" << id->second << ":" << block.second << " ";
+        }
+        *basicBlockVectors << std::endl;
+        blockCounts.clear();
+        ++intervals;
+    }
+
+    void writeReport(std::ostream& out) {
+        char line[256];
+        if(basicBlockVectors) {
+            snprintf(line, sizeof(line), "Basic block vectors: %llu intervals of %llu instructions, %zu basic blocks",
+                     static_cast<unsigned long long>(intervals), static_cast<unsigned long long>(interval), blockIds.size());
+            out << line << std::endl;
+        }
+        if(period == 0)
+            return;
+        UInt64 measuredInstructions = 0, measuredCycles = 0;
+        for(auto& sample : samples) {
+            measuredInstructions += sample.instructions;
+            measuredCycles += sample.cycles;
+        }
+        if(measuredInstructions == 0) {
+            out << "Sampling: No sample was measured in " << instructions << " instructions" << std::endl;
+            return;
+        }
+        double cyclesPerInstruction = static_cast<double>(measuredCycles)/measuredInstructions, variance = 0.0;
+        for(auto& sample : samples) {
+            double deviation = static_cast<double>(sample.cycles)/sample.instructions-cyclesPerInstruction;
+            variance += deviation*deviation;
+        }
+        if(samples.size() > 1)
+            variance /= samples.size()-1;
+        // 95% confidence interval of the mean, assuming normally distributed samples
+        double confidence = 1.96*sqrt(variance/samples.size())/cyclesPerInstruction*100.0;
+        snprintf(line, sizeof(line), "Sampling: %zu samples, %llu of %llu instructions measured (%.2f%%)",
+                 samples.size(), static_cast<unsigned long long>(measuredInstructions),
+                 static_cast<unsigned long long>(instructions), measuredInstructions*100.0/instructions);
+        out << line << std::endl;
+        snprintf(line, sizeof(line), "Estimated %.0f cycles, %.3f cycles per instruction (+-%.2f%%)",
+                 cyclesPerInstruction*instructions, cyclesPerInstruction, confidence);
+        out << line << std::endl;
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef TIMELINE
+#define TIMELINE
+
+#include "Trace.hpp"
+
+// Records the system level events of a hart: Traps, interrupts, privilege
+// mode switches, changes of the page table base and timer firings. The
+// events are kept in a ring buffer, so only the most recent ones survive,
+// and are exported in the Chrome trace event format, which can be opened
+// in chrome://tracing or Perfetto.
+
+class Timeline {
+    public:
+    enum Kind {
+        Trap,
+        Interrupt,
+        ModeSwitch,
+        AddressSpace,
+        TimerFired,
+        Kinds
+    };
+
+    enum Clock {
+        InstructionsRetired,
+        GuestTime
+    };
+
+    // Arguments: Trap and interrupt (cause, epc, badaddr), mode switch
+    // (pc), address space (sptbr), timer (mode)
+    struct Event {
+        UInt64 instret, time, arguments[3];
+        UInt8 kind, from, to;
+    };
+
+    std::vector<Event> events;
+    UInt64 recorded;
+    UInt64 hart;
+
+    // The capacity has to be a power of two
+    Timeline(UInt32 capacity = 1<<16) :events(capacity), recorded(0), hart(0) { }
+
+    void record(Kind kind, UInt8 from, UInt8 to, UInt64 instret, UInt64 time,
+                UInt64 argument0 = 0, UInt64 argument1 = 0, UInt64 argument2 = 0) {
+        events[recorded&(events.size()-1)] = { instret, time, { argument0, argument1, argument2 }, static_cast<UInt8>(kind), from, to };
+        ++recorded;
+    }
+
+    void clear() {
+        recorded = 0;
+    }
+
+    static const char* getModeName(UInt8 mode) {
+        static const char* names[] = { "user", "supervisor", "hypervisor", "machine" };
+        return names[mode&3];
+    }
+
+    static std::string getCauseName(UInt64 cause, bool interrupt) {
+        static const char* exceptions[] = {
+            "instruction address misaligned", "instruction access fault", "illegal instruction", "breakpoint",
+            "load address misaligned", "load access fault", "store address misaligned", "store access fault",
+            "ecall from user", "ecall from supervisor", "ecall from hypervisor", "ecall from machine"
+        };
+        static const char* interrupts[] = { "software interrupt", "timer interrupt", "external interrupt" };
+        if(interrupt && cause < 3)
+            return interrupts[cause];
+        if(!interrupt && cause < 12)
+            return exceptions[cause];
+        return ((interrupt) ? "interrupt " : "exception ")+std::to_string(cause);
+    }
+
+    std::string getEventName(const Event& event) const {
+        switch(event.kind) {
+            case Trap:
+            case Interrupt:
+                return getCauseName(event.arguments[0]&0xFF, event.kind == Interrupt);
+            case ModeSwitch:
+                return std::string("return to ")+getModeName(event.to);
+            case AddressSpace:
+                return "sptbr write";
+            default:
+                return std::string(getModeName(event.arguments[0]))+" timer";
+        }
+    }
+
+    // Events are written as instants and the time spent in each privilege
+    // mode as complete events. The timestamps are either the retired
+    // instructions (shown as microseconds) or the guest time.
+    void writeChromeTraceEvents(std::ostream& out, Clock clock, bool& first) const {
+        static const char* kinds[Kinds] = { "trap", "interrupt", "mode switch", "address space", "timer" };
+        UInt64 begin = (recorded > events.size()) ? recorded-events.size() : 0;
+        char line[512];
+        auto getTimestamp = [&](const Event& event) {
+            return (clock == InstructionsRetired) ? static_cast<double>(event.instret) : event.time*1e-3;
+        };
+        auto separate = [&]() {
+            if(!first)
+                out << "," << std::endl;
+            first = false;
+        };
+        separate();
+        snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%llu,\"args\":{\"name\":\"hart %llu\"}}",
+                 static_cast<unsigned long long>(hart), static_cast<unsigned long long>(hart));
+        out << line;
+        const Event* previous = NULL;
+        for(UInt64 index = begin; index < recorded; ++index) {
+            const Event& event = events[index&(events.size()-1)];
+            if(previous && event.from != event.to) {
+                separate();
+                snprintf(line, sizeof(line), "{\"name\":\"%s\",\"cat\":\"mode\",\"ph\":\"X\",\"pid\":0,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f}",
+                         getModeName(event.from), static_cast<unsigned long long>(hart), getTimestamp(*previous),
+                         getTimestamp(event)-getTimestamp(*previous));
+                out << line;
+            }
+            if(!previous || event.from != event.to)
+                previous = &event;
+            separate();
+            snprintf(line, sizeof(line), "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%llu,\"ts\":%.3f,"
+                     "\"args\":{\"from\":\"%s\",\"to\":\"%s\",\"instret\":%llu,\"time\":%llu",
+                     getEventName(event).c_str(), kinds[event.kind], static_cast<unsigned long long>(hart), getTimestamp(event),
+                     getModeName(event.from), getModeName(event.to),
+                     static_cast<unsigned long long>(event.instret), static_cast<unsigned long long>(event.time));
+            out << line;
+            switch(event.kind) {
+                case Trap:
+                case Interrupt:
+                    snprintf(line, sizeof(line), ",\"cause\":\"0x%llx\",\"epc\":\"0x%llx\",\"badaddr\":\"0x%llx\"}}",
+                             static_cast<unsigned long long>(event.arguments[0]), static_cast<unsigned long long>(event.arguments[1]),
+                             static_cast<unsigned long long>(event.arguments[2]));
+                    break;
+                case ModeSwitch:
+                    snprintf(line, sizeof(line), ",\"pc\":\"0x%llx\"}}", static_cast<unsigned long long>(event.arguments[0]));
+                    break;
+                case AddressSpace:
+                    snprintf(line, sizeof(line), ",\"sptbr\":\"0x%llx\"}}", static_cast<unsigned long long>(event.arguments[0]));
+                    break;
+                default:
+                    snprintf(line, sizeof(line), "}}");
+            }
+            out << line;
+        }
+    }
+
+    static void writeChromeTrace(std::ostream& out, const std::vector<const Timeline*>& timelines, Clock clock = InstructionsRetired) {
+        bool first = true;
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << std::endl;
+        for(auto timeline : timelines)
+            timeline->writeChromeTraceEvents(out, clock, first);
+        out << std::endl << "]}" << std::endl;
+    }
+};
+
+#endif
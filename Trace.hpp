@@ -0,0 +1,326 @@
+#ifndef TRACE
+#define TRACE
+
+#include "Sampler.hpp"
+#include <zlib.h>
+
+// Memory access traces: The file starts with a TraceHeader followed by
+// blocks, each a TraceBlockHeader and the zlib compressed records. The
+// records are encoded relative to the previous ones in the same block, so
+// that every block can be decoded on its own:
+//
+// - Flags byte: type in bits 0 to 1, size code in bits 2 to 4 (log2 of the
+//   size or 7 if the size follows explicitly), bit 5 is set if the physical
+//   address has the same offset to the virtual one as in the previous record
+//   and bit 6 if the pc is the predicted one (the address itself for fetches,
+//   otherwise the previous pc).
+// - Virtual address as zigzag varint delta to the previous one of the same type
+// - Size as varint, if the size code is 7
+// - Offset of the physical address as zigzag varint delta, unless bit 5 is set
+// - Pc as zigzag varint delta to the predicted one, unless bit 6 is set
+
+struct TraceRecord {
+    enum Type {
+        Fetch,
+        Load,
+        Store,
+        Atomic
+    };
+
+    AddressType virtualAddress, physicalAddress, pc;
+    UInt32 size;
+    UInt8 type;
+};
+
+struct TraceHeader {
+    char magic[8];
+    UInt32 version, blockSize;
+};
+
+struct TraceBlockHeader {
+    UInt32 compressedSize, size, records;
+};
+
+class TraceCodec {
+    public:
+    AddressType previousAddresses[4], previousOffset, previousPC;
+
+    TraceCodec() {
+        reset();
+    }
+
+    void reset() {
+        memset(previousAddresses, 0, sizeof(previousAddresses));
+        previousOffset = previousPC = 0;
+    }
+
+    static void writeVarint(std::vector<UInt8>& out, UInt64 value) {
+        while(value >= 0x80) {
+            out.push_back(static_cast<UInt8>(value|0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<UInt8>(value));
+    }
+
+    static void writeSigned(std::vector<UInt8>& out, UInt64 delta) {
+        writeVarint(out, (delta<<1)^static_cast<UInt64>(static_cast<Int64>(delta)>>63));
+    }
+
+    static bool readVarint(const UInt8*& in, const UInt8* end, UInt64& value) {
+        value = 0;
+        for(UInt8 shift = 0; in < end && shift < 64; shift += 7) {
+            UInt8 byte = *in++;
+            value |= static_cast<UInt64>(byte&0x7F)<<shift;
+            if(!(byte&0x80))
+                return true;
+        }
+        return false;
+    }
+
+    static bool readSigned(const UInt8*& in, const UInt8* end, UInt64& delta) {
+        if(!readVarint(in, end, delta))
+            return false;
+        delta = (delta>>1)^(0-(delta&1));
+        return true;
+    }
+
+    void encode(std::vector<UInt8>& out, const TraceRecord& record) {
+        AddressType offset = record.physicalAddress-record.virtualAddress,
+                    predictedPC = (record.type == TraceRecord::Fetch) ? record.virtualAddress : previousPC;
+        UInt8 sizeCode = 7;
+        if(record.size && !(record.size&(record.size-1)) && record.size <= 64)
+            sizeCode = __builtin_ctz(record.size);
+        out.push_back(record.type|(sizeCode<<2)|((offset == previousOffset) ? 0x20 : 0)|((record.pc == predictedPC) ? 0x40 : 0));
+        writeSigned(out, record.virtualAddress-previousAddresses[record.type]);
+        if(sizeCode == 7)
+            writeVarint(out, record.size);
+        if(offset != previousOffset)
+            writeSigned(out, offset-previousOffset);
+        if(record.pc != predictedPC)
+            writeSigned(out, record.pc-predictedPC);
+        previousAddresses[record.type] = record.virtualAddress;
+        previousOffset = offset;
+        previousPC = record.pc;
+    }
+
+    bool decode(const UInt8*& in, const UInt8* end, TraceRecord& record) {
+        if(in >= end)
+            return false;
+        UInt8 flags = *in++;
+        UInt64 value;
+        record.type = flags&3;
+        if(!readSigned(in, end, value))
+            return false;
+        record.virtualAddress = previousAddresses[record.type]+value;
+        UInt8 sizeCode = (flags>>2)&7;
+        if(sizeCode == 7) {
+            if(!readVarint(in, end, value))
+                return false;
+            record.size = value;
+        }else
+            record.size = 1<<sizeCode;
+        if(!(flags&0x20)) {
+            if(!readSigned(in, end, value))
+                return false;
+            previousOffset += value;
+        }
+        record.physicalAddress = record.virtualAddress+previousOffset;
+        record.pc = (record.type == TraceRecord::Fetch) ? record.virtualAddress : previousPC;
+        if(!(flags&0x40)) {
+            if(!readSigned(in, end, value))
+                return false;
+            record.pc += value;
+        }
+        previousAddresses[record.type] = record.virtualAddress;
+        previousPC = record.pc;
+        return true;
+    }
+};
+
+// The Cpu appends records to a single producer, single consumer ring
+// buffer. A background thread encodes, compresses and writes the blocks.
+// The producer only publishes its position every PublishInterval records,
+// to keep the shared cache lines quiet.
+
+class TraceRecorder {
+    public:
+    const static UInt32 Capacity = 1<<16, PublishInterval = 256;
+    std::vector<TraceRecord> ring;
+    alignas(64) std::atomic<UInt64> head;
+    alignas(64) std::atomic<UInt64> tail;
+    alignas(64) UInt64 localHead, cachedTail;
+    std::atomic<bool> stopping;
+    std::thread writer;
+    FILE* file;
+    UInt32 blockSize, compressionLevel;
+    UInt64 records, rawBytes, compressedBytes;
+    bool failed;
+
+    TraceRecorder() :ring(Capacity), head(0), tail(0), localHead(0), cachedTail(0), stopping(false),
+                     file(NULL), blockSize(1<<20), compressionLevel(1), records(0), rawBytes(0), compressedBytes(0), failed(false) { }
+
+    ~TraceRecorder() {
+        close();
+    }
+
+    bool open(const char* path) {
+        file = fopen(path, "wb");
+        if(!file)
+            return false;
+        TraceHeader header = { { 'R', 'V', 'T', 'R', 'A', 'C', 'E', 0 }, 1, blockSize };
+        if(fwrite(&header, sizeof(header), 1, file) != 1) {
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+        head = tail = localHead = cachedTail = 0;
+        stopping = false;
+        writer = std::thread(&TraceRecorder::writeBlocks, this);
+        return true;
+    }
+
+    // Returns false if the trace could not be written completely
+    bool close() {
+        if(!file)
+            return !failed;
+        head.store(localHead, std::memory_order_release);
+        stopping.store(true, std::memory_order_release);
+        writer.join();
+        fclose(file);
+        file = NULL;
+        return !failed;
+    }
+
+    void record(UInt8 type, UInt32 size, AddressType virtualAddress, AddressType physicalAddress, AddressType pc) {
+        if(localHead-cachedTail == Capacity) {
+            head.store(localHead, std::memory_order_release);
+            while(localHead-(cachedTail = tail.load(std::memory_order_acquire)) == Capacity)
+                std::this_thread::yield();
+        }
+        ring[localHead&(Capacity-1)] = { virtualAddress, physicalAddress, pc, size, type };
+        if(++localHead%PublishInterval == 0)
+            head.store(localHead, std::memory_order_release);
+    }
+
+    void writeBlock(std::vector<UInt8>& block, UInt32 blockRecords, std::vector<UInt8>& compressed) {
+        uLongf length = compressBound(block.size());
+        compressed.resize(length);
+        if(compress2(compressed.data(), &length, block.data(), block.size(), compressionLevel) != Z_OK) {
+            failed = true;
+            return;
+        }
+        TraceBlockHeader header = { static_cast<UInt32>(length), static_cast<UInt32>(block.size()), blockRecords };
+        if(fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(compressed.data(), 1, length, file) != length)
+            failed = true;
+        rawBytes += block.size();
+        compressedBytes += sizeof(header)+length;
+    }
+
+    void writeBlocks() {
+        TraceCodec codec;
+        std::vector<UInt8> block, compressed;
+        UInt32 blockRecords = 0;
+        UInt64 position = 0;
+        block.reserve(blockSize+64);
+        while(true) {
+            bool stop = stopping.load(std::memory_order_acquire);
+            UInt64 end = head.load(std::memory_order_acquire);
+            if(position == end) {
+                if(stop)
+                    break;
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+            for(; position < end; ++position) {
+                codec.encode(block, ring[position&(Capacity-1)]);
+                ++blockRecords;
+                if(block.size() >= blockSize) {
+                    writeBlock(block, blockRecords, compressed);
+                    records += blockRecords;
+                    block.clear();
+                    blockRecords = 0;
+                    codec.reset();
+                }
+            }
+            tail.store(position, std::memory_order_release);
+        }
+        if(blockRecords) {
+            writeBlock(block, blockRecords, compressed);
+            records += blockRecords;
+        }
+    }
+
+    void writeReport(std::ostream& out) {
+        char line[256];
+        snprintf(line, sizeof(line), "Trace: %llu records, %llu bytes encoded, %llu bytes compressed (%.2f bytes per record)",
+                 static_cast<unsigned long long>(records), static_cast<unsigned long long>(rawBytes),
+                 static_cast<unsigned long long>(compressedBytes), (records) ? static_cast<double>(compressedBytes)/records : 0.0);
+        out << line << std::endl;
+    }
+};
+
+// Replays a trace written by the TraceRecorder, one record at a time
+class TraceReader {
+    public:
+    FILE* file;
+    TraceHeader header;
+    TraceCodec codec;
+    std::vector<UInt8> block, compressed;
+    const UInt8 *position, *end;
+    UInt32 remaining;
+
+    TraceReader() :file(NULL), position(NULL), end(NULL), remaining(0) { }
+
+    ~TraceReader() {
+        close();
+    }
+
+    bool open(const char* path) {
+        close();
+        file = fopen(path, "rb");
+        if(!file)
+            return false;
+        if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "RVTRACE", 8) != 0 || header.version != 1) {
+            close();
+            return false;
+        }
+        remaining = 0;
+        return true;
+    }
+
+    void close() {
+        if(file)
+            fclose(file);
+        file = NULL;
+    }
+
+    bool readBlock() {
+        TraceBlockHeader blockHeader;
+        if(!file || fread(&blockHeader, sizeof(blockHeader), 1, file) != 1)
+            return false;
+        compressed.resize(blockHeader.compressedSize);
+        block.resize(blockHeader.size);
+        uLongf length = blockHeader.size;
+        if(fread(compressed.data(), 1, compressed.size(), file) != compressed.size() ||
+           uncompress(block.data(), &length, compressed.data(), compressed.size()) != Z_OK || length != blockHeader.size)
+            return false;
+        position = block.data();
+        end = position+length;
+        remaining = blockHeader.records;
+        codec.reset();
+        return true;
+    }
+
+    // Returns false at the end of the trace or if it is corrupted
+    bool next(TraceRecord& record) {
+        while(remaining == 0)
+            if(!readBlock())
+                return false;
+        if(!codec.decode(position, end, record))
+            return false;
+        --remaining;
+        return true;
+    }
+};
+
+#endif
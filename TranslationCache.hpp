@@ -0,0 +1,64 @@
+#ifndef TRANSLATION_CACHE
+#define TRANSLATION_CACHE
+
+#include "CSR.hpp"
+
+// Direct mapped cache of complete translations from virtual pages to
+// physical frames. The tag holds everything the translation depends on
+// (paging mode, privilege, access type, ASID and VMID), so switching
+// between address spaces does not require a flush. Changing the root of
+// a page table does. Entries of the second stage alone, from guest
+// physical pages, are kept apart by the stage bit.
+
+template<UInt16 Size>
+class TranslationCache {
+    public:
+    struct Entry {
+        AddressType page, frame;
+        UInt64 tag;
+        bool valid;
+    } entries[Size];
+    UInt64 hits, misses;
+
+    TranslationCache() {
+        flush();
+        hits = misses = 0;
+    }
+
+    static UInt64 getTag(UInt8 vm, UInt8 privilege, UInt8 accessType, bool guest, UInt16 asid, UInt16 vmid, bool secondStage) {
+        return vm|(privilege<<5)|(accessType<<7)|(static_cast<UInt64>(guest)<<10)|(static_cast<UInt64>(secondStage)<<11)|
+               (static_cast<UInt64>(asid)<<16)|(static_cast<UInt64>(vmid)<<32);
+    }
+
+    void flush() {
+        for(UInt16 i = 0; i < Size; ++i)
+            entries[i].valid = false;
+    }
+
+    void flushPage(AddressType page) {
+        Entry& entry = entries[page%Size];
+        if(entry.page == page)
+            entry.valid = false;
+    }
+
+    bool lookup(AddressType page, UInt64 tag, AddressType& frame) {
+        Entry& entry = entries[page%Size];
+        if(!entry.valid || entry.page != page || entry.tag != tag) {
+            ++misses;
+            return false;
+        }
+        ++hits;
+        frame = entry.frame;
+        return true;
+    }
+
+    void insert(AddressType page, UInt64 tag, AddressType frame) {
+        Entry& entry = entries[page%Size];
+        entry.page = page;
+        entry.frame = frame;
+        entry.tag = tag;
+        entry.valid = true;
+    }
+};
+
+#endif
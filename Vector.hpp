@@ -0,0 +1,381 @@
+#ifndef VECTOR
+#define VECTOR
+
+#include "TranslationCache.hpp"
+#include <cmath>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+enum VectorOperation {
+    VectorAdd,
+    VectorSub,
+    VectorReverseSub,
+    VectorMinU,
+    VectorMin,
+    VectorMaxU,
+    VectorMax,
+    VectorAnd,
+    VectorOr,
+    VectorXor,
+    VectorShiftLeft,
+    VectorShiftRightLogical,
+    VectorShiftRightArithmetic,
+    VectorSaturatingAddU,
+    VectorSaturatingAdd,
+    VectorSaturatingSubU,
+    VectorSaturatingSub,
+    VectorMul,
+    VectorMulHigh,
+    VectorMulHighU,
+    VectorMulHighSU,
+    VectorDivU,
+    VectorDiv,
+    VectorRemU,
+    VectorRem,
+    VectorEqual,
+    VectorNotEqual,
+    VectorLessU,
+    VectorLess,
+    VectorLessEqualU,
+    VectorLessEqual,
+    VectorGreaterU,
+    VectorGreater
+};
+
+enum VectorFloatOperation {
+    VectorFloatAdd,
+    VectorFloatSub,
+    VectorFloatReverseSub,
+    VectorFloatMul,
+    VectorFloatDiv,
+    VectorFloatReverseDiv,
+    VectorFloatMin,
+    VectorFloatMax,
+    VectorFloatSignInject,
+    VectorFloatSignInjectNegated,
+    VectorFloatSignInjectXor,
+    VectorFloatEqual,
+    VectorFloatNotEqual,
+    VectorFloatLess,
+    VectorFloatLessEqual,
+    VectorFloatGreater,
+    VectorFloatGreaterEqual
+};
+
+template<UInt16 VLEN>
+class VectorRegisterFile {
+    public:
+    static const UInt32 VLENB = VLEN/8;
+    alignas(32) UInt8 data[32*VLENB];
+    alignas(32) UInt8 scratch[8*VLENB];
+
+    template<typename type>
+    type* element(UInt8 index) {
+        return reinterpret_cast<type*>(data+index*VLENB);
+    }
+
+    bool getMaskBit(UInt8 index, UInt32 element) const {
+        return (data[index*VLENB+element/8]>>(element%8))&1;
+    }
+
+    void setMaskBit(UInt8 index, UInt32 element, bool value) {
+        UInt8& byte = data[index*VLENB+element/8];
+        byte = (byte&~(1U<<(element%8)))|(static_cast<UInt8>(value)<<(element%8));
+    }
+};
+
+inline bool vectorMaskActive(const UInt8* mask, UInt32 index) {
+    return !mask || (mask[index/8]>>(index%8))&1;
+}
+
+template<typename type>
+type vectorElementOperation(VectorOperation op, type a, type b, bool& saturated) {
+    typedef typename std::make_signed<type>::type signed_type;
+    typedef typename Integer<sizeof(type)*16>::unsigned_type wide_unsigned_type;
+    typedef typename Integer<sizeof(type)*16>::signed_type wide_signed_type;
+    const UInt8 bits = sizeof(type)*8;
+    const signed_type minValue = static_cast<signed_type>(static_cast<type>(1)<<(bits-1)),
+                      maxValue = static_cast<signed_type>(~static_cast<type>(minValue));
+    signed_type sa = a, sb = b;
+    switch(op) {
+        case VectorAdd:
+            return a+b;
+        case VectorSub:
+            return a-b;
+        case VectorReverseSub:
+            return b-a;
+        case VectorMinU:
+            return std::min(a, b);
+        case VectorMin:
+            return std::min(sa, sb);
+        case VectorMaxU:
+            return std::max(a, b);
+        case VectorMax:
+            return std::max(sa, sb);
+        case VectorAnd:
+            return a&b;
+        case VectorOr:
+            return a|b;
+        case VectorXor:
+            return a^b;
+        case VectorShiftLeft:
+            return a<<(b&(bits-1));
+        case VectorShiftRightLogical:
+            return a>>(b&(bits-1));
+        case VectorShiftRightArithmetic:
+            return sa>>(b&(bits-1));
+        case VectorSaturatingAddU: {
+            type result = a+b;
+            if(result >= a) return result;
+            saturated = true;
+            return ~static_cast<type>(0);
+        }
+        case VectorSaturatingAdd: {
+            signed_type result = static_cast<type>(a+b);
+            if(((sa^result)&(sb^result)) >= 0) return result;
+            saturated = true;
+            return (sa < 0) ? minValue : maxValue;
+        }
+        case VectorSaturatingSubU:
+            if(a >= b) return a-b;
+            saturated = true;
+            return 0;
+        case VectorSaturatingSub: {
+            signed_type result = static_cast<type>(a-b);
+            if(((sa^sb)&(sa^result)) >= 0) return result;
+            saturated = true;
+            return (sa < 0) ? minValue : maxValue;
+        }
+        case VectorMul:
+            return static_cast<wide_unsigned_type>(a)*static_cast<wide_unsigned_type>(b);
+        case VectorMulHigh:
+            return (static_cast<wide_signed_type>(sa)*static_cast<wide_signed_type>(sb))>>bits;
+        case VectorMulHighU:
+            return (static_cast<wide_unsigned_type>(a)*static_cast<wide_unsigned_type>(b))>>bits;
+        case VectorMulHighSU:
+            return (static_cast<wide_signed_type>(sa)*static_cast<wide_signed_type>(b))>>bits;
+        case VectorDivU:
+            return (b) ? a/b : ~static_cast<type>(0);
+        case VectorDiv:
+            if(b == 0) return ~static_cast<type>(0);
+            if(sa == minValue && sb == -1) return a;
+            return sa/sb;
+        case VectorRemU:
+            return (b) ? a%b : a;
+        case VectorRem:
+            if(b == 0) return a;
+            if(sa == minValue && sb == -1) return 0;
+            return sa%sb;
+        case VectorEqual:
+            return a == b;
+        case VectorNotEqual:
+            return a != b;
+        case VectorLessU:
+            return a < b;
+        case VectorLess:
+            return sa < sb;
+        case VectorLessEqualU:
+            return a <= b;
+        case VectorLessEqual:
+            return sa <= sb;
+        case VectorGreaterU:
+            return a > b;
+        case VectorGreater:
+            return sa > sb;
+    }
+    return 0;
+}
+
+template<typename type>
+type vectorFloatElementOperation(VectorFloatOperation op, type a, type b) {
+    switch(op) {
+        case VectorFloatAdd:
+            return a+b;
+        case VectorFloatSub:
+            return a-b;
+        case VectorFloatReverseSub:
+            return b-a;
+        case VectorFloatMul:
+            return a*b;
+        case VectorFloatDiv:
+            return a/b;
+        case VectorFloatReverseDiv:
+            return b/a;
+        case VectorFloatMin:
+            return std::fmin(a, b);
+        case VectorFloatMax:
+            return std::fmax(a, b);
+        case VectorFloatSignInject:
+            return std::copysign(a, b);
+        case VectorFloatSignInjectNegated:
+            return std::copysign(a, -b);
+        case VectorFloatSignInjectXor:
+            return std::copysign(a, (std::signbit(a) != std::signbit(b)) ? -1.0 : 1.0);
+        case VectorFloatEqual:
+            return a == b;
+        case VectorFloatNotEqual:
+            return a != b;
+        case VectorFloatLess:
+            return a < b;
+        case VectorFloatLessEqual:
+            return a <= b;
+        case VectorFloatGreater:
+            return a > b;
+        case VectorFloatGreaterEqual:
+            return a >= b;
+    }
+    return 0;
+}
+
+// Host SIMD kernels process the unmasked prefix of an operation in whole host
+// registers and return how many elements they handled, the rest is left to the
+// scalar element loop.
+
+#define VectorSimdCase(operation, size, width, prefix, expression) \
+    case operation*16+size: \
+        for(; i+width/8/size <= count; i += width/8/size) { \
+            __m##width##i x = prefix##loadu_si##width(reinterpret_cast<const __m##width##i*>(a+i)), \
+                          y = prefix##loadu_si##width(reinterpret_cast<const __m##width##i*>(b+i)); \
+            prefix##storeu_si##width(reinterpret_cast<__m##width##i*>(dst+i), expression); \
+        } \
+    break;
+
+#define VectorSimdLogicCases(operation, width, prefix, expression) \
+    VectorSimdCase(operation, 1, width, prefix, expression) \
+    VectorSimdCase(operation, 2, width, prefix, expression) \
+    VectorSimdCase(operation, 4, width, prefix, expression) \
+    VectorSimdCase(operation, 8, width, prefix, expression)
+
+#define VectorSimdKernel(name, width, prefix) \
+template<typename type> \
+UInt32 name(VectorOperation op, type* dst, const type* a, const type* b, UInt32 count) { \
+    UInt32 i = 0; \
+    switch(op*16+sizeof(type)) { \
+        VectorSimdCase(VectorAdd, 1, width, prefix, prefix##add_epi8(x, y)) \
+        VectorSimdCase(VectorAdd, 2, width, prefix, prefix##add_epi16(x, y)) \
+        VectorSimdCase(VectorAdd, 4, width, prefix, prefix##add_epi32(x, y)) \
+        VectorSimdCase(VectorAdd, 8, width, prefix, prefix##add_epi64(x, y)) \
+        VectorSimdCase(VectorSub, 1, width, prefix, prefix##sub_epi8(x, y)) \
+        VectorSimdCase(VectorSub, 2, width, prefix, prefix##sub_epi16(x, y)) \
+        VectorSimdCase(VectorSub, 4, width, prefix, prefix##sub_epi32(x, y)) \
+        VectorSimdCase(VectorSub, 8, width, prefix, prefix##sub_epi64(x, y)) \
+        VectorSimdCase(VectorReverseSub, 1, width, prefix, prefix##sub_epi8(y, x)) \
+        VectorSimdCase(VectorReverseSub, 2, width, prefix, prefix##sub_epi16(y, x)) \
+        VectorSimdCase(VectorReverseSub, 4, width, prefix, prefix##sub_epi32(y, x)) \
+        VectorSimdCase(VectorReverseSub, 8, width, prefix, prefix##sub_epi64(y, x)) \
+        VectorSimdCase(VectorMinU, 1, width, prefix, prefix##min_epu8(x, y)) \
+        VectorSimdCase(VectorMinU, 2, width, prefix, prefix##min_epu16(x, y)) \
+        VectorSimdCase(VectorMinU, 4, width, prefix, prefix##min_epu32(x, y)) \
+        VectorSimdCase(VectorMin, 1, width, prefix, prefix##min_epi8(x, y)) \
+        VectorSimdCase(VectorMin, 2, width, prefix, prefix##min_epi16(x, y)) \
+        VectorSimdCase(VectorMin, 4, width, prefix, prefix##min_epi32(x, y)) \
+        VectorSimdCase(VectorMaxU, 1, width, prefix, prefix##max_epu8(x, y)) \
+        VectorSimdCase(VectorMaxU, 2, width, prefix, prefix##max_epu16(x, y)) \
+        VectorSimdCase(VectorMaxU, 4, width, prefix, prefix##max_epu32(x, y)) \
+        VectorSimdCase(VectorMax, 1, width, prefix, prefix##max_epi8(x, y)) \
+        VectorSimdCase(VectorMax, 2, width, prefix, prefix##max_epi16(x, y)) \
+        VectorSimdCase(VectorMax, 4, width, prefix, prefix##max_epi32(x, y)) \
+        VectorSimdLogicCases(VectorAnd, width, prefix, prefix##and_si##width(x, y)) \
+        VectorSimdLogicCases(VectorOr, width, prefix, prefix##or_si##width(x, y)) \
+        VectorSimdLogicCases(VectorXor, width, prefix, prefix##xor_si##width(x, y)) \
+        VectorSimdCase(VectorMul, 2, width, prefix, prefix##mullo_epi16(x, y)) \
+        VectorSimdCase(VectorMul, 4, width, prefix, prefix##mullo_epi32(x, y)) \
+    } \
+    return i; \
+}
+
+#define VectorFloatSimdCase(operation, width, prefix, expression) \
+    case operation*16+4: \
+        for(; i+width/32 <= count; i += width/32) { \
+            __m##width x = prefix##loadu_ps(reinterpret_cast<const float*>(a+i)), \
+                       y = prefix##loadu_ps(reinterpret_cast<const float*>(b+i)); \
+            prefix##storeu_ps(reinterpret_cast<float*>(dst+i), expression); \
+        } \
+    break;
+
+#define VectorDoubleSimdCase(operation, width, prefix, expression) \
+    case operation*16+8: \
+        for(; i+width/64 <= count; i += width/64) { \
+            __m##width##d x = prefix##loadu_pd(reinterpret_cast<const double*>(a+i)), \
+                          y = prefix##loadu_pd(reinterpret_cast<const double*>(b+i)); \
+            prefix##storeu_pd(reinterpret_cast<double*>(dst+i), expression); \
+        } \
+    break;
+
+#define VectorFloatSimdKernel(name, width, prefix) \
+template<typename type> \
+UInt32 name(VectorFloatOperation op, type* dst, const type* a, const type* b, UInt32 count) { \
+    UInt32 i = 0; \
+    switch(op*16+sizeof(type)) { \
+        VectorFloatSimdCase(VectorFloatAdd, width, prefix, prefix##add_ps(x, y)) \
+        VectorDoubleSimdCase(VectorFloatAdd, width, prefix, prefix##add_pd(x, y)) \
+        VectorFloatSimdCase(VectorFloatSub, width, prefix, prefix##sub_ps(x, y)) \
+        VectorDoubleSimdCase(VectorFloatSub, width, prefix, prefix##sub_pd(x, y)) \
+        VectorFloatSimdCase(VectorFloatReverseSub, width, prefix, prefix##sub_ps(y, x)) \
+        VectorDoubleSimdCase(VectorFloatReverseSub, width, prefix, prefix##sub_pd(y, x)) \
+        VectorFloatSimdCase(VectorFloatMul, width, prefix, prefix##mul_ps(x, y)) \
+        VectorDoubleSimdCase(VectorFloatMul, width, prefix, prefix##mul_pd(x, y)) \
+        VectorFloatSimdCase(VectorFloatDiv, width, prefix, prefix##div_ps(x, y)) \
+        VectorDoubleSimdCase(VectorFloatDiv, width, prefix, prefix##div_pd(x, y)) \
+        VectorFloatSimdCase(VectorFloatReverseDiv, width, prefix, prefix##div_ps(y, x)) \
+        VectorDoubleSimdCase(VectorFloatReverseDiv, width, prefix, prefix##div_pd(y, x)) \
+    } \
+    return i; \
+}
+
+#if defined(__AVX2__)
+VectorSimdKernel(vectorSimdKernel, 256, _mm256_)
+VectorFloatSimdKernel(vectorFloatSimdKernel, 256, _mm256_)
+#elif defined(__SSE4_1__)
+VectorSimdKernel(vectorSimdKernel, 128, _mm_)
+VectorFloatSimdKernel(vectorFloatSimdKernel, 128, _mm_)
+#else
+template<typename type>
+UInt32 vectorSimdKernel(VectorOperation, type*, const type*, const type*, UInt32) {
+    return 0;
+}
+
+template<typename type>
+UInt32 vectorFloatSimdKernel(VectorFloatOperation, type*, const type*, const type*, UInt32) {
+    return 0;
+}
+#endif
+
+template<typename type>
+void vectorArithmetic(VectorOperation op, type* dst, const type* a, const type* b,
+                      UInt32 start, UInt32 end, const UInt8* mask, bool& saturated) {
+    if(!mask && start == 0)
+        start = vectorSimdKernel(op, dst, a, b, end);
+    for(UInt32 i = start; i < end; ++i)
+        if(vectorMaskActive(mask, i))
+            dst[i] = vectorElementOperation(op, a[i], b[i], saturated);
+}
+
+template<typename type>
+void vectorFloatArithmetic(VectorFloatOperation op, type* dst, const type* a, const type* b,
+                           UInt32 start, UInt32 end, const UInt8* mask) {
+    if(!mask && start == 0)
+        start = vectorFloatSimdKernel(op, dst, a, b, end);
+    for(UInt32 i = start; i < end; ++i)
+        if(vectorMaskActive(mask, i))
+            dst[i] = vectorFloatElementOperation(op, a[i], b[i]);
+}
+
+template<typename type, typename operation_type, typename element_operation>
+void vectorCompare(operation_type op, UInt8* dst, const type* a, const type* b,
+                   UInt32 start, UInt32 end, const UInt8* mask, element_operation elementOperation) {
+    for(UInt32 i = start; i < end; ++i)
+        if(vectorMaskActive(mask, i)) {
+            bool value = elementOperation(op, a[i], b[i]);
+            dst[i/8] = (dst[i/8]&~(1U<<(i%8)))|(static_cast<UInt8>(value)<<(i%8));
+        }
+}
+
+template<typename type>
+void vectorBroadcast(type* dst, type value, UInt32 end) {
+    for(UInt32 i = 0; i < end; ++i)
+        dst[i] = value;
+}
+
+#endif
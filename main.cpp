@@ -2,9 +2,451 @@
 #include <elfio/elfio.hpp>
 
 Ram ram;
+Bus bus;
 Cpu<> cpu;
 
+UInt32 encodeBenchmarkInstruction(UInt8 opcode, UInt8 funct3, UInt8 funct7, UInt8 rd, UInt8 rs1, UInt8 rs2, Int32 imm) {
+    Instruction instruction;
+    instruction.opcode = opcode;
+    instruction.reg[0] = rd;
+    instruction.reg[1] = rs1;
+    instruction.reg[2] = rs2;
+    instruction.imm = imm;
+    if(instruction.getType() == Instruction::R) {
+        instruction.funct[0] = funct7;
+        instruction.funct[1] = funct3;
+    }else
+        instruction.funct[0] = funct3;
+    return instruction.encode32();
+}
+
+template<UInt8 XLEN>
+double runBenchmark(const UInt32* program, UInt8 length, UInt64 iterations, bool macroOpFusion, bool fastmem, bool profile = false) {
+    Cpu<XLEN, (ISAExtensions)(I_BaseISA|M_MultiplyAndDivide)> cpu;
+    Profiler profiler;
+    cpu.macroOpFusion = macroOpFusion;
+    if(fastmem)
+        cpu.enableFastmem();
+    if(profile)
+        cpu.profiler = &profiler;
+    const UInt64 end = cpu.pc+length*sizeof(UInt32);
+    for(UInt8 i = 0; i < length; ++i)
+        ram.set<UInt32, false>(cpu.pc+i*sizeof(UInt32), const_cast<UInt32*>(&program[i]));
+    cpu.regX[1].U = iterations;
+    cpu.regX[2].U = 0x1000;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    while(cpu.pc != end && cpu.fetchAndExecute());
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-start).count();
+    // Every retired instruction counts one cycle, also the second half of a fused pair
+    return cpu.csr.cycle*1e3/elapsed;
+}
+
+template<UInt8 XLEN>
+void benchmark(UInt64 iterations) {
+    const UInt8 width = (XLEN == 32) ? 2 : 3;
+    const UInt32 arithmetic[] = {
+        encodeBenchmarkInstruction(0x63, 0, 0, 0, 1, 0, 52), // BEQ x1,x0,+52
+        encodeBenchmarkInstruction(0x33, 0, 1, 3, 1, 1, 0), // MUL x3,x1,x1
+        encodeBenchmarkInstruction(0x33, 3, 1, 4, 3, 1, 0), // MULHU x4,x3,x1
+        encodeBenchmarkInstruction(0x33, 1, 1, 4, 4, 3, 0), // MULH x4,x4,x3
+        encodeBenchmarkInstruction(0x33, 5, 1, 5, 3, 2, 0), // DIVU x5,x3,x2
+        encodeBenchmarkInstruction(0x33, 6, 1, 6, 3, 2, 0), // REM x6,x3,x2
+        encodeBenchmarkInstruction(0x33, 0, 0, 7, 7, 5, 0), // ADD x7,x7,x5
+        encodeBenchmarkInstruction(0x33, 5, 32, 8, 4, 1, 0), // SRA x8,x4,x1
+        encodeBenchmarkInstruction(0x23, width, 0, 0, 2, 7, 0), // SW/SD x7,0(x2)
+        encodeBenchmarkInstruction(0x03, width, 0, 9, 2, 0, 0), // LW/LD x9,0(x2)
+        encodeBenchmarkInstruction(0x33, 4, 0, 7, 9, 8, 0), // XOR x7,x9,x8
+        encodeBenchmarkInstruction(0x13, 0, 0, 1, 1, 0, -1), // ADDI x1,x1,-1
+        encodeBenchmarkInstruction(0x6F, 0, 0, 0, 0, 0, -48) // JAL x0,-48
+    };
+    // Instruction pairs as emitted by compilers, which are subject to macro-op fusion
+    const UInt32 idioms[] = {
+        encodeBenchmarkInstruction(0x63, 0, 0, 0, 1, 0, 64), // BEQ x1,x0,+64
+        encodeBenchmarkInstruction(0x37, 0, 0, 3, 0, 0, 0x12345000), // LUI x3,0x12345
+        encodeBenchmarkInstruction(0x13, 0, 0, 3, 3, 0, 0x678), // ADDI x3,x3,0x678
+        encodeBenchmarkInstruction(0x13, 1, 0, 4, 1, 0, XLEN/2), // SLLI x4,x1,XLEN/2
+        encodeBenchmarkInstruction(0x13, 5, 0, 4, 4, 0, XLEN/2), // SRLI x4,x4,XLEN/2
+        encodeBenchmarkInstruction(0x33, 3, 0, 5, 4, 3, 0), // SLTU x5,x4,x3
+        encodeBenchmarkInstruction(0x63, 1, 0, 0, 5, 0, 8), // BNE x5,x0,+8
+        encodeBenchmarkInstruction(0x33, 0, 0, 6, 6, 4, 0), // ADD x6,x6,x4
+        encodeBenchmarkInstruction(0x17, 0, 0, 7, 0, 0, 0), // AUIPC x7,0
+        encodeBenchmarkInstruction(0x03, width, 0, 8, 7, 0, 0), // LW/LD x8,0(x7)
+        encodeBenchmarkInstruction(0x33, 0, 0, 6, 6, 8, 0), // ADD x6,x6,x8
+        encodeBenchmarkInstruction(0x17, 0, 0, 9, 0, 0, 0), // AUIPC x9,0
+        encodeBenchmarkInstruction(0x67, 0, 0, 0, 9, 0, 12), // JALR x0,x9,12
+        encodeBenchmarkInstruction(0x13, 0, 0, 6, 6, 0, 1), // ADDI x6,x6,1
+        encodeBenchmarkInstruction(0x13, 0, 0, 1, 1, 0, -1), // ADDI x1,x1,-1
+        encodeBenchmarkInstruction(0x6F, 0, 0, 0, 0, 0, -60) // JAL x0,-60
+    };
+    double arithmeticMIPS = runBenchmark<XLEN>(arithmetic, sizeof(arithmetic)/sizeof(UInt32), iterations, true, false),
+           fastmemArithmeticMIPS = runBenchmark<XLEN>(arithmetic, sizeof(arithmetic)/sizeof(UInt32), iterations, true, true),
+           profiledArithmeticMIPS = runBenchmark<XLEN>(arithmetic, sizeof(arithmetic)/sizeof(UInt32), iterations, true, false, true),
+           idiomsMIPS = runBenchmark<XLEN>(idioms, sizeof(idioms)/sizeof(UInt32), iterations, true, false),
+           unfusedIdiomsMIPS = runBenchmark<XLEN>(idioms, sizeof(idioms)/sizeof(UInt32), iterations, false, false);
+    printf("RV%d: arithmetic %.2f MIPS (%.2f MIPS with fastmem, %.2f MIPS with profiling), idioms %.2f MIPS (%.2f MIPS without macro-op fusion)\n", XLEN,
+           arithmeticMIPS, fastmemArithmeticMIPS, profiledArithmeticMIPS, idiomsMIPS, unfusedIdiomsMIPS);
+}
+
+const ISAExtensions linuxUserExtensions = (ISAExtensions)(A_AtomicOperations|C_CompressedInstructions|D_DoubleFloat|F_Float|I_BaseISA|M_MultiplyAndDivide|U_UserMode);
+
+// Filled by the command line options of --linux-user
+struct LinuxUserOptions {
+    bool highLevelEmulation = false, profile = false, mix = false, simulateCaches = false, simulatePipeline = false;
+    const char *foldedStacksPath = NULL, *tracePath = NULL, *timelinePath = NULL;
+    CacheModel cacheModel;
+    std::unique_ptr<BranchPredictor> branchPredictor;
+    Pipeline pipeline;
+    Sampler sampler;
+    std::ofstream basicBlockVectors;
+    TraceRecorder traceRecorder;
+    Timeline timeline;
+    Timeline::Clock timelineClock = Timeline::InstructionsRetired;
+};
+
+template<UInt8 XLEN>
+bool runLinuxUser(const std::vector<std::string>& arguments, const std::vector<std::string>& environment, LinuxUserOptions& options, int& exitCode) {
+    bool highLevelEmulation = options.highLevelEmulation, profile = options.profile, mix = options.mix;
+    const char* foldedStacksPath = options.foldedStacksPath;
+    CacheModel* cacheModel = (options.simulateCaches) ? &options.cacheModel : NULL;
+    BranchPredictor* branchPredictor = options.branchPredictor.get();
+    Pipeline* pipeline = (options.simulatePipeline) ? &options.pipeline : NULL;
+    Sampler* sampler = (options.sampler.period || options.sampler.basicBlockVectors) ? &options.sampler : NULL;
+    TraceRecorder* traceRecorder = (options.tracePath) ? &options.traceRecorder : NULL;
+    Timeline* timeline = (options.timelinePath) ? &options.timeline : NULL;
+    Cpu<XLEN, linuxUserExtensions> cpu;
+    LinuxUser linuxUser;
+    Disassembler disassembler;
+    Profiler profiler;
+    CallStackProfiler callStackProfiler;
+    InstructionMix instructionMix;
+    if(!linuxUser.load(cpu, arguments[0], arguments, environment))
+        return false;
+    if(highLevelEmulation || profile || foldedStacksPath || cacheModel || branchPredictor)
+        disassembler.readSymbolsFromFile(arguments[0]);
+    if(highLevelEmulation)
+        cpu.addHighLevelRoutines(disassembler.symbols);
+    if(profile)
+        cpu.profiler = &profiler;
+    if(foldedStacksPath)
+        cpu.callStackProfiler = &callStackProfiler;
+    if(mix)
+        cpu.instructionMix = &instructionMix;
+    cpu.cacheModel = cacheModel;
+    cpu.branchPredictor = branchPredictor;
+    cpu.pipeline = pipeline;
+    cpu.traceRecorder = traceRecorder;
+    cpu.timeline = timeline;
+    if(sampler) {
+        sampler->cacheModel = cacheModel;
+        sampler->branchPredictor = branchPredictor;
+        sampler->pipeline = pipeline;
+        sampler->begin(cpu.pc, cpu.csr.cycle);
+        cpu.sampler = sampler;
+        cpu.updateSampledModels();
+    }
+    bool trapped = false;
+    while(!linuxUser.exited)
+        if(!cpu.fetchAndExecute()) {
+            fprintf(stderr, "Unhandled trap %llu at %llx\n", static_cast<unsigned long long>(cpu.csr.mcause),
+                    static_cast<unsigned long long>(cpu.csr.mepc));
+            trapped = true;
+            break;
+        }
+    exitCode = (trapped) ? 128 : linuxUser.exitCode;
+    if(sampler)
+        sampler->finish(cpu.csr.cycle);
+    if(traceRecorder && !traceRecorder->close())
+        fprintf(stderr, "Could not write the trace completely\n");
+    // Linux user binaries run without paging, so virtual addresses are physical
+    if(profile)
+        profiler.writeReport(std::cerr, disassembler, [](AddressType address, AddressType length) -> const UInt8* {
+            return ram.getHostPointer(address, length);
+        });
+    if(foldedStacksPath) {
+        std::ofstream file(foldedStacksPath);
+        callStackProfiler.writeFoldedStacks(file, disassembler.symbols);
+    }
+    if(mix)
+        instructionMix.writeReport(std::cerr);
+    if(cacheModel)
+        cacheModel->writeReport(std::cerr, disassembler.symbols);
+    if(branchPredictor)
+        branchPredictor->writeReport(std::cerr, disassembler.symbols);
+    if(pipeline)
+        pipeline->writeReport(std::cerr);
+    if(sampler)
+        sampler->writeReport(std::cerr);
+    if(traceRecorder)
+        traceRecorder->writeReport(std::cerr);
+    return true;
+}
+
+// Runs a bare metal executable in machine mode, loaded to the physical
+// addresses of its segments, until it exits through the Htif
+template<UInt8 XLEN>
+bool runHtif(const char* path, int& exitCode) {
+    Cpu<XLEN, linuxUserExtensions> cpu;
+    Htif htif;
+    ELFIO::elfio reader;
+    if(!reader.load(path) || reader.get_machine() != 243 ||
+       reader.get_class() != ((XLEN == 32) ? ELFCLASS32 : ELFCLASS64))
+        return false;
+    AddressType ramSize = static_cast<AddressType>(1)<<ram.size;
+    for(auto segment : reader.segments) {
+        if(segment->get_type() != PT_LOAD)
+            continue;
+        AddressType address = segment->get_physical_address();
+        if(address > ramSize || segment->get_memory_size() > ramSize-address)
+            return false;
+        ram.setBlock(address, segment->get_data(), segment->get_file_size());
+        memset(ram.data+address+segment->get_file_size(), 0, segment->get_memory_size()-segment->get_file_size());
+    }
+    cpu.htif = &htif;
+    cpu.pc = reader.get_entry();
+    while(!htif.exited)
+        if(!cpu.fetchAndExecute()) {
+            fprintf(stderr, "Unhandled trap %llu at %llx\n", static_cast<unsigned long long>(cpu.csr.mcause),
+                    static_cast<unsigned long long>(cpu.csr.mepc));
+            exitCode = 128;
+            return true;
+        }
+    exitCode = htif.exitCode;
+    return true;
+}
+
+// Measures how long it takes from loading an executable to its first
+// instruction, how many system calls per second it can make and how long
+// it takes to reset it to the loaded state afterwards
+void benchmarkLinuxUser(UInt64 iterations) {
+    const UInt32 program[] = {
+        encodeBenchmarkInstruction(0x13, 0, 0, 17, 0, 0, 172), // ADDI a7,x0,172 (getpid)
+        encodeBenchmarkInstruction(0x73, 0, 0, 0, 0, 0, 0), // ECALL
+        encodeBenchmarkInstruction(0x13, 0, 0, 8, 8, 0, -1), // ADDI s0,s0,-1
+        encodeBenchmarkInstruction(0x63, 1, 0, 0, 8, 0, -12), // BNE s0,x0,-12
+        encodeBenchmarkInstruction(0x13, 0, 0, 17, 0, 0, 93), // ADDI a7,x0,93 (exit)
+        encodeBenchmarkInstruction(0x13, 0, 0, 10, 0, 0, 0), // ADDI a0,x0,0
+        encodeBenchmarkInstruction(0x73, 0, 0, 0, 0, 0, 0) // ECALL
+    };
+    ELFIO::elfio writer;
+    writer.create(ELFCLASS64, ELFDATA2LSB);
+    writer.set_os_abi(ELFOSABI_LINUX);
+    writer.set_type(ET_EXEC);
+    writer.set_machine(243);
+    ELFIO::section* text_sec = writer.sections.add(".text");
+    text_sec->set_type(SHT_PROGBITS);
+    text_sec->set_flags(SHF_ALLOC|SHF_EXECINSTR);
+    text_sec->set_addr_align(4);
+    text_sec->set_data(reinterpret_cast<const char*>(program), sizeof(program));
+    ELFIO::segment* text_seg = writer.segments.add();
+    text_seg->set_type(PT_LOAD);
+    text_seg->set_virtual_address(0x10000);
+    text_seg->set_physical_address(0x10000);
+    text_seg->set_flags(PF_X|PF_R);
+    text_seg->set_align(0x1000);
+    text_seg->add_section_index(text_sec->get_index(), text_sec->get_addr_align());
+    writer.set_entry(0x10000);
+    std::string path = "/tmp/riscv-linux-user-benchmark-"+std::to_string(getpid());
+    writer.save(path);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    Cpu<64, linuxUserExtensions> cpu;
+    LinuxUser linuxUser;
+    bool loaded = linuxUser.load(cpu, path, { path }, { });
+    auto loadElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-start).count();
+    unlink(path.c_str());
+    if(!loaded)
+        return;
+    cpu.regX[8].U = iterations;
+    Cpu<64, linuxUserExtensions>::Snapshot snapshot;
+    LinuxUser::Snapshot linuxUserSnapshot;
+    cpu.takeSnapshot(snapshot);
+    linuxUser.takeSnapshot(linuxUserSnapshot);
+    ram.takeSnapshot();
+    start = std::chrono::high_resolution_clock::now();
+    while(!linuxUser.exited && cpu.fetchAndExecute());
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-start).count();
+    UInt64 syscalls = linuxUser.syscalls, exitCode = linuxUser.exitCode, instret = cpu.csr.instret;
+    start = std::chrono::high_resolution_clock::now();
+    ram.restoreSnapshot();
+    cpu.restoreSnapshot(snapshot);
+    linuxUser.restoreSnapshot(linuxUserSnapshot);
+    auto resetElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-start).count();
+    // After the reset the program has to run exactly as before
+    while(!linuxUser.exited && cpu.fetchAndExecute());
+    ram.releaseSnapshot();
+    if(linuxUser.syscalls != syscalls || linuxUser.exitCode != exitCode || cpu.csr.instret != instret) {
+        printf("Linux user: The program ran differently after the reset\n");
+        return;
+    }
+    printf("Linux user: %.3f ms to the first instruction, %.2f million system calls per second, %.3f ms to reset\n",
+           loadElapsed*1e-6, syscalls*1e3/elapsed, resetElapsed*1e-6);
+}
+
+// Measures how long it takes to restore a checkpoint of the Ram in its
+// current size, of which a few scattered pages are in use
+void benchmarkCheckpoint() {
+    Cpu<64> cpu;
+    for(AddressType address = 0; address < (static_cast<AddressType>(1)<<ram.size); address += 1<<20)
+        ram.setBlock(address, &address, sizeof(address));
+    std::string path = "/tmp/riscv-checkpoint-benchmark-"+std::to_string(getpid());
+    if(!cpu.saveCheckpoint(path.c_str()))
+        return;
+    auto start = std::chrono::high_resolution_clock::now();
+    bool loaded = cpu.loadCheckpoint(path.c_str());
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now()-start).count();
+    unlink(path.c_str());
+    if(loaded)
+        printf("Checkpoint: %.3f ms to restore %llu MiB of Ram\n", elapsed*1e-6, (1ULL<<ram.size)>>20);
+}
+
+// Replays a memory access trace through the cache model
+bool replayTrace(const char* path, CacheModel& cacheModel) {
+    TraceReader reader;
+    TraceRecord record;
+    if(!reader.open(path))
+        return false;
+    UInt64 records = 0;
+    while(reader.next(record)) {
+        cacheModel.access(record.type == TraceRecord::Fetch, record.type >= TraceRecord::Store,
+                          record.physicalAddress, record.size, record.pc);
+        ++records;
+    }
+    std::cout << records << " records replayed" << std::endl;
+    cacheModel.writeReport(std::cout, {});
+    return true;
+}
+
 int main(int argc, char** argv) {
+    if(argc >= 2 && strcmp(argv[1], "--benchmark") == 0) {
+        UInt64 iterations = (argc >= 3) ? strtoull(argv[2], NULL, 10) : 1000000;
+        ram.setSize(16);
+        benchmark<32>(iterations);
+        benchmark<64>(iterations);
+        benchmark<128>(iterations);
+        ram.setSize(26);
+        benchmarkLinuxUser(iterations);
+        ram.setSize(32);
+        benchmarkCheckpoint();
+        return 0;
+    }
+
+    if(argc >= 3 && strcmp(argv[1], "--replay-trace") == 0) {
+        CacheModel cacheModel;
+        for(int index = 3; index+1 < argc && strcmp(argv[index], "--cache") == 0; index += 2)
+            if(!cacheModel.configure(argv[index+1])) {
+                fprintf(stderr, "Invalid cache configuration %s\n", argv[index+1]);
+                return 1;
+            }
+        if(!replayTrace(argv[2], cacheModel)) {
+            fprintf(stderr, "Could not read %s\n", argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+
+    if(argc >= 3 && strcmp(argv[1], "--linux-user") == 0) {
+        LinuxUserOptions options;
+        int first = 2;
+        for(; first < argc; ++first)
+            if(strcmp(argv[first], "--hle") == 0)
+                options.highLevelEmulation = true;
+            else if(strcmp(argv[first], "--profile") == 0)
+                options.profile = true;
+            else if(strcmp(argv[first], "--instruction-mix") == 0)
+                options.mix = true;
+            else if(strcmp(argv[first], "--caches") == 0)
+                options.simulateCaches = true;
+            else if(strcmp(argv[first], "--cache") == 0 && first+1 < argc) {
+                options.simulateCaches = true;
+                if(!options.cacheModel.configure(argv[++first])) {
+                    fprintf(stderr, "Invalid cache configuration %s\n", argv[first]);
+                    return 1;
+                }
+            }else if(strcmp(argv[first], "--branch-predictor") == 0 && first+1 < argc) {
+                DirectionPredictor* direction = BranchPredictor::createDirectionPredictor(argv[++first]);
+                if(!direction) {
+                    fprintf(stderr, "Unknown branch predictor %s\n", argv[first]);
+                    return 1;
+                }
+                options.branchPredictor.reset(new BranchPredictor(direction));
+            }else if(strcmp(argv[first], "--pipeline") == 0)
+                options.simulatePipeline = true;
+            else if(strcmp(argv[first], "--latency") == 0 && first+1 < argc) {
+                options.simulatePipeline = true;
+                if(!options.pipeline.configure(argv[++first])) {
+                    fprintf(stderr, "Invalid latency %s\n", argv[first]);
+                    return 1;
+                }
+            }else if(strcmp(argv[first], "--sample") == 0 && first+1 < argc) {
+                if(!options.sampler.configure(argv[++first])) {
+                    fprintf(stderr, "Invalid sampling %s\n", argv[first]);
+                    return 1;
+                }
+            }else if(strcmp(argv[first], "--bbv") == 0 && first+1 < argc) {
+                options.basicBlockVectors.open(argv[++first]);
+                if(!options.basicBlockVectors) {
+                    fprintf(stderr, "Could not open %s\n", argv[first]);
+                    return 1;
+                }
+                options.sampler.basicBlockVectors = &options.basicBlockVectors;
+            }else if(strcmp(argv[first], "--interval") == 0 && first+1 < argc) {
+                options.sampler.interval = strtoull(argv[++first], NULL, 0);
+                if(options.sampler.interval == 0) {
+                    fprintf(stderr, "Invalid interval %s\n", argv[first]);
+                    return 1;
+                }
+            }else if(strcmp(argv[first], "--timeline") == 0 && first+1 < argc)
+                options.timelinePath = argv[++first];
+            else if(strcmp(argv[first], "--timeline-clock") == 0 && first+1 < argc) {
+                if(strcmp(argv[++first], "instret") == 0)
+                    options.timelineClock = Timeline::InstructionsRetired;
+                else if(strcmp(argv[first], "time") == 0)
+                    options.timelineClock = Timeline::GuestTime;
+                else {
+                    fprintf(stderr, "Unknown timeline clock %s\n", argv[first]);
+                    return 1;
+                }
+            }else if(strcmp(argv[first], "--trace") == 0 && first+1 < argc)
+                options.tracePath = argv[++first];
+            else if(strcmp(argv[first], "--folded-stacks") == 0 && first+1 < argc)
+                options.foldedStacksPath = argv[++first];
+            else
+                break;
+        std::vector<std::string> arguments(argv+first, argv+argc), environment;
+        if(arguments.empty())
+            return 1;
+        for(char** variable = environ; *variable; ++variable)
+            environment.push_back(*variable);
+        if(options.tracePath && !options.traceRecorder.open(options.tracePath)) {
+            fprintf(stderr, "Could not open %s\n", options.tracePath);
+            return 1;
+        }
+        int exitCode;
+        ram.setSize(30);
+        if(!runLinuxUser<64>(arguments, environment, options, exitCode) &&
+           !runLinuxUser<32>(arguments, environment, options, exitCode)) {
+            fprintf(stderr, "Could not load %s\n", arguments[0].c_str());
+            return 1;
+        }
+        if(options.timelinePath) {
+            std::ofstream file(options.timelinePath);
+            Timeline::writeChromeTrace(file, { &options.timeline }, options.timelineClock);
+        }
+        return exitCode;
+    }
+
+    // The Htif lets the guest open, create and overwrite host files
+    if(argc == 3 && strcmp(argv[1], "--htif") == 0) {
+        int exitCode;
+        ram.setSize(30);
+        if(!runHtif<64>(argv[2], exitCode) && !runHtif<32>(argv[2], exitCode)) {
+            fprintf(stderr, "Could not load %s\n", argv[2]);
+            return 1;
+        }
+        return exitCode;
+    }
+
     /*if(argc == 4) {
         if(strcmp(argv[1], "--disassemble") == 0) {
             Disassembler disassembler;